@@ -0,0 +1,271 @@
+/*
+	Lexer throughput benchmark.
+
+	Generates a synthetic source file of the requested size and mix, tokenizes it with tokenize_file and
+	reports throughput. Build and run from the repository root on Linux:
+
+		cc -O2 -Isrc -o lex_bench bench/lex_bench.c src/tokenize.c src/symbol.c src/file_map.c src/scan.c src/parallel.c src/memstat.c -lpthread
+		./lex_bench [size] [mix] [iterations]
+
+	size is a byte count with an optional K, M or G suffix (default 16M).
+	mix is one of keyword, identifier, literal or mixed (default mixed).
+	The best of iterations runs (default 5) is reported. Allocation counts are only available with glibc.
+*/
+
+#define _GNU_SOURCE
+#include "tokenize.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __GLIBC__
+//Every allocation in the process goes through these, which forward to glibc's allocator
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+static uint64_t allocation_count;
+
+void *malloc(size_t size)
+{
+	allocation_count++;
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size)
+{
+	allocation_count++;
+	return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+	allocation_count++;
+	return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr)
+{
+	__libc_free(ptr);
+}
+#define ALLOCATIONS_COUNTED 1
+#else
+static uint64_t allocation_count;
+#define ALLOCATIONS_COUNTED 0
+#endif
+
+typedef enum
+{
+	MIX_KEYWORD,
+	MIX_IDENTIFIER,
+	MIX_LITERAL,
+	MIX_MIXED
+} CorpusMix;
+
+static uint64_t rng_state = 0x9E3779B97F4A7C15ull;
+
+static uint32_t rng_next()
+{
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 7;
+	rng_state ^= rng_state << 17;
+	return (uint32_t)(rng_state >> 32);
+}
+
+static const char *pick(const char **choices, int count)
+{
+	return choices[rng_next() % count];
+}
+
+static void write_identifier(FILE *file, int min_length, int max_length)
+{
+	static const char first[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ_";
+	static const char rest[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ_0123456789";
+	int length = min_length + rng_next() % (max_length - min_length + 1);
+
+	fputc(first[rng_next() % (sizeof(first) - 1)], file);
+	for (int i = 1; i < length; i++)
+		fputc(rest[rng_next() % (sizeof(rest) - 1)], file);
+}
+
+static void write_literal(FILE *file)
+{
+	switch (rng_next() % 3)
+	{
+	case 0:
+		fprintf(file, "%u", rng_next() % 65536);
+		break;
+	case 1:
+		fprintf(file, "0x%x", rng_next() % 65536);
+		break;
+	default:
+		fputc('"', file);
+		int length = rng_next() % 48;
+		for (int i = 0; i < length; i++)
+			fputc("abcdefghij klmnop,.;:()"[rng_next() % 23], file);
+		fputc('"', file);
+		break;
+	}
+}
+
+static void write_keyword_statement(FILE *file)
+{
+	static const char *types[] = { "i16", "u16", "i8", "u8", "bool", "void" };
+	static const char *values[] = { "true", "false", "null" };
+
+	switch (rng_next() % 4)
+	{
+	case 0:
+		fprintf(file, "%s x = %s;\n", pick(types, 6), pick(values, 3));
+		break;
+	case 1:
+		fprintf(file, "if (x == %s) { return %s; } else { break; }\n", pick(values, 3), pick(values, 3));
+		break;
+	case 2:
+		fprintf(file, "while (true) { continue; }\n");
+		break;
+	default:
+		fprintf(file, "static struct %s* @array;\n", pick(types, 6));
+		break;
+	}
+}
+
+static void write_identifier_statement(FILE *file)
+{
+	static const char *operators[] = { " + ", " * ", " == ", " != ", " && ", " || ", " <= ", " >= " };
+
+	write_identifier(file, 4, 32);
+	fputs(" = ", file);
+	int terms = 1 + rng_next() % 6;
+	for (int i = 0; i < terms; i++)
+	{
+		if (i > 0) fputs(pick(operators, 8), file);
+		write_identifier(file, 1, 24);
+	}
+	fputs(";\n", file);
+}
+
+static void write_literal_statement(FILE *file)
+{
+	fputs("x = ", file);
+	int terms = 1 + rng_next() % 6;
+	for (int i = 0; i < terms; i++)
+	{
+		if (i > 0) fputs(", ", file);
+		write_literal(file);
+	}
+	fputs(";\n", file);
+}
+
+static bool generate_corpus(const char *path, uint64_t size, CorpusMix mix)
+{
+	FILE *file = fopen(path, "wb");
+	if (!file) return false;
+
+	while ((uint64_t)ftell(file) < size)
+	{
+		CorpusMix statement = mix == MIX_MIXED ? rng_next() % 3 : mix;
+		if (statement == MIX_KEYWORD)
+			write_keyword_statement(file);
+		else if (statement == MIX_IDENTIFIER)
+			write_identifier_statement(file);
+		else
+			write_literal_statement(file);
+	}
+
+	fclose(file);
+	return true;
+}
+
+static uint64_t parse_size(const char *str)
+{
+	char *end;
+	uint64_t size = strtoull(str, &end, 10);
+	switch (*end)
+	{
+	case 'k': case 'K': return size << 10;
+	case 'm': case 'M': return size << 20;
+	case 'g': case 'G': return size << 30;
+	}
+	return size;
+}
+
+static double now_seconds()
+{
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return time.tv_sec + time.tv_nsec * 1e-9;
+}
+
+int main(int argc, char **argv)
+{
+	uint64_t size = argc > 1 ? parse_size(argv[1]) : 16 << 20;
+	const char *mix_name = argc > 2 ? argv[2] : "mixed";
+	int iterations = argc > 3 ? atoi(argv[3]) : 5;
+
+	CorpusMix mix;
+	if (!strcmp(mix_name, "keyword")) mix = MIX_KEYWORD;
+	else if (!strcmp(mix_name, "identifier")) mix = MIX_IDENTIFIER;
+	else if (!strcmp(mix_name, "literal")) mix = MIX_LITERAL;
+	else if (!strcmp(mix_name, "mixed")) mix = MIX_MIXED;
+	else
+	{
+		fprintf(stderr, "Unknown mix %s\n", mix_name);
+		return 1;
+	}
+
+	char path[] = "/tmp/lex_bench_XXXXXX";
+	int fd = mkstemp(path);
+	if (fd < 0 || !generate_corpus(path, size, mix))
+	{
+		fprintf(stderr, "Failed to generate corpus\n");
+		return 1;
+	}
+	close(fd);
+
+	double best_seconds = 0;
+	uint64_t bytes = 0;
+	int token_count = 0;
+	uint64_t allocations = 0;
+
+	for (int i = 0; i < iterations; i++)
+	{
+		TokenList list = token_list_create();
+		uint64_t allocations_before = allocation_count;
+		double start = now_seconds();
+		bool success = tokenize_file(path, &list);
+		double seconds = now_seconds() - start;
+
+		if (!success)
+		{
+			fprintf(stderr, "Failed to tokenize corpus\n");
+			return 1;
+		}
+
+		if (i == 0 || seconds < best_seconds)
+		{
+			best_seconds = seconds;
+			allocations = allocation_count - allocations_before;
+		}
+		bytes = list.source_length;
+		token_count = list.tokens.size;
+		token_list_free(&list);
+	}
+
+	remove(path);
+
+	printf("mix %s, %llu bytes, %d tokens, best of %d\n", mix_name, (unsigned long long)bytes, token_count, iterations);
+	printf("%.1f MB/s\n", bytes / best_seconds / 1e6);
+	printf("%.2f Mtokens/s\n", token_count / best_seconds / 1e6);
+	printf("%.2f ns/token\n", best_seconds * 1e9 / token_count);
+	if (ALLOCATIONS_COUNTED)
+		printf("%.6f allocations/token (%llu total)\n", (double)allocations / token_count, (unsigned long long)allocations);
+	else
+		printf("allocations/token unavailable\n");
+
+	return 0;
+}
@@ -0,0 +1,59 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include "arena.h"
+#include "memstat.h"
+
+#define ARENA_DEFAULT_CHUNK_SIZE 65536
+#define ARENA_ALIGNMENT 16
+
+struct ArenaChunk
+{
+	ArenaChunk *next;
+	size_t used;
+	size_t capacity;
+};
+
+//The chunk header is padded so the first allocation in a chunk is aligned
+#define CHUNK_HEADER_SIZE ((sizeof(ArenaChunk) + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1))
+
+Arena arena_create(size_t chunk_size)
+{
+	return (Arena)
+	{
+		.chunk_size = chunk_size ? chunk_size : ARENA_DEFAULT_CHUNK_SIZE
+	};
+}
+
+void arena_free(Arena *arena)
+{
+	ArenaChunk *chunk = arena->chunk;
+	while (chunk)
+	{
+		ArenaChunk *next = chunk->next;
+		mem_free(chunk);
+		chunk = next;
+	}
+	arena->chunk = NULL;
+}
+
+void *arena_alloc(Arena *arena, size_t size)
+{
+	size = (size + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+
+	ArenaChunk *chunk = arena->chunk;
+	if (!chunk || chunk->capacity - chunk->used < size)
+	{
+		//Allocations larger than a chunk get a chunk of their own
+		size_t capacity = size > arena->chunk_size ? size : arena->chunk_size;
+		chunk = mem_alloc(CHUNK_HEADER_SIZE + capacity);
+		if (!chunk) return NULL;
+		chunk->next = arena->chunk;
+		chunk->used = 0;
+		chunk->capacity = capacity;
+		arena->chunk = chunk;
+	}
+
+	void *memory = (char *)chunk + CHUNK_HEADER_SIZE + chunk->used;
+	chunk->used += size;
+	return memory;
+}
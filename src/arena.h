@@ -0,0 +1,24 @@
+#ifndef ARENA_H
+#define ARENA_H
+#include <stddef.h>
+
+//Region allocator. Allocations are bumped out of large chunks and are never freed one by one;
+//arena_free releases every chunk at once. One arena lives for a whole compilation, and the IR builder takes
+//the parameter lists of functions and the argument lists of calls from it.
+
+typedef struct ArenaChunk ArenaChunk;
+
+typedef struct
+{
+	//Newest chunk first. Allocations come from the newest chunk only.
+	ArenaChunk *chunk;
+	size_t chunk_size;
+} Arena;
+
+//chunk_size 0 picks the default. Nothing is allocated until the first arena_alloc.
+extern Arena arena_create(size_t chunk_size);
+extern void arena_free(Arena *arena);
+//Returns size bytes aligned for any type. The memory is not zeroed.
+extern void *arena_alloc(Arena *arena, size_t size);
+
+#endif
@@ -1,5 +1,6 @@
 #include "ast.h"
 #include "tokenize.h"
+#include "parallel.h"
 #include <stdlib.h>
 #include <stdio.h>
 
@@ -11,6 +12,8 @@ int type_descriptor_size(TypeDescriptor *descriptor)
 	{
 	case BASE_TYPE_VOID:
 		return 0;
+	case BASE_TYPE_U8:
+	case BASE_TYPE_S8:
 	case BASE_TYPE_U16:
 	case BASE_TYPE_S16:
 	case BASE_TYPE_BOOL:
@@ -20,7 +23,13 @@ int type_descriptor_size(TypeDescriptor *descriptor)
 	}
 }
 
-void pretty_print_tree(Node *node, FILE *file, int depth)
+static void print_token(TokenList *list, int token_index, FILE *file)
+{
+	Token *token = &list->tokens.data[token_index];
+	fprintf(file, " (%.*s)", (int)token->length, token_text(list, token));
+}
+
+static void print_node(TokenList *list, AstNode *node, FILE *file, int depth)
 {
 	for (int i = 0; i < depth; i++)
 	{
@@ -29,7 +38,8 @@ void pretty_print_tree(Node *node, FILE *file, int depth)
 	switch (node->type)
 	{
 	case NODE_VAR_DECL:
-		fprintf(file, "DECL (%s)", node->var_decl.var_name_token->name);
+		fputs("DECL", file);
+		print_token(list, node->value, file);
 		break;
 	case NODE_ADD:
 		fputs("ADD", file);
@@ -50,19 +60,23 @@ void pretty_print_tree(Node *node, FILE *file, int depth)
 		fputs("ASSIGN", file);
 		break;
 	case NODE_VAR:
-		fprintf(file, "VAR (%s)", node->variable.var_name_token->name);
+		fputs("VAR", file);
+		print_token(list, node->value, file);
 		break;
 	case NODE_NUMBER:
-		fprintf(file, "NUMBER (%s)", node->number.literal_token->name);
+		fputs("NUMBER", file);
+		print_token(list, node->value, file);
 		break;
 	case NODE_FUNC_CALL:
-		fprintf(file, "CALL (%s)", node->func_call.func_name_token->name);
+		fputs("CALL", file);
+		print_token(list, node->value, file);
 		break;
 	case NODE_COMMA:
 		fputs("COMMA", file);
 		break;
 	case NODE_FUNCTION:
-		fprintf(file, "FUNC (%s)", node->function.name_token->name);
+		fputs("FUNC", file);
+		print_token(list, node->value, file);
 		break;
 	case NODE_EXP_SEQ:
 		fputs("SEQ", file);
@@ -129,20 +143,104 @@ void pretty_print_tree(Node *node, FILE *file, int depth)
 		break;
 	}
 	fputs("\n", file);
+}
+
+typedef struct
+{
+	NodeIndex node;
+	int depth;
+} PrintEntry;
+
+VECTOR_DEFINE(PrintEntryVector, print_entry_vector, PrintEntry)
 
-	if (node->left)
-		pretty_print_tree(node->left, file, depth + 1);
-	if (node->right)
-		pretty_print_tree(node->right, file, depth + 1);
+//Prints the nodes in pre-order, each indented by its depth. The walk keeps its own stack, so deep trees
+//do not exhaust the C stack.
+void pretty_print_tree(TokenList *list, AstTree *tree, NodeIndex index, FILE *file, int depth)
+{
+	PrintEntryVector stack = print_entry_vector_create(0);
+	print_entry_vector_push(&stack, (PrintEntry){ .node = index, .depth = depth });
+	while (stack.size)
+	{
+		PrintEntry entry = print_entry_vector_pop(&stack);
+		AstNode *node = &tree->nodes.data[entry.node];
+		print_node(list, node, file, entry.depth);
+
+		//The right child is pushed first so the left one is printed first
+		if (node->right != NODE_INDEX_NONE)
+			print_entry_vector_push(&stack, (PrintEntry){ .node = node->right, .depth = entry.depth + 1 });
+		if (node->left != NODE_INDEX_NONE)
+			print_entry_vector_push(&stack, (PrintEntry){ .node = node->left, .depth = entry.depth + 1 });
+	}
+	print_entry_vector_free(&stack);
 }
 
 typedef struct
 {
 	bool success;
-	Node *node;
+	NodeIndex node;
 	int next_index;
 } AstBlockResult;
-AstBlockResult ast_block(Vector *tokens, int index);
+AstBlockResult ast_block(TokenVector *tokens, AstTree *tree, int index);
+
+//How a token is parsed when it starts an operand
+typedef enum
+{
+	OPERAND_NONE,
+	//A single token node, such as a literal
+	OPERAND_LEAF,
+	//A prefix operator applied to the operand that follows
+	OPERAND_PREFIX,
+	//A type keyword starting a variable declaration
+	OPERAND_TYPE,
+	//A variable or a function call
+	OPERAND_NAME,
+	//A cast or a parenthesized expression
+	OPERAND_PAREN
+} OperandKind;
+
+typedef struct
+{
+	uint8_t operand;
+	//Node built for OPERAND_LEAF and OPERAND_PREFIX
+	uint8_t operand_node;
+	//Binary operator node when the token follows an operand, NODE_INVALID if it ends the expression
+	uint8_t infix_node;
+	//Base type named by an OPERAND_TYPE keyword
+	uint8_t base_type;
+} TokenRule;
+
+//The parser picks every production from the type of the next token, so it never backtracks
+static const TokenRule token_rules[TOKEN_TYPE_COUNT] =
+{
+	[TOKEN_INT] = { OPERAND_LEAF, NODE_NUMBER },
+	[TOKEN_STR_LITERAL] = { OPERAND_LEAF, NODE_STRING },
+	[TOKEN_CONTINUE] = { OPERAND_LEAF, NODE_CONTINUE },
+	[TOKEN_TRUE] = { OPERAND_LEAF, NODE_TRUE },
+	[TOKEN_FALSE] = { OPERAND_LEAF, NODE_FALSE },
+	[TOKEN_NULL] = { OPERAND_LEAF, NODE_NULL },
+	[TOKEN_STAR] = { OPERAND_PREFIX, NODE_DEREF, NODE_MULTIPLY },
+	[TOKEN_AMP] = { OPERAND_PREFIX, NODE_REF },
+	[TOKEN_BOOL] = { OPERAND_TYPE, .base_type = BASE_TYPE_BOOL },
+	[TOKEN_U8] = { OPERAND_TYPE, .base_type = BASE_TYPE_U8 },
+	[TOKEN_I8] = { OPERAND_TYPE, .base_type = BASE_TYPE_S8 },
+	[TOKEN_U16] = { OPERAND_TYPE, .base_type = BASE_TYPE_U16 },
+	[TOKEN_I16] = { OPERAND_TYPE, .base_type = BASE_TYPE_S16 },
+	[TOKEN_VOID] = { OPERAND_TYPE, .base_type = BASE_TYPE_VOID },
+	[TOKEN_IDENTIFIER] = { OPERAND_NAME },
+	[TOKEN_OPEN_PAREN] = { OPERAND_PAREN },
+	[TOKEN_COMMA] = { .infix_node = NODE_COMMA },
+	[TOKEN_EQUAL] = { .infix_node = NODE_ASSIGN },
+	[TOKEN_LOGIC_OR] = { .infix_node = NODE_LOGIC_OR },
+	[TOKEN_LOGIC_AND] = { .infix_node = NODE_LOGIC_AND },
+	[TOKEN_CMP_EQ] = { .infix_node = NODE_CMP_EQ },
+	[TOKEN_CMP_NEQ] = { .infix_node = NODE_CMP_NEQ },
+	[TOKEN_CMP_LT] = { .infix_node = NODE_CMP_LT },
+	[TOKEN_CMP_GT] = { .infix_node = NODE_CMP_GT },
+	[TOKEN_CMP_LE] = { .infix_node = NODE_CMP_LE },
+	[TOKEN_CMP_GE] = { .infix_node = NODE_CMP_GE },
+	[TOKEN_PLUS] = { .infix_node = NODE_ADD },
+	[TOKEN_MINUS] = { .infix_node = NODE_SUBTRACT },
+};
 
 //Determins if the token represents a value
 bool token_is_value(Token *token)
@@ -166,36 +264,19 @@ typedef struct
 	TypeDescriptor type_descriptor;
 } TypeDescriptorParseResult;
 
-static TypeDescriptorParseResult parse_type_descriptor(Vector *tokens, int index)
+static TypeDescriptorParseResult parse_type_descriptor(TokenVector *tokens, int index)
 {
 	TypeDescriptorParseResult result = {0};
-	Token *token = vec_at(Token*, tokens, index);
+	Token *token = &tokens->data[index];
 
-	switch (token->type)
-	{
-	case TOKEN_BOOL:
-		result.type_descriptor.base_type = BASE_TYPE_BOOL;
-		index++;
-		break;
-	case TOKEN_U16:
-		result.type_descriptor.base_type = BASE_TYPE_U16;
-		index++;
-		break;
-	case TOKEN_I16:
-		result.type_descriptor.base_type = BASE_TYPE_S16;
-		index++;
-		break;
-	case TOKEN_VOID:
-		result.type_descriptor.base_type = BASE_TYPE_VOID;
-		index++;
-		break;
-	default:
+	if (token_rules[token->type].operand != OPERAND_TYPE)
 		return result;
-	}
+	result.type_descriptor.base_type = token_rules[token->type].base_type;
+	index++;
 
 	if (index >= tokens->size)
 		return result;
-	token = vec_at(Token*, tokens, index);
+	token = &tokens->data[index];
 
 	while (token->type == TOKEN_STAR)
 	{
@@ -203,7 +284,7 @@ static TypeDescriptorParseResult parse_type_descriptor(Vector *tokens, int index
 		index++;
 		if (index >= tokens->size)
 			return result;
-		token = vec_at(Token*, tokens, index);
+		token = &tokens->data[index];
 	}
 
 	result.next_index = index;
@@ -218,10 +299,10 @@ typedef struct
 	FuncDescriptor func_descriptor;
 } FunctionParseResult;
 
-static FunctionParseResult parse_function(Vector *tokens, int index)
+static FunctionParseResult parse_function(TokenVector *tokens, int index)
 {
 	FunctionParseResult result = {0};
-	Token *token = vec_at(Token*, tokens, index);
+	Token *token = &tokens->data[index];
 
 	TypeDescriptorParseResult return_type_result = parse_type_descriptor(tokens, index);
 	if (!return_type_result.success)
@@ -230,16 +311,16 @@ static FunctionParseResult parse_function(Vector *tokens, int index)
 		return result;
 	result.func_descriptor.return_type = return_type_result.type_descriptor;
 	index = return_type_result.next_index;
-	token = vec_at(Token*, tokens, index);
+	token = &tokens->data[index];
 
 	if (token->type != TOKEN_IDENTIFIER)
 		return result;
-	result.func_descriptor.name_token = token;
+	result.func_descriptor.name_token = index;
 
 	index++;
 	if (index >= tokens->size)
 		return result;
-	token = vec_at(Token*, tokens, index);
+	token = &tokens->data[index];
 
 	if (token->type != TOKEN_OPEN_PAREN)
 		return result;
@@ -247,7 +328,7 @@ static FunctionParseResult parse_function(Vector *tokens, int index)
 	index++;
 	if (index >= tokens->size)
 		return result;
-	token = vec_at(Token*, tokens, index);
+	token = &tokens->data[index];
 
 	if (token->type == TOKEN_CLOSE_PAREN)
 	{
@@ -257,7 +338,7 @@ static FunctionParseResult parse_function(Vector *tokens, int index)
 		return result;
 	}
 
-	result.func_descriptor.parameters = vec_new(FuncParamDescriptor, 1);
+	result.func_descriptor.parameters = func_param_vector_create();
 	while (1)
 	{
 		FuncParamDescriptor func_param = {0};
@@ -266,15 +347,15 @@ static FunctionParseResult parse_function(Vector *tokens, int index)
 		if (param_type_result.next_index >= tokens->size) goto err_cleanup;
 		func_param.type = param_type_result.type_descriptor;
 		index = param_type_result.next_index;
-		token = vec_at(Token*, tokens, index);
+		token = &tokens->data[index];
 
 		if (token->type != TOKEN_IDENTIFIER) goto err_cleanup;
-		func_param.name_token = token;
+		func_param.name_token = index;
 		index++;
 		if (index >= tokens->size) goto err_cleanup;
-		token = vec_at(Token*, tokens, index);
+		token = &tokens->data[index];
 
-		vec_push(FuncParamDescriptor, &result.func_descriptor.parameters, &func_param);
+		func_param_vector_push(&result.func_descriptor.parameters, func_param);
 
 		if (token->type == TOKEN_COMMA)
 		{
@@ -295,24 +376,15 @@ static FunctionParseResult parse_function(Vector *tokens, int index)
 	return result;
 
 	err_cleanup:
-	vec_free(&result.func_descriptor.parameters);
+	func_param_vector_free(&result.func_descriptor.parameters);
 	result.success = false;
 	return result;
 }
 
-void free_tree(Node *tree)
-{
-	if (tree->left)
-		free_tree(tree->left);
-	if (tree->right)
-		free_tree(tree->right);
-	free(tree);
-}
-
-int node_precedence(Node *node)
+int node_precedence(NodeType type)
 {
 
-	switch (node->type)
+	switch (type)
 	{
 	case NODE_COMMA:
 		return 0;
@@ -351,433 +423,253 @@ int node_precedence(Node *node)
 	return 0;
 }
 
-//TODO: It's possible for the user to pass in bogus input with parentesis and cause memory leaks
-Node *append_tree(Node *tree, Node *leaf)
+//Appends a node after its children, which keeps the pool in post-order
+static NodeIndex add_node(AstTree *tree, NodeType type, NodeIndex left, NodeIndex right, uint32_t value)
 {
-	int leaf_precedence = node_precedence(leaf);
-
-	Node *current_node = tree;
-	int current_precedence = 0;
-	while ((current_precedence = node_precedence(current_node)) < leaf_precedence && current_node->right && !current_node->paren ||
-			//Precedence level 1 operators are evaluated right to left (eg. =, +=, *=, etc.)
-			current_precedence | leaf_precedence == 1 && current_node->right)
-		current_node = current_node->right;
-
-	if ((current_precedence < leaf_precedence && !current_node->paren) || leaf->paren) 
+	ast_node_vector_push(&tree->nodes, (AstNode)
 	{
-		if (!current_node->left)
-			current_node->left = leaf;
-		else
-			current_node->right = leaf;
-		leaf->up = current_node;
-		return tree;
-	}
-
-	if (current_node->up)
-		current_node->up->right = leaf;
-	leaf->up = current_node->up;
-	leaf->left = current_node;
-	current_node->up = leaf;
-	if (current_node == tree)
-		return leaf;
-	return tree;
+		.type = type,
+		.value = value,
+		.left = left,
+		.right = right
+	});
+	return tree->nodes.size - 1;
 }
 
 typedef struct
 {
 	bool success;
 	int next_index;
-	Node *node;
+	NodeIndex node;
 } ParseExpressionResult;
 
-ParseExpressionResult parse_expression(Vector *tokens, int index)
+//An operator that is waiting for its operand. Prefix operators and casts have no left operand.
+typedef struct
 {
-	Node *tree = NULL;
-
-	while(1)
-	{
-		Token *token = vec_at(Token*, tokens, index);
-
-		//Check for variable declaration
-		TypeDescriptorParseResult parse_type_result = parse_type_descriptor(tokens, index);
-		if (parse_type_result.success &&
-			parse_type_result.next_index < tokens->size &&
-			vec_at(Token*, tokens, parse_type_result.next_index)->type == TOKEN_IDENTIFIER)
-		{
-			Node *node = malloc(sizeof(Node));
-			*node = (Node){ .type = NODE_VAR_DECL };
-			node->var_decl.var_type = parse_type_result.type_descriptor;
-			node->var_decl.var_name_token = vec_at(Token*, tokens, parse_type_result.next_index);
-			tree = (tree == NULL ? node : append_tree(tree, node));
-			index = parse_type_result.next_index + 1;
-			if (index >= tokens->size) goto err_cleanup;
-			continue;
-		}
-
-		//Check for a cast
-		if (token->type == TOKEN_OPEN_PAREN)
-		{
-			int cast_index = index + 1;
-			if (cast_index >= tokens->size) goto not_cast;
-			TypeDescriptorParseResult type_result = parse_type_descriptor(tokens, cast_index);
-			if (!type_result.success) goto not_cast;
-			cast_index = type_result.next_index;
-			if (cast_index >= tokens->size) goto not_cast;
-
-			token = vec_at(Token*, tokens, cast_index);
-			if (token->type != TOKEN_CLOSE_PAREN) goto not_cast;
-			cast_index++;
-			if (cast_index >= tokens->size) goto not_cast;
-
-			token = vec_at(Token*, tokens, cast_index);
-			if (token->type != TOKEN_OPEN_PAREN && !token_is_value(token)) goto not_cast;
-
-			Node *node = malloc(sizeof(Node));
-			*node = (Node){ .type = NODE_CAST };
-			node->cast.cast_type = type_result.type_descriptor;
-			tree = (tree == NULL ? node : append_tree(tree, node));
-			index = cast_index;
-			continue;
-		}
-		not_cast:
-
-		if (token->type == TOKEN_STR_LITERAL)
-		{
-			Node *node = malloc(sizeof(Node));
-			*node = (Node){ .type = NODE_STRING };
-			node->string.literal_token = token;
-			tree = (tree == NULL ? node : append_tree(tree, node));
-			index++;
-			if (index >= tokens->size) goto err_cleanup;
-			continue;
-		}
-
-		if (token->type == TOKEN_CONTINUE)
-		{
-			Node *node = malloc(sizeof(Node));
-			*node = (Node){ .type = NODE_CONTINUE };
-			tree = (tree == NULL ? node : append_tree(tree, node));
-			index++;
-			if (index >= tokens->size) goto err_cleanup;
-			continue;
-		}
-
-		if (token->type == TOKEN_TRUE)
-		{
-			Node *node = malloc(sizeof(Node));
-			*node = (Node){ .type = NODE_TRUE };
-			tree = (tree == NULL ? node : append_tree(tree, node));
-			index++;
-			if (index >= tokens->size) goto err_cleanup;
-			continue;
-		}
-
-		if (token->type == TOKEN_FALSE)
-		{
-			Node *node = malloc(sizeof(Node));
-			*node = (Node){ .type = NODE_FALSE };
-			tree = (tree == NULL ? node : append_tree(tree, node));
-			index++;
-			if (index >= tokens->size) goto err_cleanup;
-			continue;
-		}
-
-		if (token->type == TOKEN_NULL)
-		{
-			Node *node = malloc(sizeof(Node));
-			*node = (Node){ .type = NODE_NULL };
-			tree = (tree == NULL ? node : append_tree(tree, node));
-			index++;
-			if (index >= tokens->size) goto err_cleanup;
-			continue;
-		}
-
-		if (token->type == TOKEN_CMP_EQ)
-		{
-			Node *node = malloc(sizeof(Node));
-			*node = (Node){ .type = NODE_CMP_EQ };
-			tree = (tree == NULL ? node : append_tree(tree, node));
-			index++;
-			if (index >= tokens->size) goto err_cleanup;
-			continue;
-		}
-
-		if (token->type == TOKEN_CMP_NEQ)
-		{
-			Node *node = malloc(sizeof(Node));
-			*node = (Node){ .type = NODE_CMP_NEQ };
-			tree = (tree == NULL ? node : append_tree(tree, node));
-			index++;
-			if (index >= tokens->size) goto err_cleanup;
-			continue;
-		}
+	uint8_t type;
+	//Target type of NODE_CAST
+	uint8_t base_type;
+	uint16_t ptr_count;
+	int token_index;
+	NodeIndex left;
+	//Minimum precedence of the expression a binary operator continues once its right operand is parsed
+	int min_precedence;
+} PendingOperator;
+
+SMALL_VECTOR_DEFINE(PendingOperatorVector, pending_operator_vector, PendingOperator, 16)
+
+static ParseExpressionResult parse_binary(TokenVector *tokens, AstTree *tree, int index, int min_precedence);
+
+//A type keyword after the parenthesis makes it a cast if the parenthesis closes right after the type
+//and an operand follows. The type is only parsed once that first token says it can be one.
+//Returns the index of the operand, or -1 if the parenthesis does not start a cast.
+static int parse_cast(TokenVector *tokens, int index, TypeDescriptor *type)
+{
+	if (index + 1 >= tokens->size || token_rules[tokens->data[index + 1].type].operand != OPERAND_TYPE) return -1;
 
-		if (token->type == TOKEN_CMP_LT)
-		{
-			Node *node = malloc(sizeof(Node));
-			*node = (Node){ .type = NODE_CMP_LT };
-			tree = (tree == NULL ? node : append_tree(tree, node));
-			index++;
-			if (index >= tokens->size) goto err_cleanup;
-			continue;
-		}
+	TypeDescriptorParseResult type_result = parse_type_descriptor(tokens, index + 1);
+	int cast_index = type_result.next_index;
+	if (!type_result.success || cast_index + 1 >= tokens->size || tokens->data[cast_index].type != TOKEN_CLOSE_PAREN) return -1;
 
-		if (token->type == TOKEN_CMP_GT)
-		{
-			Node *node = malloc(sizeof(Node));
-			*node = (Node){ .type = NODE_CMP_GT };
-			tree = (tree == NULL ? node : append_tree(tree, node));
-			index++;
-			if (index >= tokens->size) goto err_cleanup;
-			continue;
-		}
+	Token *next = &tokens->data[cast_index + 1];
+	if (next->type != TOKEN_OPEN_PAREN && !token_is_value(next) && token_rules[next->type].operand != OPERAND_PREFIX) return -1;
 
-		if (token->type == TOKEN_CMP_LE)
-		{
-			Node *node = malloc(sizeof(Node));
-			*node = (Node){ .type = NODE_CMP_LE };
-			tree = (tree == NULL ? node : append_tree(tree, node));
-			index++;
-			if (index >= tokens->size) goto err_cleanup;
-			continue;
-		}
+	*type = type_result.type_descriptor;
+	return cast_index + 1;
+}
 
-		if (token->type == TOKEN_CMP_GE)
-		{
-			Node *node = malloc(sizeof(Node));
-			*node = (Node){ .type = NODE_CMP_GE };
-			tree = (tree == NULL ? node : append_tree(tree, node));
-			index++;
-			if (index >= tokens->size) goto err_cleanup;
-			continue;
-		}
+//Parses one operand without its prefix operators: a leaf, a declaration, a call or a parenthesized expression
+static ParseExpressionResult parse_operand(TokenVector *tokens, AstTree *tree, int index)
+{
+	if (index >= tokens->size) return (ParseExpressionResult){ .success = false };
+	Token *token = &tokens->data[index];
+	const TokenRule *rule = &token_rules[token->type];
 
-		if (token->type == TOKEN_LOGIC_AND)
+	switch (rule->operand)
+	{
+	case OPERAND_LEAF:
+	{
+		NodeIndex node = add_node(tree, rule->operand_node, NODE_INDEX_NONE, NODE_INDEX_NONE, index);
+		return (ParseExpressionResult){ .success = true, .next_index = index + 1, .node = node };
+	}
+	case OPERAND_TYPE:
+	{
+		TypeDescriptorParseResult type_result = parse_type_descriptor(tokens, index);
+		if (!type_result.success || type_result.next_index >= tokens->size || tokens->data[type_result.next_index].type != TOKEN_IDENTIFIER)
+			return (ParseExpressionResult){ .success = false };
+
+		NodeIndex node = add_node(tree, NODE_VAR_DECL, NODE_INDEX_NONE, NODE_INDEX_NONE, type_result.next_index);
+		tree->nodes.data[node].base_type = type_result.type_descriptor.base_type;
+		tree->nodes.data[node].ptr_count = type_result.type_descriptor.ptr_count;
+		return (ParseExpressionResult){ .success = true, .next_index = type_result.next_index + 1, .node = node };
+	}
+	case OPERAND_NAME:
+	{
+		if (index + 1 >= tokens->size || tokens->data[index + 1].type != TOKEN_OPEN_PAREN)
 		{
-			Node *node = malloc(sizeof(Node));
-			*node = (Node){ .type = NODE_LOGIC_AND };
-			tree = (tree == NULL ? node : append_tree(tree, node));
-			index++;
-			if (index >= tokens->size) goto err_cleanup;
-			continue;
+			NodeIndex node = add_node(tree, NODE_VAR, NODE_INDEX_NONE, NODE_INDEX_NONE, index);
+			return (ParseExpressionResult){ .success = true, .next_index = index + 1, .node = node };
 		}
 
-		if (token->type == TOKEN_LOGIC_OR)
+		//Function call. The arguments are one comma expression.
+		int name_token = index;
+		index += 2;
+		NodeIndex arguments = NODE_INDEX_NONE;
+		if (index < tokens->size && tokens->data[index].type != TOKEN_CLOSE_PAREN)
 		{
-			Node *node = malloc(sizeof(Node));
-			*node = (Node){ .type = NODE_LOGIC_OR };
-			tree = (tree == NULL ? node : append_tree(tree, node));
-			index++;
-			if (index >= tokens->size) goto err_cleanup;
-			continue;
+			ParseExpressionResult argument_result = parse_binary(tokens, tree, index, 0);
+			if (!argument_result.success) return argument_result;
+			arguments = argument_result.node;
+			index = argument_result.next_index;
 		}
+		if (index >= tokens->size || tokens->data[index].type != TOKEN_CLOSE_PAREN)
+			return (ParseExpressionResult){ .success = false };
 
-		if (token->type == TOKEN_PLUS)
-		{
-			Node *node = malloc(sizeof(Node));
-			*node = (Node){ .type = NODE_ADD };
-			tree = (tree == NULL ? node : append_tree(tree, node));
-			index++;
-			if (index >= tokens->size) goto err_cleanup;
-			continue;
-		}
+		NodeIndex node = add_node(tree, NODE_FUNC_CALL, arguments, NODE_INDEX_NONE, name_token);
+		return (ParseExpressionResult){ .success = true, .next_index = index + 1, .node = node };
+	}
+	case OPERAND_PAREN:
+	{
+		ParseExpressionResult inner = parse_binary(tokens, tree, index + 1, 0);
+		if (!inner.success) return inner;
+		if (inner.next_index >= tokens->size || tokens->data[inner.next_index].type != TOKEN_CLOSE_PAREN)
+			return (ParseExpressionResult){ .success = false };
+		inner.next_index++;
+		return inner;
+	}
+	}
 
-		if (token->type == TOKEN_MINUS)
-		{
-			Node *node = malloc(sizeof(Node));
-			*node = (Node){ .type = NODE_SUBTRACT };
-			tree = (tree == NULL ? node : append_tree(tree, node));
-			index++;
-			if (index >= tokens->size) goto err_cleanup;
-			continue;
-		}
+	return (ParseExpressionResult){ .success = false };
+}
 
-		if (token->type == TOKEN_AMP)
-		{
-			Node *node = malloc(sizeof(Node));
-			*node = (Node){ .type = NODE_REF };
-			tree = (tree == NULL ? node : append_tree(tree, node));
-			index++;
-			if (index >= tokens->size) goto err_cleanup;
-			continue;
-		}
+//The binary operator that follows an operand, or NODE_INVALID if the token ends the expression
+static NodeType infix_operator(TokenVector *tokens, int index)
+{
+	return index < tokens->size ? token_rules[tokens->data[index].type].infix_node : NODE_INVALID;
+}
 
-		if (token->type == TOKEN_EQUAL)
-		{
-			Node *node = malloc(sizeof(Node));
-			*node = (Node){ .type = NODE_ASSIGN };
-			tree = (tree == NULL ? node : append_tree(tree, node));
-			index++;
-			if (index >= tokens->size) goto err_cleanup;
-			continue;
-		}
+//Precedence climbing. Parses an operand followed by every binary operator of at least min_precedence.
+//Each token is visited once. Operators waiting for their operands are kept on an explicit stack instead
+//of in recursive calls, so prefix chains and right-associative chains such as a = b = c take bounded
+//C stack. Only parentheses and call arguments recurse, once per nesting level.
+static ParseExpressionResult parse_binary(TokenVector *tokens, AstTree *tree, int index, int min_precedence)
+{
+	PendingOperatorVector pending = pending_operator_vector_create();
+	ParseExpressionResult result;
 
-		//Check for function call
-		if (token->type == TOKEN_IDENTIFIER &&
-			index + 1 <= tokens->size &&
-			vec_at(Token*, tokens, index + 1)->type == TOKEN_OPEN_PAREN)
+	while (1)
+	{
+		//Prefix operators and casts bind tighter than every binary operator, so they only wait for the next operand
+		while (index < tokens->size)
 		{
-			index += 2;
-			if (index >= tokens->size) goto err_cleanup;
-			Token *name_token = token;
-
-			token = vec_at(Token*, tokens, index);
-			if (token->type == TOKEN_CLOSE_PAREN)
+			const TokenRule *rule = &token_rules[tokens->data[index].type];
+			TypeDescriptor cast_type;
+			int operand_index;
+			if (rule->operand == OPERAND_PREFIX)
 			{
+				pending_operator_vector_push(&pending, (PendingOperator){ .type = rule->operand_node, .token_index = index, .left = NODE_INDEX_NONE });
 				index++;
-				if (index >= tokens->size) goto err_cleanup;
-				Node *node = malloc(sizeof(Node));
-				*node = (Node){ .type = NODE_FUNC_CALL, .paren = true };
-				node->func_call.func_name_token = name_token;
-				tree = (tree == NULL ? node : append_tree(tree, node));
-				continue;
 			}
-
-			Node *param_tree = NULL;
-
-			while (1)
+			else if (rule->operand == OPERAND_PAREN && (operand_index = parse_cast(tokens, index, &cast_type)) >= 0)
 			{
-				ParseExpressionResult recurse_result = parse_expression(tokens, index);
-				if (!recurse_result.success) goto err_param_cleanup;
-				if (!recurse_result.node) goto err_param_cleanup;
-				param_tree = (param_tree == NULL ? recurse_result.node : append_tree(param_tree, recurse_result.node));
-
-				index = recurse_result.next_index;
-				if (index >= tokens->size) goto err_param_cleanup;
-				token = vec_at(Token*, tokens, index);
-
-				if (token->type == TOKEN_COMMA)
+				pending_operator_vector_push(&pending, (PendingOperator)
 				{
-					Node *node = malloc(sizeof(Node));
-					*node = (Node){ .type = NODE_COMMA };
-					param_tree = (param_tree == NULL ? node : append_tree(param_tree, node));
-					index++;
-					if (index >= tokens->size) goto err_param_cleanup;
-					continue;
-				}
-
-				break;
+					.type = NODE_CAST,
+					.base_type = cast_type.base_type,
+					.ptr_count = cast_type.ptr_count,
+					.token_index = index,
+					.left = NODE_INDEX_NONE
+				});
+				index = operand_index;
 			}
-
-			Node *node = malloc(sizeof(Node));
-			*node = (Node){ .type = NODE_FUNC_CALL, .paren = true };
-			node->func_call.func_name_token = name_token;
-			node->left = param_tree;
-			param_tree->up = node;
-			tree = (tree == NULL ? node : append_tree(tree, node));
-			continue;
-
-			err_param_cleanup:
-			if (param_tree)
-				free_tree(param_tree);
-			goto err_cleanup;
+			else break;
 		}
 
-		if (token->type == TOKEN_IDENTIFIER)
-		{
-			Node *node = malloc(sizeof(Node));
-			*node = (Node){ .type = NODE_VAR };
-			node->variable.var_name_token = token;
-			tree = (tree == NULL ? node : append_tree(tree, node));
-			index++;
-			if (index >= tokens->size) goto err_cleanup;
-			continue;
-		}
-
-		if (token->type == TOKEN_INT)
-		{
-			Node *node = malloc(sizeof(Node));
-			*node = (Node){ .type = NODE_NUMBER };
-			node->number.literal_token = token;
-			tree = (tree == NULL ? node : append_tree(tree, node));
-			index++;
-			if (index >= tokens->size) goto err_cleanup;
-			continue;
-		}
+		result = parse_operand(tokens, tree, index);
+		if (!result.success) goto done;
 
-		if (token->type == TOKEN_STAR)
+		//Applies the waiting prefix operators, then finishes every binary operator whose right side ends
+		//here because the next operator binds less tightly
+		while (1)
 		{
-			Node *node = malloc(sizeof(Node));
-
-			if (index > 0 &&
-				vec_at(Token*, tokens, index - 1)->type == TOKEN_IDENTIFIER ||
-				vec_at(Token*, tokens, index - 1)->type == TOKEN_INT ||
-				vec_at(Token*, tokens, index - 1)->type == TOKEN_CLOSE_PAREN)
+			PendingOperator *top = pending.size ? &pending_operator_vector_data(&pending)[pending.size - 1] : NULL;
+			if (top && top->left == NODE_INDEX_NONE)
 			{
-				*node = (Node){ .type = NODE_MULTIPLY };
-			}
-			else
-			{
-				*node = (Node){ .type = NODE_DEREF };
+				result.node = add_node(tree, top->type, result.node, NODE_INDEX_NONE, top->token_index);
+				tree->nodes.data[result.node].base_type = top->base_type;
+				tree->nodes.data[result.node].ptr_count = top->ptr_count;
+				pending.size--;
+				continue;
 			}
-			tree = (tree == NULL ? node : append_tree(tree, node));
-			index++;
-			if (index >= tokens->size) goto err_cleanup;
-			continue;
-		}
 
-		if (token->type == TOKEN_OPEN_PAREN)
-		{
-			index++;
-			if (index >= tokens->size) goto err_cleanup;
-			ParseExpressionResult recurse_result = parse_expression(tokens, index);
-			if (!recurse_result.success) goto err_cleanup;
-			index = recurse_result.next_index;
-			if (index >= tokens->size) goto err_cleanup;
-			tree = (tree == NULL ? recurse_result.node : append_tree(tree, recurse_result.node));
-			continue;
-		}
+			NodeType type = infix_operator(tokens, result.next_index);
+			if (type != NODE_INVALID && node_precedence(type) >= min_precedence) break;
+			if (!top) goto done;
 
-		if (token->type == TOKEN_CLOSE_PAREN)
-		{
-			if (tree)
-				tree->paren = true;
-			index++;
-			break;
+			result.node = add_node(tree, top->type, top->left, result.node, top->token_index);
+			min_precedence = top->min_precedence;
+			pending.size--;
 		}
 
-		if (token->type == TOKEN_COMMA)
+		//Precedence level 1 operators are evaluated right to left (eg. =, +=, *=, etc.)
+		NodeType type = infix_operator(tokens, result.next_index);
+		int precedence = node_precedence(type);
+		pending_operator_vector_push(&pending, (PendingOperator)
 		{
-			break;
-		}
+			.type = type,
+			.token_index = result.next_index,
+			.left = result.node,
+			.min_precedence = min_precedence
+		});
+		min_precedence = precedence == 1 ? precedence : precedence + 1;
+		index = result.next_index + 1;
+	}
 
-		if (token->type == TOKEN_SEMICOLON)
-		{
-			index++;
-			break;
-		}
+	done:
+	pending_operator_vector_free(&pending);
+	return result;
+}
 
-		goto err_cleanup;
-	}
+//Parses an expression up to and including the ; or ) that ends it. An empty expression has no node.
+ParseExpressionResult parse_expression(TokenVector *tokens, AstTree *tree, int index)
+{
+	if (index >= tokens->size) return (ParseExpressionResult){ .success = false };
 
-	return (ParseExpressionResult){ .success = true, .next_index = index, .node = tree };
+	ParseExpressionResult result = { .success = true, .next_index = index, .node = NODE_INDEX_NONE };
+	TokenType type = tokens->data[index].type;
+	if (type != TOKEN_SEMICOLON && type != TOKEN_CLOSE_PAREN)
+	{
+		result = parse_binary(tokens, tree, index, 0);
+		if (!result.success) return result;
+		if (result.next_index >= tokens->size) return (ParseExpressionResult){ .success = false };
+		type = tokens->data[result.next_index].type;
+	}
 
-	err_cleanup:
-	if (tree) free_tree(tree);
-	return (ParseExpressionResult){ .success = false };
+	if (type != TOKEN_SEMICOLON && type != TOKEN_CLOSE_PAREN)
+		return (ParseExpressionResult){ .success = false };
+	result.next_index++;
+	return result;
 }
 
 typedef struct
 {
 	bool success;
-	Node *node;
+	NodeIndex node;
 	int next_index;
 } AstReturnStatement;
 
-AstReturnStatement parse_return_statement(Vector *tokens, int index)
+AstReturnStatement parse_return_statement(TokenVector *tokens, AstTree *tree, int index)
 {
-	Token *token = vec_at(Token*, tokens, index);
+	int return_index = index;
+	Token *token = &tokens->data[index];
 	if (token->type != TOKEN_RETURN) return (AstReturnStatement){ .success = false };
 	index++;
 	if (index >= tokens->size) return (AstReturnStatement){ .success = false };
 
-	ParseExpressionResult exp_result = parse_expression(tokens, index);
+	ParseExpressionResult exp_result = parse_expression(tokens, tree, index);
 	if (!exp_result.success) return (AstReturnStatement){ .success = false };
 
-	Node *node = malloc(sizeof(Node));
-	*node = (Node){ .type = NODE_RETURN };
-	node->left = exp_result.node;
-	exp_result.node->up = node;
+	NodeIndex node = add_node(tree, NODE_RETURN, exp_result.node, NODE_INDEX_NONE, return_index);
 
 	return (AstReturnStatement){ .success = true, .node = node, .next_index = exp_result.next_index };
 }
@@ -785,135 +677,108 @@ AstReturnStatement parse_return_statement(Vector *tokens, int index)
 typedef struct
 {
 	bool success;
-	Node *node;
+	NodeIndex node;
 	int next_index;
 } AstIfResult;
 
-AstIfResult parse_if_statement(Vector *tokens, int index)
+AstIfResult parse_if_statement(TokenVector *tokens, AstTree *tree, int index)
 {
-	Node *exp_node = NULL;
-	Node *if_body_node = NULL;
-	Node *else_body_node = NULL;
+	NodeIndex exp_node = NODE_INDEX_NONE;
+	NodeIndex if_body_node = NODE_INDEX_NONE;
+	NodeIndex else_body_node = NODE_INDEX_NONE;
+	int if_index = index;
 
-	Token *token = vec_at(Token*, tokens, index);
+	Token *token = &tokens->data[index];
 	if (token->type != TOKEN_IF) return (AstIfResult){ .success = false };
 	index++;
 	if (index >= tokens->size) return (AstIfResult){ .success = false };
-	token = vec_at(Token*, tokens, index);
+	token = &tokens->data[index];
 
 	if (token->type != TOKEN_OPEN_PAREN) return (AstIfResult){ .success = false };
 	index++;
 	if (index >= tokens->size) return (AstIfResult){ .success = false };
-	token = vec_at(Token*, tokens, index);
+	token = &tokens->data[index];
 
-	ParseExpressionResult exp_result = parse_expression(tokens, index);
+	ParseExpressionResult exp_result = parse_expression(tokens, tree, index);
 	if (!exp_result.success) goto err_cleanup;
 	exp_node = exp_result.node;
 	index = exp_result.next_index;
 	if (index >= tokens->size) goto err_cleanup;
 
-	AstBlockResult if_body_result = ast_block(tokens, index);
+	AstBlockResult if_body_result = ast_block(tokens, tree, index);
 	if (!if_body_result.success) goto err_cleanup;
 	if_body_node = if_body_result.node;
 	index = if_body_result.next_index;
 	if (index >= tokens->size) goto err_cleanup;
 
-	token = vec_at(Token*, tokens, index);
+	token = &tokens->data[index];
 	if (token->type != TOKEN_ELSE) goto place_node;
 	index++;
 	if (index >= tokens->size) goto err_cleanup;
-	AstBlockResult else_body_result = ast_block(tokens, index);
+	AstBlockResult else_body_result = ast_block(tokens, tree, index);
 	if (!else_body_result.success) goto err_cleanup;
 	else_body_node = else_body_result.node;
 	index = else_body_result.next_index;
 	if (index >= tokens->size) goto err_cleanup;
 
 	place_node:
-	Node *if_node = malloc(sizeof(Node));
-	*if_node = (Node){ .type = NODE_IF };
-	if_node->left = exp_node;
-	exp_node->up = if_node;
-
-	Node *branch_node = malloc(sizeof(Node));
-	*branch_node = (Node){ .type = NODE_BRANCH };
-	if_node->right = branch_node;
-	branch_node->up = if_node;
-	branch_node->left = if_body_node;
-	if_body_node->up = branch_node;
-	if (else_body_node)
-	{
-		else_body_node->up = branch_node;
-		branch_node->right = else_body_node;
-	}
+	NodeIndex branch_node = add_node(tree, NODE_BRANCH, if_body_node, else_body_node, 0);
+	NodeIndex if_node = add_node(tree, NODE_IF, exp_node, branch_node, if_index);
 
 	return (AstIfResult) { .success = true, .node = if_node, .next_index = index };
 
 	err_cleanup:
-	if (exp_node)
-		free_tree(exp_node);
-	if (if_body_node)
-		free_tree(if_body_node);
-	if (else_body_node)
-		free_tree(else_body_node);
 	return (AstIfResult){ .success = false };
 }
 
 typedef struct
 {
 	bool success;
-	Node *node;
+	NodeIndex node;
 	int next_index;
 } AstWhileResult;
 
-AstWhileResult parse_while_statement(Vector *tokens, int index)
+AstWhileResult parse_while_statement(TokenVector *tokens, AstTree *tree, int index)
 {
-	Node *exp_node = NULL;
-	Node *while_body = NULL;
+	NodeIndex exp_node = NODE_INDEX_NONE;
+	NodeIndex while_body = NODE_INDEX_NONE;
+	int while_index = index;
 
-	Token *token = vec_at(Token*, tokens, index);
+	Token *token = &tokens->data[index];
 	if (token->type != TOKEN_WHILE) return (AstWhileResult){ .success = false };
 	index++;
 	if (index >= tokens->size) return (AstWhileResult){ .success = false };
-	token = vec_at(Token*, tokens, index);
+	token = &tokens->data[index];
 
 	if (token->type != TOKEN_OPEN_PAREN) return (AstWhileResult){ .success = false };
 	index++;
 	if (index >= tokens->size) return (AstWhileResult){ .success = false };
-	token = vec_at(Token*, tokens, index);
+	token = &tokens->data[index];
 
-	ParseExpressionResult exp_result = parse_expression(tokens, index);
+	ParseExpressionResult exp_result = parse_expression(tokens, tree, index);
 	if (!exp_result.success) goto err_cleanup;
 	exp_node = exp_result.node;
 	index = exp_result.next_index;
 	if (index >= tokens->size) goto err_cleanup;
 
-	AstBlockResult while_body_result = ast_block(tokens, index);
+	AstBlockResult while_body_result = ast_block(tokens, tree, index);
 	if (!while_body_result.success) goto err_cleanup;
 	while_body = while_body_result.node;
 	index = while_body_result.next_index;
 	if (index >= tokens->size) goto err_cleanup;
 
-	Node *while_node = malloc(sizeof(Node));
-	*while_node = (Node){ .type = NODE_WHILE };
-	while_node->left = exp_node;
-	exp_node->up = while_node;
-	while_node->right = while_body;
-	while_body->up = while_node;
+	NodeIndex while_node = add_node(tree, NODE_WHILE, exp_node, while_body, while_index);
 	return (AstWhileResult) { .success = true, .node = while_node, .next_index = index };
 
 	err_cleanup:
-	if (exp_node)
-		free_tree(exp_node);
-	if (while_body)
-		free_tree(while_body);
 	return (AstWhileResult){0};
 }
 
-AstBlockResult ast_block(Vector *tokens, int index)
+AstBlockResult ast_block(TokenVector *tokens, AstTree *tree, int index)
 {
-	AstBlockResult block_result = {0};
+	AstBlockResult block_result = { .node = NODE_INDEX_NONE };
 
-	while (vec_at(Token*, tokens, index)->type == TOKEN_OPEN_BRACE)
+	while (tokens->data[index].type == TOKEN_OPEN_BRACE)
 	{
 		index++;
 		if (index >= tokens->size) goto err_cleanup;
@@ -921,130 +786,219 @@ AstBlockResult ast_block(Vector *tokens, int index)
 
 	while (1)
 	{
-		Node *placed_node = NULL;
+		NodeIndex placed_node = NODE_INDEX_NONE;
 		int next_index = 0;
 
-		AstReturnStatement return_result = parse_return_statement(tokens, index);
-		if (return_result.success)
+		//The block ends at its closing brace, which can come right after the opening one
+		if (tokens->data[index].type == TOKEN_CLOSE_BRACE)
+		{
+			block_result.success = true;
+			block_result.next_index = index + 1;
+			return block_result;
+		}
+
+		//The first token decides the statement form
+		switch (tokens->data[index].type)
+		{
+		case TOKEN_RETURN:
 		{
+			AstReturnStatement return_result = parse_return_statement(tokens, tree, index);
+			if (!return_result.success) goto err_cleanup;
 			placed_node = return_result.node;
 			next_index = return_result.next_index;
-			goto place_node;
+			break;
 		}
-
-		AstIfResult if_result = parse_if_statement(tokens, index);
-		if (if_result.success)
+		case TOKEN_IF:
 		{
+			AstIfResult if_result = parse_if_statement(tokens, tree, index);
+			if (!if_result.success) goto err_cleanup;
 			placed_node = if_result.node;
 			next_index = if_result.next_index;
-			goto place_node;
+			break;
 		}
-
-		AstWhileResult while_result = parse_while_statement(tokens, index);
-		if (while_result.success)
+		case TOKEN_WHILE:
 		{
+			AstWhileResult while_result = parse_while_statement(tokens, tree, index);
+			if (!while_result.success) goto err_cleanup;
 			placed_node = while_result.node;
 			next_index = while_result.next_index;
-			goto place_node;
+			break;
 		}
-
-		if (vec_at(Token*, tokens, index)->type == TOKEN_BREAK)
-		{
-			placed_node = malloc(sizeof(Node));
-			*placed_node = (Node) { .type = NODE_BREAK };
+		case TOKEN_BREAK:
+			placed_node = add_node(tree, NODE_BREAK, NODE_INDEX_NONE, NODE_INDEX_NONE, index);
 			next_index = index + 1;
-			goto place_node;
-		}
-
-		ParseExpressionResult exp_result = parse_expression(tokens, index);
-		placed_node = exp_result.node;
-		next_index = exp_result.next_index;
-		if (!exp_result.success) goto err_cleanup;
-
-		place_node:
-		if (!block_result.node)
+			break;
+		default:
 		{
-			block_result.node = placed_node;
-			goto node_placed;
+			ParseExpressionResult exp_result = parse_expression(tokens, tree, index);
+			if (!exp_result.success) goto err_cleanup;
+			placed_node = exp_result.node;
+			next_index = exp_result.next_index;
+			break;
 		}
-
-		if (block_result.node->type != NODE_EXP_SEQ || block_result.node->right)
-		{
-			Node *node = malloc(sizeof(Node));
-			*node = (Node){ .type = NODE_EXP_SEQ };
-			node->left = block_result.node;
-			block_result.node->up = node;
-			block_result.node = node;
-			node->right = placed_node;
-			placed_node->up = node;
-			goto node_placed;
 		}
 
-		block_result.node->right = placed_node;
-		placed_node->up = block_result.node;
+		if (block_result.node == NODE_INDEX_NONE)
+			block_result.node = placed_node;
+		else if (placed_node != NODE_INDEX_NONE)
+			block_result.node = add_node(tree, NODE_EXP_SEQ, block_result.node, placed_node, 0);
 
-		node_placed:
 		index = next_index;
 		if (index >= tokens->size) goto err_cleanup;
-		Token *token = vec_at(Token*, tokens, index);
-
-		if (token->type == TOKEN_CLOSE_BRACE)
-		{
-			block_result.success = true;
-			block_result.next_index = index + 1;
-			return block_result;
-		}
 	}
 
 	err_cleanup:
-	if (block_result.node)
-		free_tree(block_result.node);
 	return (AstBlockResult){ .success = false };
 }
 
 typedef struct
 {
 	bool success;
-	Node *node;
+	NodeIndex node;
 	int next_index;
 } AstFuncResult;
 
-AstFuncResult ast_function(Vector *tokens, int index)
+//Parses the body of a function whose signature ast_scan_unit has already parsed. index is the brace that
+//opens the body.
+AstFuncResult ast_function(TokenVector *tokens, AstTree *tree, int name_token, int index)
 {
-	FunctionParseResult func_result = parse_function(tokens, 0);
-	if (!func_result.success) return (AstFuncResult){ .success = false };
-	index = func_result.next_index;
-	if (index >= tokens->size) return (AstFuncResult){ .success = false };
-
-	Token *token = vec_at(Token*, tokens, index);
-	if (token->type != TOKEN_OPEN_BRACE) return (AstFuncResult){ .success = false };
-
 	index++;
 	if (index >= tokens->size) return (AstFuncResult){ .success = false };
 
-	AstBlockResult block_result = ast_block(tokens, index);
+	AstBlockResult block_result = ast_block(tokens, tree, index);
 	if (!block_result.success) return (AstFuncResult){ .success = false };
 
-	Node *node = malloc(sizeof(Node));
-	*node = (Node){ .type = NODE_FUNCTION };
-	node->function.name_token = func_result.func_descriptor.name_token;
-	node->function.func_descriptor = func_result.func_descriptor;
-	node->left = block_result.node;
-	block_result.node->up = node;
-
+	NodeIndex node = add_node(tree, NODE_FUNCTION, block_result.node, NODE_INDEX_NONE, name_token);
 	return (AstFuncResult){ .success = true, .node = node, .next_index = block_result.next_index };
 }
 
-bool ast_tokens(Vector *tokens)
+//Below this many tokens the functions are parsed on the calling thread. parallel_for starts and joins its
+//threads on every call, tens of microseconds each, while 64K tokens take about a millisecond to parse.
+#define PARALLEL_PARSE_MIN_TOKENS (1 << 16)
+
+//Splits the tokens into functions by matching braces. A function ends at the brace that closes its
+//outermost block, and the next one starts right after it.
+static void find_functions(TokenVector *tokens, AstFunctionVector *functions)
+{
+	int depth = 0;
+	int first_token = 0;
+	for (int i = 0; i < tokens->size; i++)
+	{
+		TokenType type = tokens->data[i].type;
+		if (type == TOKEN_OPEN_BRACE)
+		{
+			depth++;
+		}
+		else if (type == TOKEN_CLOSE_BRACE && depth > 0 && --depth == 0)
+		{
+			ast_function_vector_push(functions, (AstFunction){ .first_token = first_token, .end_token = i + 1 });
+			first_token = i + 1;
+		}
+	}
+
+	//Tokens after the last complete function still form a function, which fails to parse
+	if (first_token < tokens->size)
+		ast_function_vector_push(functions, (AstFunction){ .first_token = first_token, .end_token = tokens->size });
+}
+
+bool ast_scan_unit(TokenList *list, AstUnit *unit)
 {
-	AstFuncResult result = ast_function(tokens, 0);
+	*unit = (AstUnit){ .list = list };
+	find_functions(&list->tokens, &unit->functions);
 
-	if (result.success)
+	bool success = true;
+	for (int i = 0; i < unit->functions.size; i++)
 	{
-		pretty_print_tree(result.node, stdout, 0);
+		AstFunction *function = &unit->functions.data[i];
+		TokenVector tokens = { .data = list->tokens.data, .size = function->end_token };
+		FunctionParseResult result = parse_function(&tokens, function->first_token);
+		function->signature = result.func_descriptor;
+		function->body_token = result.next_index;
+		function->success = result.success && result.next_index < tokens.size && tokens.data[result.next_index].type == TOKEN_OPEN_BRACE;
+		success &= function->success;
+	}
+	return success;
+}
+
+AstTree *ast_function_tree(AstUnit *unit, int index)
+{
+	AstFunction *function = &unit->functions.data[index];
+	if (!function->success) return NULL;
+	if (function->parsed) return &function->tree;
+
+	//The parser stops at the end of the vector, so ending the view at the function's last token keeps
+	//it inside the function while token indexes stay the same as in the whole list
+	TokenVector tokens = { .data = unit->list->tokens.data, .size = function->end_token };
+	function->tree = (AstTree){ .root = NODE_INDEX_NONE };
+	AstFuncResult result = ast_function(&tokens, &function->tree, function->signature.name_token, function->body_token);
+	function->parsed = true;
+	function->success = result.success && result.next_index == function->end_token;
+	if (!function->success) return NULL;
+
+	function->tree.root = result.node;
+	return &function->tree;
+}
+
+static void parse_function_task(void *context, int index)
+{
+	ast_function_tree(context, index);
+}
+
+bool ast_parse_unit(TokenList *list, AstUnit *unit)
+{
+	ast_scan_unit(list, unit);
+
+	if (list->tokens.size >= PARALLEL_PARSE_MIN_TOKENS)
+	{
+		parallel_for(unit->functions.size, parse_function_task, unit);
 	}
 	else
 	{
-		puts("Failed to parse function");
+		for (int i = 0; i < unit->functions.size; i++)
+			parse_function_task(unit, i);
 	}
-}
\ No newline at end of file
+
+	for (int i = 0; i < unit->functions.size; i++)
+	{
+		if (!unit->functions.data[i].success)
+			return false;
+	}
+	return true;
+}
+
+void ast_unit_free(AstUnit *unit)
+{
+	for (int i = 0; i < unit->functions.size; i++)
+	{
+		func_param_vector_free(&unit->functions.data[i].signature.parameters);
+		ast_tree_free(&unit->functions.data[i].tree);
+	}
+	ast_function_vector_free(&unit->functions);
+}
+
+void ast_tree_free(AstTree *tree)
+{
+	ast_node_vector_free(&tree->nodes);
+	tree->root = NODE_INDEX_NONE;
+}
+
+bool ast_tokens(TokenList *list)
+{
+	AstUnit unit;
+	bool success = ast_parse_unit(list, &unit);
+
+	for (int i = 0; i < unit.functions.size; i++)
+	{
+		AstFunction *function = &unit.functions.data[i];
+		if (function->success)
+		{
+			pretty_print_tree(list, &function->tree, function->tree.root, stdout, 0);
+		}
+		else
+		{
+			puts("Failed to parse function");
+		}
+	}
+	ast_unit_free(&unit);
+	return success;
+}
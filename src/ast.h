@@ -7,6 +7,8 @@ typedef enum
 {
 	BASE_TYPE_INVALID,
 	BASE_TYPE_VOID,
+	BASE_TYPE_U8,
+	BASE_TYPE_S8,
 	BASE_TYPE_U16,
 	BASE_TYPE_S16,
 	BASE_TYPE_BOOL,
@@ -18,17 +20,22 @@ typedef struct
 	int ptr_count;
 } TypeDescriptor;
 
+//Fields named *_token hold an index into the token vector that was parsed.
+
 typedef struct
 {
-	Token *name_token;
+	int name_token;
 	TypeDescriptor type;
 } FuncParamDescriptor;
 
+//Most functions take only a few parameters, so they are stored inline
+SMALL_VECTOR_DEFINE(FuncParamVector, func_param_vector, FuncParamDescriptor, 4)
+
 typedef struct
 {
-	Token *name_token;
+	int name_token;
 	TypeDescriptor return_type;
-	Vector parameters;
+	FuncParamVector parameters;
 } FuncDescriptor;
 
 typedef enum
@@ -68,64 +75,75 @@ typedef enum
 	NODE_CAST
 } NodeType;
 
-typedef struct
-{
-	TypeDescriptor var_type;
-	Token *var_name_token;
-} NodeVarDecl;
+typedef uint32_t NodeIndex;
+#define NODE_INDEX_NONE UINT32_MAX
 
+//Nodes are stored by value in AstTree.nodes and refer to their children by index. Every node comes after
+//its children (post-order) and the root is the last node, so bottom-up passes are a single forward scan.
 typedef struct
 {
-	Token *var_name_token;
-} NodeVar;
+	uint8_t type;
+	//Declared type of NODE_VAR_DECL and target type of NODE_CAST
+	uint8_t base_type;
+	uint16_t ptr_count;
+	//Token index of the name, literal, keyword or operator the node was parsed from, which is the name for
+	//NODE_VAR_DECL, NODE_VAR, NODE_FUNC_CALL and NODE_FUNCTION and the opening parenthesis for NODE_CAST.
+	//Unused for NODE_EXP_SEQ and NODE_BRANCH.
+	uint32_t value;
+	NodeIndex left;
+	NodeIndex right;
+} AstNode;
 
-typedef struct
-{
-	Token *func_name_token;
-} NodeFuncCall;
+VECTOR_DEFINE(AstNodeVector, ast_node_vector, AstNode)
 
 typedef struct
 {
-	Token *literal_token;
-} NodeNumber;
+	AstNodeVector nodes;
+	NodeIndex root;
+} AstTree;
 
-typedef struct
+static inline TypeDescriptor ast_node_type_descriptor(AstNode *node)
 {
-	Token *literal_token;
-} NodeString;
+	return (TypeDescriptor){ .base_type = node->base_type, .ptr_count = node->ptr_count };
+}
 
+//One function of a translation unit. Each function is parsed into a tree of its own, so functions can be
+//parsed independently of each other and bodies only need to be parsed when they are used.
 typedef struct
 {
-	Token *name_token;
-	FuncDescriptor func_descriptor;
-} NodeFunction;
+	//Token range of the function, from its return type through its closing brace
+	int first_token;
+	int end_token;
+	//Index of the brace that opens the body, where ast_function_tree starts parsing
+	int body_token;
+	FuncDescriptor signature;
+	//Set once the body has been parsed into tree. The root of the tree is the NODE_FUNCTION node.
+	bool parsed;
+	AstTree tree;
+	//False if the signature or, once parsed, the body failed to parse
+	bool success;
+} AstFunction;
+
+VECTOR_DEFINE(AstFunctionVector, ast_function_vector, AstFunction)
 
 typedef struct
 {
-	TypeDescriptor cast_type;
-} NodeCast;
+	TokenList *list;
+	AstFunctionVector functions;
+} AstUnit;
 
-struct Node
-{
-	NodeType type;
-	struct Node *left;
-	struct Node *right;
-	struct Node *up;
-	bool paren;
-	union
-	{
-		NodeVarDecl var_decl;
-		NodeVar variable;
-		NodeNumber number;
-		NodeFuncCall func_call;
-		NodeFunction function;
-		NodeString string;
-		NodeCast cast;
-	};
-};
-typedef struct Node Node;
-
-extern bool ast_tokens(Vector *tokens);
+//Records the signature and token range of every function in the tokens, skipping the bodies by brace
+//matching. Returns false if any signature failed to parse.
+extern bool ast_scan_unit(TokenList *list, AstUnit *unit);
+//Parses the body of a scanned function the first time it is asked for. Returns NULL if it fails to parse.
+//Different functions can be parsed from different threads at the same time.
+extern AstTree *ast_function_tree(AstUnit *unit, int index);
+//Scans the tokens and parses every body. Returns false if any function failed to parse.
+extern bool ast_parse_unit(TokenList *list, AstUnit *unit);
+extern void ast_unit_free(AstUnit *unit);
+extern void ast_tree_free(AstTree *tree);
+//Parses the tokens as a translation unit and prints the tree of every function
+extern bool ast_tokens(TokenList *list);
 extern int type_descriptor_size(TypeDescriptor *descriptor);
 
 #endif
\ No newline at end of file
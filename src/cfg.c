@@ -0,0 +1,327 @@
+#include <assert.h>
+#include "cfg.h"
+
+//Maps a label to the block it starts
+HASH_MAP_DEFINE(LabelBlockMap, label_block_map, int, int, hash_int, equal_int)
+
+static bool ends_block(enum IrInstType opcode)
+{
+	return opcode == IRINST_JUMP || opcode == IRINST_BRANCH || opcode == IRINST_RETURN;
+}
+
+static void split_blocks(struct IrCfg *cfg, struct IrFunction *function, LabelBlockMap *labels)
+{
+	struct IrInstBuffer *insts = &function->insts;
+	int current = -1;
+	//Consecutive labels start a single block
+	bool has_code = false;
+	for (IrInstIndex i = insts->first; i != IR_INST_INDEX_NONE; i = insts->next[i])
+	{
+		enum IrInstType opcode = insts->opcodes[i];
+		if (current == -1 || (opcode == IRINST_LABEL && has_code))
+		{
+			ir_block_vector_push(&cfg->blocks, (struct IrBlock){ .first = i, .order_index = -1, .idom = -1 });
+			current = cfg->blocks.size - 1;
+			has_code = false;
+		}
+
+		cfg->blocks.data[current].last = i;
+		cfg->inst_blocks.data[i] = current;
+		if (opcode == IRINST_LABEL)
+			label_block_map_put(labels, insts->operands[i].label.label, current);
+		else
+			has_code = true;
+
+		if (ends_block(opcode))
+			current = -1;
+	}
+}
+
+static int label_block(LabelBlockMap *labels, int label)
+{
+	int *block = label_block_map_get(labels, label);
+	assert(block != NULL);
+	return *block;
+}
+
+static void add_succ(struct IrCfg *cfg, int block, int succ)
+{
+	struct IrBlock *b = &cfg->blocks.data[block];
+	//Both targets of a branch can be the same block
+	if (b->succ_count > 0 && cfg->succs.data[b->first_succ] == succ) return;
+	ir_block_index_vector_push(&cfg->succs, succ);
+	b->succ_count++;
+}
+
+static void link_blocks(struct IrCfg *cfg, struct IrFunction *function, LabelBlockMap *labels)
+{
+	struct IrInstBuffer *insts = &function->insts;
+	for (int b = 0; b < cfg->blocks.size; b++)
+	{
+		IrInstIndex last = cfg->blocks.data[b].last;
+		union IrOperands *operands = &insts->operands[last];
+		cfg->blocks.data[b].first_succ = cfg->succs.size;
+		switch (insts->opcodes[last])
+		{
+		case IRINST_JUMP:
+			add_succ(cfg, b, label_block(labels, operands->jump.label));
+			break;
+		case IRINST_BRANCH:
+			add_succ(cfg, b, label_block(labels, operands->branch.true_label));
+			add_succ(cfg, b, label_block(labels, operands->branch.false_label));
+			break;
+		case IRINST_RETURN:
+			break;
+		default:
+			//Blocks are made in program order, so the block that follows is the next one
+			if (b + 1 < cfg->blocks.size)
+				add_succ(cfg, b, b + 1);
+		}
+	}
+
+	//Predecessor lists are laid out by counting the edges into each block first
+	for (int i = 0; i < cfg->succs.size; i++)
+		cfg->blocks.data[cfg->succs.data[i]].pred_count++;
+	int first_pred = 0;
+	for (int b = 0; b < cfg->blocks.size; b++)
+	{
+		cfg->blocks.data[b].first_pred = first_pred;
+		first_pred += cfg->blocks.data[b].pred_count;
+		cfg->blocks.data[b].pred_count = 0;
+	}
+
+	ir_block_index_vector_reserve(&cfg->preds, cfg->succs.size);
+	cfg->preds.size = cfg->succs.size;
+	for (int b = 0; b < cfg->blocks.size; b++)
+	{
+		struct IrBlock *block = &cfg->blocks.data[b];
+		for (int i = 0; i < block->succ_count; i++)
+		{
+			struct IrBlock *succ = &cfg->blocks.data[cfg->succs.data[block->first_succ + i]];
+			cfg->preds.data[succ->first_pred + succ->pred_count++] = b;
+		}
+	}
+}
+
+//Orders the reachable blocks in reverse postorder. The search keeps its own stack, so long chains of
+//blocks do not exhaust the C stack.
+static void order_blocks(struct IrCfg *cfg)
+{
+	struct SearchEntry
+	{
+		int block;
+		int next_succ;
+	};
+	struct SearchEntry *stack = mem_alloc(sizeof(struct SearchEntry) * cfg->blocks.size);
+	bool *visited = mem_calloc(cfg->blocks.size, sizeof(bool));
+	int depth = 0;
+
+	stack[depth++] = (struct SearchEntry){ .block = 0 };
+	visited[0] = true;
+	while (depth > 0)
+	{
+		struct SearchEntry *entry = &stack[depth - 1];
+		struct IrBlock *block = &cfg->blocks.data[entry->block];
+		if (entry->next_succ < block->succ_count)
+		{
+			int succ = cfg->succs.data[block->first_succ + entry->next_succ++];
+			if (!visited[succ])
+			{
+				visited[succ] = true;
+				stack[depth++] = (struct SearchEntry){ .block = succ };
+			}
+			continue;
+		}
+
+		ir_block_index_vector_push(&cfg->order, entry->block);
+		depth--;
+	}
+
+	//The blocks were pushed in postorder
+	for (int i = 0, j = cfg->order.size - 1; i < j; i++, j--)
+	{
+		int block = cfg->order.data[i];
+		cfg->order.data[i] = cfg->order.data[j];
+		cfg->order.data[j] = block;
+	}
+	for (int i = 0; i < cfg->order.size; i++)
+		cfg->blocks.data[cfg->order.data[i]].order_index = i;
+
+	mem_free(visited);
+	mem_free(stack);
+}
+
+//Nearest common dominator of a predecessor a and the dominator b found from the earlier predecessors.
+//The blocks a walks through are marked. They all lie below b, so a later walk that reaches one can stop
+//there, which keeps a join of many predecessors from walking the same long chain for each of them.
+static int intersect(struct IrCfg *cfg, int *marks, int mark, int a, int b)
+{
+	struct IrBlock *blocks = cfg->blocks.data;
+	while (a != b)
+	{
+		while (blocks[a].order_index > blocks[b].order_index)
+		{
+			if (marks[a] == mark) return b;
+			marks[a] = mark;
+			a = blocks[a].idom;
+		}
+		while (blocks[b].order_index > blocks[a].order_index)
+			b = blocks[b].idom;
+	}
+	return a;
+}
+
+//Cooper, Harvey and Kennedy, "A Simple, Fast Dominance Algorithm". The immediate dominators are refined
+//in reverse postorder until they stop changing, which takes few passes for the graphs structured code makes.
+static void find_dominators(struct IrCfg *cfg)
+{
+	struct IrBlock *blocks = cfg->blocks.data;
+	blocks[0].idom = 0;
+	int *marks = mem_alloc(sizeof(int) * cfg->blocks.size);
+	for (int b = 0; b < cfg->blocks.size; b++)
+		marks[b] = -1;
+	int mark = 0;
+
+	bool changed = true;
+	while (changed)
+	{
+		changed = false;
+		for (int i = 1; i < cfg->order.size; i++)
+		{
+			int b = cfg->order.data[i];
+			int idom = -1;
+			mark++;
+			for (int p = 0; p < blocks[b].pred_count; p++)
+			{
+				int pred = cfg->preds.data[blocks[b].first_pred + p];
+				if (blocks[pred].idom == -1) continue;
+				idom = idom == -1 ? pred : intersect(cfg, marks, mark, pred, idom);
+			}
+			if (blocks[b].idom != idom)
+			{
+				blocks[b].idom = idom;
+				changed = true;
+			}
+		}
+	}
+	mem_free(marks);
+}
+
+//Builds the child lists of the dominator tree and numbers it in preorder. A block comes after its
+//immediate dominator in reverse postorder, so both are single passes over the order.
+static void build_dominator_tree(struct IrCfg *cfg)
+{
+	struct IrBlock *blocks = cfg->blocks.data;
+	for (int i = 1; i < cfg->order.size; i++)
+		blocks[blocks[cfg->order.data[i]].idom].child_count++;
+
+	int first_child = 0;
+	for (int i = 0; i < cfg->order.size; i++)
+	{
+		struct IrBlock *block = &blocks[cfg->order.data[i]];
+		block->first_child = first_child;
+		first_child += block->child_count;
+		block->child_count = 0;
+	}
+
+	ir_block_index_vector_reserve(&cfg->dom_children, cfg->order.size);
+	cfg->dom_children.size = cfg->order.size > 0 ? cfg->order.size - 1 : 0;
+	for (int i = 1; i < cfg->order.size; i++)
+	{
+		int b = cfg->order.data[i];
+		struct IrBlock *parent = &blocks[blocks[b].idom];
+		cfg->dom_children.data[parent->first_child + parent->child_count++] = b;
+	}
+
+	//Subtree sizes are summed from the leaves up, then each child gets the numbers after its earlier siblings
+	for (int i = 0; i < cfg->order.size; i++)
+		blocks[cfg->order.data[i]].dom_last = 1;
+	for (int i = cfg->order.size - 1; i > 0; i--)
+	{
+		int b = cfg->order.data[i];
+		blocks[blocks[b].idom].dom_last += blocks[b].dom_last;
+	}
+	if (cfg->order.size > 0)
+		blocks[0].dom_pre = 0;
+	for (int i = 0; i < cfg->order.size; i++)
+	{
+		struct IrBlock *block = &blocks[cfg->order.data[i]];
+		int next = block->dom_pre + 1;
+		for (int c = 0; c < block->child_count; c++)
+		{
+			struct IrBlock *child = &blocks[cfg->dom_children.data[block->first_child + c]];
+			child->dom_pre = next;
+			next += child->dom_last;
+		}
+		block->dom_last = block->dom_pre + block->dom_last - 1;
+	}
+}
+
+struct IrCfg ir_cfg_create(struct IrFunction *function)
+{
+	struct IrCfg cfg =
+	{
+		.blocks = ir_block_vector_create(16),
+		.preds = ir_block_index_vector_create(16),
+		.succs = ir_block_index_vector_create(16),
+		.order = ir_block_index_vector_create(16),
+		.dom_children = ir_block_index_vector_create(16),
+		.inst_blocks = ir_block_index_vector_create(function->insts.size)
+	};
+	for (uint32_t i = 0; i < function->insts.size; i++)
+		ir_block_index_vector_push(&cfg.inst_blocks, -1);
+
+	LabelBlockMap labels = label_block_map_create();
+	split_blocks(&cfg, function, &labels);
+	link_blocks(&cfg, function, &labels);
+	label_block_map_free(&labels);
+
+	if (cfg.blocks.size == 0) return cfg;
+	order_blocks(&cfg);
+	find_dominators(&cfg);
+	build_dominator_tree(&cfg);
+	return cfg;
+}
+
+void ir_cfg_free(struct IrCfg *cfg)
+{
+	ir_block_vector_free(&cfg->blocks);
+	ir_block_index_vector_free(&cfg->preds);
+	ir_block_index_vector_free(&cfg->succs);
+	ir_block_index_vector_free(&cfg->order);
+	ir_block_index_vector_free(&cfg->dom_children);
+	ir_block_index_vector_free(&cfg->inst_blocks);
+}
+
+bool ir_cfg_dominates(struct IrCfg *cfg, int a, int b)
+{
+	struct IrBlock *block_a = &cfg->blocks.data[a];
+	struct IrBlock *block_b = &cfg->blocks.data[b];
+	if (block_a->idom == -1 || block_b->idom == -1) return false;
+	return block_a->dom_pre <= block_b->dom_pre && block_b->dom_pre <= block_a->dom_last;
+}
+
+static void print_block_list(FILE *file, const char *name, int *blocks, int count)
+{
+	fprintf(file, " %s", name);
+	for (int i = 0; i < count; i++)
+		fprintf(file, " B%i", blocks[i]);
+}
+
+void ir_print_cfg(struct IrCfg *cfg, struct IrFunction *function, FILE *file)
+{
+	fprintf(file, "cfg %.*s\n", function->name_length, function->name);
+	for (int b = 0; b < cfg->blocks.size; b++)
+	{
+		struct IrBlock *block = &cfg->blocks.data[b];
+		fprintf(file, "B%i", b);
+		if (function->insts.opcodes[block->first] == IRINST_LABEL)
+			fprintf(file, " L%i", function->insts.operands[block->first].label.label);
+		print_block_list(file, "preds", &cfg->preds.data[block->first_pred], block->pred_count);
+		print_block_list(file, "succs", &cfg->succs.data[block->first_succ], block->succ_count);
+		if (block->idom == -1)
+			fputs(" unreachable\n", file);
+		else
+			fprintf(file, " idom B%i\n", block->idom);
+	}
+}
@@ -0,0 +1,56 @@
+#ifndef CFG_H
+#define CFG_H
+#include "ir.h"
+#include <stdio.h>
+
+//A run of instructions that is only entered at its first instruction and only left after its last.
+//Blocks start at the function header, at a label that follows other code and after a jump, branch or return.
+struct IrBlock
+{
+	//First and last instruction of the block in program order
+	IrInstIndex first;
+	IrInstIndex last;
+	//Ranges of IrCfg.preds and IrCfg.succs
+	int first_pred;
+	int pred_count;
+	int first_succ;
+	int succ_count;
+	//Position in IrCfg.order, -1 if the block cannot be reached from the entry block
+	int order_index;
+	//Immediate dominator. The entry block is its own immediate dominator and unreachable blocks have -1.
+	int idom;
+	//Range of IrCfg.dom_children
+	int first_child;
+	int child_count;
+	//Preorder number of the block in the dominator tree and the highest number in its subtree, so a block
+	//dominates the blocks numbered from dom_pre through dom_last
+	int dom_pre;
+	int dom_last;
+};
+
+VECTOR_DEFINE(IrBlockVector, ir_block_vector, struct IrBlock)
+VECTOR_DEFINE(IrBlockIndexVector, ir_block_index_vector, int)
+
+//Control flow graph of one function. Block 0 is the entry block.
+struct IrCfg
+{
+	IrBlockVector blocks;
+	IrBlockIndexVector preds;
+	//The successors of a branch are its true target and then its false target, unless both are the same block
+	IrBlockIndexVector succs;
+	//Reachable blocks in reverse postorder, so every block comes after its dominators
+	IrBlockIndexVector order;
+	IrBlockIndexVector dom_children;
+	//Block of every instruction slot of the function, -1 for removed slots
+	IrBlockIndexVector inst_blocks;
+};
+
+//Splits the function into blocks and computes their edges and dominators. The graph describes the
+//instructions as they are and is not updated when they change.
+extern struct IrCfg ir_cfg_create(struct IrFunction *function);
+extern void ir_cfg_free(struct IrCfg *cfg);
+//Returns true if every path from the entry block to block b goes through block a. Blocks dominate themselves.
+extern bool ir_cfg_dominates(struct IrCfg *cfg, int a, int b);
+extern void ir_print_cfg(struct IrCfg *cfg, struct IrFunction *function, FILE *file);
+
+#endif
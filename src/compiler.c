@@ -1,24 +1,9 @@
 #include "compiler.h"
+#include "cfg.h"
+#include "memstat.h"
 #include <assert.h>
 #include <stdlib.h>
 #include <stdio.h>
-#define ERRMSG_SIZE 100
-
-enum ValueLocation
-{
-	VAL_LOC_TOKEN,
-	VAL_LOC_STACK,
-	VAL_LOC_VARIABLE,
-	VAL_LOC_DECL,
-};
-
-struct TypedValue
-{
-	struct TypeDescriptor type;
-	enum ValueLocation location;
-	Token *token;
-	int ir_var_number;
-};
 
 struct TypeInfo
 {
@@ -27,82 +12,77 @@ struct TypeInfo
 	bool is_algebraic;
 };
 
-struct Variable
-{
-	Token *name_token;
-	struct TypeDescriptor type;
-	int ir_var_number;
-};
+VECTOR_DEFINE(NodeIndexVector, node_index_vector, NodeIndex)
+VECTOR_DEFINE(IrVarNumberVector, ir_var_number_vector, int)
+VECTOR_DEFINE(IrBaseTypeVector, ir_base_type_vector, enum IrBaseType)
 
-struct Variable *find_variable(struct CompilerContext *ctx, const char *name)
+struct Variable *find_variable(struct CompilerContext *ctx, SymbolId name)
 {
-	int count = ctx->variables.size;
-	for (int i = 0; i < count; i++)
-	{
-		struct Variable *v = &vec_at(struct Variable, &ctx->variables, i);
-		if (!strcmp(name, v->name_token->name)) return v;
-	}
-	return NULL;
+	int *index = variable_map_get(&ctx->variable_lookup, name);
+	if (!index) return NULL;
+	return &ctx->variables.data[*index];
 }
 
-char errmsg[ERRMSG_SIZE];
-struct TypedValue value_stack[50];
-int value_stack_size = 0;
-int value_stack_min = 0;
-enum LangOperator operator_stack[50];
-int operator_stack_size = 0;
-int operator_stack_min = 0;
-
-void set_compiler_error(const char *msg, Token *token)
+void compiler_enter_scope(struct CompilerContext *ctx)
 {
-	snprintf(errmsg, ERRMSG_SIZE, "(%i, %i): %s", token->line, token->column, msg);
+	scope_vector_push(&ctx->scopes, ctx->variables.size);
 }
 
-void print_compiler_error()
+void compiler_exit_scope(struct CompilerContext *ctx)
 {
-	printf("Failed to compile.\n%s\n", errmsg);
+	int start = scope_vector_pop(&ctx->scopes);
+	for (int i = ctx->variables.size - 1; i >= start; i--)
+	{
+		struct Variable *variable = &ctx->variables.data[i];
+		//A redeclaration in the same scope was never bound, so the name still refers to an older entry
+		int *index = variable_map_get(&ctx->variable_lookup, variable->name);
+		if (!index || *index != i) continue;
+		if (variable->shadowed >= 0)
+			*index = variable->shadowed;
+		else
+			variable_map_remove(&ctx->variable_lookup, variable->name);
+	}
+	ctx->variables.size = start;
 }
 
-enum LangOperator pop_operator()
+//Adds a binding for variable in the innermost scope and returns it
+static struct Variable *declare_variable(struct CompilerContext *ctx, struct Variable variable)
 {
-	if (operator_stack_size == 0 || operator_stack_size == operator_stack_min) return LANG_OP_INVALID;
-	operator_stack_size--;
-	return operator_stack[operator_stack_size];
+	int index = ctx->variables.size;
+	int *bound = variable_map_get(&ctx->variable_lookup, variable.name);
+	int scope_start = ctx->scopes.size ? *scope_vector_last(&ctx->scopes) : 0;
+	variable.shadowed = bound ? *bound : -1;
+	//A redeclared name keeps referring to its first declaration in the same scope
+	if (!bound || *bound < scope_start)
+		variable_map_put(&ctx->variable_lookup, variable.name, index);
+	return variable_vector_push(&ctx->variables, variable);
 }
 
-enum LangOperator peek_operator()
+void set_compiler_error(struct CompilerContext *ctx, const char *msg, Token *token)
 {
-	if (operator_stack_size == 0 || operator_stack_size == operator_stack_min) return LANG_OP_INVALID;
-	return operator_stack[operator_stack_size - 1];
+	SourceLocation location = token_location(ctx->unit->list, token);
+	snprintf(ctx->errmsg, ERRMSG_SIZE, "(%i, %i): %s", location.line, location.column, msg);
 }
 
-void push_operator(enum LangOperator operator)
+void print_compiler_error(struct CompilerContext *ctx, FILE *file)
 {
-	assert(operator_stack_size < 50);
-	operator_stack[operator_stack_size] = operator;
-	operator_stack_size++;
+	fprintf(file, "Failed to compile.\n%s\n", ctx->errmsg);
 }
 
-struct TypedValue pop_value()
+static AstNode *get_node(struct CompilerContext *ctx, NodeIndex index)
 {
-	if (value_stack_size == 0 || value_stack_size == value_stack_min) return value_stack[0];
-	value_stack_size--;
-	return value_stack[value_stack_size];
+	return &ctx->tree->nodes.data[index];
 }
 
-void push_value(struct TypedValue *value)
+//Token the node was parsed from, where errors about it are reported
+static Token *node_token(struct CompilerContext *ctx, AstNode *node)
 {
-	assert(value_stack_size < 50);
-	value_stack[value_stack_size] = *value;
-	value_stack_size++;
+	return &ctx->unit->list->tokens.data[node->value];
 }
 
-bool should_evaluate(enum LangOperator next_operator)
+static Token *get_token(struct CompilerContext *ctx, int token_index)
 {
-	enum LangOperator last_operator = peek_operator();
-	if (last_operator == LANG_OP_INVALID) return false;
-	if (operator_precedence(last_operator) <= operator_precedence(next_operator)) return true;
-	return false;
+	return &ctx->unit->list->tokens.data[token_index];
 }
 
 void type_info(struct TypeDescriptor *td, struct TypeInfo *info)
@@ -145,6 +125,31 @@ void type_info(struct TypeDescriptor *td, struct TypeInfo *info)
 
 }
 
+//Converts a type from the tree to the type the compiler checks against. bool is lowered as u8.
+static struct TypeDescriptor lang_type_descriptor(TypeDescriptor descriptor)
+{
+	static const enum LangBaseType base_types[] =
+	{
+		[BASE_TYPE_VOID] = LANG_TYPE_VOID,
+		[BASE_TYPE_U8] = LANG_TYPE_U8,
+		[BASE_TYPE_S8] = LANG_TYPE_I8,
+		[BASE_TYPE_U16] = LANG_TYPE_U16,
+		[BASE_TYPE_S16] = LANG_TYPE_I16,
+		[BASE_TYPE_BOOL] = LANG_TYPE_U8,
+	};
+
+	return (struct TypeDescriptor)
+	{
+		.base_type = base_types[descriptor.base_type],
+		.ptr_count = descriptor.ptr_count
+	};
+}
+
+static bool type_is_void(struct TypeDescriptor *td)
+{
+	return td->base_type == LANG_TYPE_VOID && td->ptr_count == 0;
+}
+
 enum LangBaseType int_literal_base_type(Token *token)
 {
 	if (token->is_negative)
@@ -168,20 +173,16 @@ enum IrBaseType convert_type_descriptor(struct TypeDescriptor *descriptor)
 	return IRTYPE_I0;
 }
 
+//Gives a literal value an IR variable of its current type. Does nothing for other values.
 void define_ir_number(struct CompilerContext *ctx, struct TypedValue *value)
 {
-	if (value->location == VAL_LOC_TOKEN)
-	{
-		enum IrBaseType ir_type = convert_type_descriptor(&value->type);
-		struct IrInst *define = ir_push_define(&ctx->ir_context, ir_type, value->token->int_literal);
-		value->ir_var_number = define->dst_var;
-	}
-	if (value->location == VAL_LOC_DECL)
-	{
-		enum IrBaseType ir_type = convert_type_descriptor(&value->type);
-		struct IrInst *define = ir_push_define(&ctx->ir_context, ir_type, value->token->int_literal);
-		value->ir_var_number = define->dst_var;
-	}
+	if (value->location != VAL_LOC_TOKEN) return;
+
+	Token *token = value->token;
+	uint64_t literal = token->is_negative ? (uint64_t)-(int64_t)token->int_literal : token->int_literal;
+	enum IrBaseType ir_type = convert_type_descriptor(&value->type);
+	value->ir_var_number = ir_push_define(&ctx->ir_context, ir_type, literal);
+	value->location = VAL_LOC_TEMP;
 }
 
 //Returns true if the integer literal in the token will fit in the desired type
@@ -229,7 +230,7 @@ bool implicit_cast(struct CompilerContext *ctx, struct TypedValue *value, struct
 
 	if (td->ptr_count > 0 || value->type.ptr_count > 0)
 	{
-		set_compiler_error("Cannot implictly cast pointer", current_token);
+		set_compiler_error(ctx, "Cannot implictly cast pointer", current_token);
 		return false;
 	}
 
@@ -242,13 +243,13 @@ bool implicit_cast(struct CompilerContext *ctx, struct TypedValue *value, struct
 		{
 			if (!int_can_fit(value->token, LANG_TYPE_U8))
 			{
-				set_compiler_error("Implicit cast of integer literal would result in data loss", current_token);
+				set_compiler_error(ctx, "Implicit cast of integer literal would result in data loss", current_token);
 				return false;
 			}
 			value->type.base_type = LANG_TYPE_U8;
 			return true;
 		}
-		set_compiler_error("Implicit conversion failed", current_token);
+		set_compiler_error(ctx, "Implicit conversion failed", current_token);
 		return false;
 	}
 
@@ -258,13 +259,13 @@ bool implicit_cast(struct CompilerContext *ctx, struct TypedValue *value, struct
 		{
 			if (!int_can_fit(value->token, LANG_TYPE_I8))
 			{
-				set_compiler_error("Implicit cast of integer literal would result in data loss", current_token);
+				set_compiler_error(ctx, "Implicit cast of integer literal would result in data loss", current_token);
 				return false;
 			}
 			value->type.base_type = LANG_TYPE_I8;
 			return true;
 		}
-		set_compiler_error("Implicit conversion failed", current_token);
+		set_compiler_error(ctx, "Implicit conversion failed", current_token);
 		return false;
 	}
 
@@ -274,7 +275,7 @@ bool implicit_cast(struct CompilerContext *ctx, struct TypedValue *value, struct
 		{
 			if (!int_can_fit(value->token, LANG_TYPE_U16))
 			{
-				set_compiler_error("Implicit cast of integer literal would result in data loss", current_token);
+				set_compiler_error(ctx, "Implicit cast of integer literal would result in data loss", current_token);
 				return false;
 			}
 			value->type.base_type = LANG_TYPE_U16;
@@ -283,18 +284,18 @@ bool implicit_cast(struct CompilerContext *ctx, struct TypedValue *value, struct
 
 		if (value_type_info.is_signed)
 		{
-			set_compiler_error("Cannot implictly convert a signed value to an unsigned value", current_token);
+			set_compiler_error(ctx, "Cannot implictly convert a signed value to an unsigned value", current_token);
 			return false;
 		}
 		if (value_type_info.width_bytes > 2)
 		{
-			set_compiler_error("Cannot implictly convert integer to a smaller type", current_token);
+			set_compiler_error(ctx, "Cannot implictly convert integer to a smaller type", current_token);
 			return false;
 		}
 
-		struct IrInst *inst = ir_push_extend(ctx, value->ir_var_number, IRTYPE_I16, false);
+		value->ir_var_number = ir_push_extend(&ctx->ir_context, value->ir_var_number, IRTYPE_I16, false);
 		value->type.base_type = LANG_TYPE_U16;
-		value->ir_var_number = inst->dst_var;
+		value->location = VAL_LOC_TEMP;
 		return true;
 	}
 
@@ -304,7 +305,7 @@ bool implicit_cast(struct CompilerContext *ctx, struct TypedValue *value, struct
 		{
 			if (!int_can_fit(value->token, LANG_TYPE_I16))
 			{
-				set_compiler_error("Implicit cast of integer literal would result in data loss", current_token);
+				set_compiler_error(ctx, "Implicit cast of integer literal would result in data loss", current_token);
 				return false;
 			}
 			value->type.base_type = LANG_TYPE_I16;
@@ -313,455 +314,960 @@ bool implicit_cast(struct CompilerContext *ctx, struct TypedValue *value, struct
 
 		if (!value_type_info.is_signed)
 		{
-			set_compiler_error("Cannot implictly convert a signed value to an unsigned value", current_token);
+			set_compiler_error(ctx, "Cannot implictly convert a signed value to an unsigned value", current_token);
 			return false;
 		}
 		if (value_type_info.width_bytes > 2)
 		{
-			set_compiler_error("Cannot implictly convert integer to a smaller type", current_token);
+			set_compiler_error(ctx, "Cannot implictly convert integer to a smaller type", current_token);
 			return false;
 		}
 
-		struct IrInst *inst = ir_push_extend(ctx, value->ir_var_number, IRTYPE_I16, true);
+		value->ir_var_number = ir_push_extend(&ctx->ir_context, value->ir_var_number, IRTYPE_I16, true);
 		value->type.base_type = LANG_TYPE_I16;
-		value->ir_var_number = inst->dst_var;
+		value->location = VAL_LOC_TEMP;
 		return true;
 	}
 
-	set_compiler_error("Implicit conversion failed", current_token);
+	set_compiler_error(ctx, "Implicit conversion failed", current_token);
 	return false;
 }
 
 bool upgrade_ints(struct CompilerContext *ctx, struct TypedValue *v1, struct TypedValue *v2, Token *current_token)
 {
-	//The smaller type is upgraded to the larger type.
-	//Signed and unsigned values cannot be upgraded to each other.
-	struct BaseTypeInfo v1_info = {0};
-	struct BaseTypeInfo v2_info = {0};
+	//A literal takes the type of the value it is combined with. Otherwise the smaller type is upgraded
+	//to the larger type. Signed and unsigned values cannot be upgraded to each other.
+	struct TypeInfo v1_info = {0};
+	struct TypeInfo v2_info = {0};
 	type_info(&v1->type, &v1_info);
 	type_info(&v2->type, &v2_info);
 
 	if (!v1_info.is_algebraic || !v2_info.is_algebraic)
 	{
-		set_compiler_error("Cannot perform arithemtic on non-algebraic types", current_token);
+		set_compiler_error(ctx, "Cannot perform arithemtic on non-algebraic types", current_token);
 		return false;
 	}
 
-	if (v1_info.width_bytes > v2_info.width_bytes || v2->location == VAL_LOC_TOKEN)
-	{
-		bool r = implicit_cast(ctx, v2, &v1->type, current_token);
-		if (!r) return false;
-		return true;
-	}
+	bool v1_literal = v1->location == VAL_LOC_TOKEN;
+	bool v2_literal = v2->location == VAL_LOC_TOKEN;
+	bool cast_v2 = true;
+	if (v1_literal != v2_literal)
+		cast_v2 = v2_literal;
+	else if (v1_info.width_bytes != v2_info.width_bytes)
+		cast_v2 = v1_info.width_bytes > v2_info.width_bytes;
+	else if (v1_literal)
+		//Of two literals of the same size, a negative one keeps its signed type
+		cast_v2 = !v2->token->is_negative;
+
+	if (cast_v2)
+		return implicit_cast(ctx, v2, &v1->type, current_token);
+	return implicit_cast(ctx, v1, &v2->type, current_token);
+}
 
-	bool r = implicit_cast(ctx, v1, &v2->type, current_token);
-	if (!r) return false;
+//Emits an add, sub or mul of two values of the same type
+static bool compile_arithmetic(struct CompilerContext *ctx, NodeType type, struct TypedValue *v1, struct TypedValue *v2, struct TypedValue *result, Token *current_token)
+{
+	if (!upgrade_ints(ctx, v1, v2, current_token)) return false;
+
+	define_ir_number(ctx, v1);
+	define_ir_number(ctx, v2);
+	int dst_var = 0;
+	if (type == NODE_ADD)
+		dst_var = ir_push_add(&ctx->ir_context, v1->ir_var_number, v2->ir_var_number, 0);
+	else if (type == NODE_SUBTRACT)
+		dst_var = ir_push_sub(&ctx->ir_context, v1->ir_var_number, v2->ir_var_number, 0);
+	else
+		dst_var = ir_push_mul(&ctx->ir_context, v1->ir_var_number, v2->ir_var_number, 0);
+
+	*result = (struct TypedValue)
+	{
+		.type = v1->type,
+		.location = VAL_LOC_TEMP,
+		.ir_var_number = dst_var
+	};
 	return true;
 }
 
-void compile_add(struct CompilerContext *ctx, struct TypedValue *v1, struct TypedValue *v2, Token *current_token)
+static bool compile_cast(struct CompilerContext *ctx, struct TypedValue *value, struct TypeDescriptor *td, Token *current_token)
 {
-	//TODO: error checking
-	bool r = upgrade_ints(ctx, v1, v2, current_token);
-	if (!r)
+	if (value->type.ptr_count > 0 && td->ptr_count > 0)
 	{
-		print_compiler_error();
-		return;
+		value->type = *td;
+		return true;
 	}
 
-	define_ir_number(ctx, v1);
-	define_ir_number(ctx, v2);
-	struct IrInst *add = ir_push_add(&ctx->ir_context, v1->ir_var_number, v2->ir_var_number, 0);
+	struct TypeInfo value_info = {0};
+	struct TypeInfo td_info = {0};
+	type_info(&value->type, &value_info);
+	type_info(td, &td_info);
 
-	push_value(&(struct TypedValue)
+	if (!value_info.is_algebraic || !td_info.is_algebraic)
 	{
-		.type = v2->type,
-		.location = VAL_LOC_STACK,
-		.ir_var_number = add->dst_var
-	});
+		set_compiler_error(ctx, "Cannot cast non-algebraic types", current_token);
+		return false;
+	}
+
+	if (value->location == VAL_LOC_TOKEN)
+	{
+		//A literal that fits is retyped. Any other literal is defined and converted like a variable.
+		if (td->ptr_count > 0 || int_can_fit(value->token, td->base_type))
+		{
+			value->type = *td;
+			return true;
+		}
+		define_ir_number(ctx, value);
+	}
+
+	if (value_info.width_bytes == td_info.width_bytes)
+	{
+		value->type = *td;
+		return true;
+	}
+
+	enum IrBaseType new_ir_type = convert_type_descriptor(td);
+	if (td_info.width_bytes < value_info.width_bytes)
+		value->ir_var_number = ir_push_trunc(&ctx->ir_context, value->ir_var_number, new_ir_type);
+	else
+		value->ir_var_number = ir_push_extend(&ctx->ir_context, value->ir_var_number, new_ir_type, value_info.is_signed);
+
+	value->location = VAL_LOC_TEMP;
+	value->type = *td;
+	return true;
 }
 
-void compile_mul(struct CompilerContext *ctx, struct TypedValue *v1, struct TypedValue *v2, Token *current_token)
+static bool lower_expression(struct CompilerContext *ctx, NodeIndex index, struct TypedValue *value);
+static bool lower_condition(struct CompilerContext *ctx, NodeIndex index, int true_label, int false_label);
+static bool lower_statement(struct CompilerContext *ctx, NodeIndex index);
+
+//Finds the type a pointer value points to
+static bool pointee_type(struct CompilerContext *ctx, struct TypedValue *pointer, struct TypeDescriptor *td, Token *current_token)
 {
-	//TODO: error checking
-	bool r = upgrade_ints(ctx, v1, v2, current_token);
-	if (!r)
+	if (pointer->type.ptr_count == 0)
 	{
-		print_compiler_error();
-		return;
+		set_compiler_error(ctx, "Cannot dereference a value that is not a pointer", current_token);
+		return false;
 	}
 
-	define_ir_number(ctx, v1);
-	define_ir_number(ctx, v2);
-	struct IrInst *mul = ir_push_mul(&ctx->ir_context, v1->ir_var_number, v2->ir_var_number, 0);
-
-	push_value(&(struct TypedValue)
+	*td = pointer->type;
+	td->ptr_count--;
+	if (type_is_void(td))
 	{
-		.type = v2->type,
-		.location = VAL_LOC_STACK,
-		.ir_var_number = mul->dst_var
-	});
+		set_compiler_error(ctx, "Cannot dereference a void pointer", current_token);
+		return false;
+	}
+	return true;
 }
 
-void compile_assign(struct CompilerContext *ctx, struct TypedValue *v1, struct TypedValue *v2, Token *current_token)
+//Replaces a pointer value with the value it points to
+static bool lower_load(struct CompilerContext *ctx, struct TypedValue *value, Token *current_token)
 {
-	//TODO: error checking
-	struct Variable *lvar = NULL;
-	if (v1->location == VAL_LOC_DECL)
+	struct TypeDescriptor td;
+	if (!pointee_type(ctx, value, &td, current_token)) return false;
+
+	define_ir_number(ctx, value);
+	value->ir_var_number = ir_push_load(&ctx->ir_context, value->ir_var_number, convert_type_descriptor(&td));
+	value->location = VAL_LOC_TEMP;
+	value->type = td;
+	return true;
+}
+
+//Stores the value of the right side of an assignment in its target, declaring the target first if it is a declaration.
+//The address of a dereferenced target is on the value stack.
+static bool lower_assign(struct CompilerContext *ctx, AstNode *node, struct TypedValue source, struct TypedValue *value)
+{
+	AstNode *target = get_node(ctx, node->left);
+
+	if (target->type == NODE_DEREF)
+	{
+		struct TypedValue pointer = typed_value_vector_pop(&ctx->value_stack);
+		struct TypeDescriptor td;
+		if (!pointee_type(ctx, &pointer, &td, node_token(ctx, target))) return false;
+		if (!implicit_cast(ctx, &source, &td, node_token(ctx, node))) return false;
+
+		define_ir_number(ctx, &pointer);
+		define_ir_number(ctx, &source);
+		ir_push_store(&ctx->ir_context, pointer.ir_var_number, source.ir_var_number);
+		*value = source;
+		return true;
+	}
+
+	if (target->type == NODE_VAR_DECL)
 	{
+		//The initializer is lowered before the name is bound, so it still sees any variable the declaration hides
 		struct Variable variable = (struct Variable)
 		{
-			.name_token = v1->token,
-			.type = v1->type,
-			.ir_var_number = v1->ir_var_number
+			.name = node_token(ctx, target)->symbol,
+			.type = lang_type_descriptor(ast_node_type_descriptor(target))
 		};
-		vec_push(struct Variable, &ctx->variables, &variable);
-		lvar = &vec_last(struct Variable, &ctx->variables);
+		if (type_is_void(&variable.type))
+		{
+			set_compiler_error(ctx, "Cannot declare a void variable", node_token(ctx, target));
+			return false;
+		}
+		if (!implicit_cast(ctx, &source, &variable.type, node_token(ctx, node))) return false;
+
+		define_ir_number(ctx, &source);
+		//The variable needs its own IR variable when the value already belongs to another variable
+		if (source.location == VAL_LOC_VARIABLE)
+			variable.ir_var_number = ir_push_copy(&ctx->ir_context, source.ir_var_number, 0);
+		else
+			variable.ir_var_number = source.ir_var_number;
+
+		struct Variable *declared = declare_variable(ctx, variable);
+		*value = (struct TypedValue){ .type = declared->type, .location = VAL_LOC_VARIABLE, .ir_var_number = declared->ir_var_number };
+		return true;
 	}
 
-	bool r = implicit_cast(ctx, v2, &v1->type, current_token);
-	if (!r)
+	struct Variable *variable = find_variable(ctx, node_token(ctx, target)->symbol);
+	if (!variable)
 	{
-		print_compiler_error();
-		return;
+		set_compiler_error(ctx, "Undeclared identifier", node_token(ctx, target));
+		return false;
 	}
+	if (!implicit_cast(ctx, &source, &variable->type, node_token(ctx, node))) return false;
+
+	define_ir_number(ctx, &source);
+	ir_push_copy(&ctx->ir_context, source.ir_var_number, variable->ir_var_number);
+	*value = (struct TypedValue){ .type = variable->type, .location = VAL_LOC_VARIABLE, .ir_var_number = variable->ir_var_number };
+	return true;
+}
 
-	if (v1->location == VAL_LOC_DECL)
+//Returns the signature of the function a call node names, or NULL if there is no such function
+static FuncDescriptor *find_callee(struct CompilerContext *ctx, AstNode *node)
+{
+	int *function_index = function_map_get(&ctx->function_lookup, node_token(ctx, node)->symbol);
+	if (!function_index) return NULL;
+	return &ctx->unit->functions.data[*function_index].signature;
+}
+
+//Converts the arguments of a call, which are the top entries of the value stack, and emits the call
+static bool lower_call(struct CompilerContext *ctx, AstNode *node, struct TypedValue *value)
+{
+	Token *name = node_token(ctx, node);
+	FuncDescriptor *callee = find_callee(ctx, node);
+	FuncParamDescriptor *params = func_param_vector_data(&callee->parameters);
+	int arg_count = callee->parameters.size;
+	struct TypedValue *args = &ctx->value_stack.data[ctx->value_stack.size - arg_count];
+
+	IrVarNumberVector arg_vars = ir_var_number_vector_create(arg_count);
+	for (int i = 0; i < arg_count; i++)
 	{
-		define_ir_number(ctx, v2);
-		if (v2->location == VAL_LOC_VARIABLE)
+		struct TypeDescriptor param_type = lang_type_descriptor(params[i].type);
+		if (!implicit_cast(ctx, &args[i], &param_type, name))
 		{
-			struct IrInst *copy = ir_push_copy(ctx, v2->ir_var_number, 0);
-			lvar->ir_var_number = copy->dst_var;
-			return;
+			ir_var_number_vector_free(&arg_vars);
+			return false;
 		}
-		lvar->ir_var_number = v2->ir_var_number;
-		return;
+		define_ir_number(ctx, &args[i]);
+		ir_var_number_vector_push(&arg_vars, args[i].ir_var_number);
 	}
+	ctx->value_stack.size -= arg_count;
 
-	define_ir_number(ctx, v1);
-	define_ir_number(ctx, v2);
-	struct IrInst *copy = ir_push_copy(ctx, v2->ir_var_number, v1->ir_var_number);
+	struct TypeDescriptor return_type = lang_type_descriptor(callee->return_type);
+	int result = ir_push_call(&ctx->ir_context, token_text(ctx->unit->list, name), name->length,
+		convert_type_descriptor(&return_type), arg_vars.data, arg_vars.size);
+	ir_var_number_vector_free(&arg_vars);
+
+	*value = (struct TypedValue){ .type = return_type, .location = VAL_LOC_TEMP, .ir_var_number = result };
+	return true;
 }
 
-void compile_cast(struct CompilerContext *ctx, Token *current_token)
+//Turns a condition into a u8 that is 1 if it holds and 0 otherwise
+static bool lower_condition_value(struct CompilerContext *ctx, NodeIndex index, struct TypedValue *value)
 {
-	struct TypedValue value = pop_value();
-	struct TypeDescriptor td = pop_value().type;
+	int result = ir_push_define(&ctx->ir_context, IRTYPE_I8, 0);
+	int true_label = ir_new_label(&ctx->ir_context);
+	int end_label = ir_new_label(&ctx->ir_context);
+	if (!lower_condition(ctx, index, true_label, end_label)) return false;
+
+	ir_push_label(&ctx->ir_context, true_label);
+	int one = ir_push_define(&ctx->ir_context, IRTYPE_I8, 1);
+	ir_push_copy(&ctx->ir_context, one, result);
+	ir_push_label(&ctx->ir_context, end_label);
 
-	if (value.type.ptr_count > 0 && td.ptr_count > 0)
+	*value = (struct TypedValue)
 	{
-		value.type.ptr_count = td.ptr_count;
-		value.type.base_type = td.base_type;
-		return true;
-	}
+		.type = (struct TypeDescriptor){ .base_type = LANG_TYPE_U8 },
+		.location = VAL_LOC_TEMP,
+		.ir_var_number = result
+	};
+	return true;
+}
 
-	struct TypeInfo value_info = {0};
-	struct TypeInfo td_info = {0};
-	type_info(&value.type, &value_info);
-	type_info(&td, &td_info);
+static void push_pending_node(struct CompilerContext *ctx, NodeIndex index, bool operands_pushed)
+{
+	pending_node_vector_push(&ctx->operator_stack, (struct PendingNode){ .node = index, .operands_pushed = operands_pushed });
+}
 
-	if (!value_info.is_algebraic || !td_info.is_algebraic)
+//Lowers a node that has no operands on the operator stack and returns its value
+static bool lower_leaf(struct CompilerContext *ctx, NodeIndex index, struct TypedValue *value)
+{
+	AstNode *node = get_node(ctx, index);
+	switch (node->type)
 	{
-		set_compiler_error("Cannot case non-algebraic types", current_token);
-		print_compiler_error();
-		return;
+	case NODE_NUMBER:
+	{
+		Token *token = node_token(ctx, node);
+		enum LangBaseType base_type = int_literal_base_type(token);
+		if (base_type == LANG_TYPE_INVALID)
+		{
+			set_compiler_error(ctx, "Integer literal is too large", token);
+			return false;
+		}
+		*value = (struct TypedValue)
+		{
+			.type = (struct TypeDescriptor){ .base_type = base_type },
+			.location = VAL_LOC_TOKEN,
+			.token = token
+		};
+		return true;
 	}
-
-	if (value.location == VAL_LOC_TOKEN)
+	case NODE_VAR:
 	{
-		//TODO: We should check that the integer literal in the token can actually be cast to a ptr without its value changing
-		value.type.base_type = td.base_type;
-		value.type.ptr_count = td.ptr_count;
-		push_value(&value);
-		return;
+		struct Variable *variable = find_variable(ctx, node_token(ctx, node)->symbol);
+		if (!variable)
+		{
+			set_compiler_error(ctx, "Undeclared identifier", node_token(ctx, node));
+			return false;
+		}
+		*value = (struct TypedValue){ .type = variable->type, .location = VAL_LOC_VARIABLE, .ir_var_number = variable->ir_var_number };
+		return true;
 	}
-
-	if (value_info.width_bytes == td_info.width_bytes)
+	case NODE_VAR_DECL:
 	{
-		value.type.base_type = td.base_type;
-		value.type.ptr_count = td.ptr_count;
-		push_value(&value);
-		return;
+		//A declaration without an initializer starts out as 0
+		struct Variable variable = (struct Variable)
+		{
+			.name = node_token(ctx, node)->symbol,
+			.type = lang_type_descriptor(ast_node_type_descriptor(node))
+		};
+		if (type_is_void(&variable.type))
+		{
+			set_compiler_error(ctx, "Cannot declare a void variable", node_token(ctx, node));
+			return false;
+		}
+		variable.ir_var_number = ir_push_define(&ctx->ir_context, convert_type_descriptor(&variable.type), 0);
+		struct Variable *declared = declare_variable(ctx, variable);
+		*value = (struct TypedValue){ .type = declared->type, .location = VAL_LOC_VARIABLE, .ir_var_number = declared->ir_var_number };
+		return true;
 	}
-
-	enum IrBaseType new_ir_type =  convert_type_descriptor(&td);
-	if (td_info.width_bytes < value_info.width_bytes)
+	case NODE_TRUE:
+	case NODE_FALSE:
 	{
-		struct IrInst *trunc = ir_push_trunc(ctx, value.ir_var_number, new_ir_type);
-		value.ir_var_number = trunc->dst_var;
-		value.type.base_type = td.base_type;
-		value.type.ptr_count = td.ptr_count;
-		push_value(&value);
-		return;
+		int define = ir_push_define(&ctx->ir_context, IRTYPE_I8, node->type == NODE_TRUE);
+		*value = (struct TypedValue)
+		{
+			.type = (struct TypeDescriptor){ .base_type = LANG_TYPE_U8 },
+			.location = VAL_LOC_TEMP,
+			.ir_var_number = define
+		};
+		return true;
+	}
+	case NODE_CMP_EQ:
+	case NODE_CMP_NEQ:
+	case NODE_CMP_LT:
+	case NODE_CMP_GT:
+	case NODE_CMP_LE:
+	case NODE_CMP_GE:
+	case NODE_LOGIC_AND:
+	case NODE_LOGIC_OR:
+		//Conditions place labels between their operands, so they are lowered on the condition stack
+		return lower_condition_value(ctx, index, value);
+	case NODE_REF:
+	{
+		//Only variables have an address
+		AstNode *operand = get_node(ctx, node->left);
+		if (operand->type != NODE_VAR)
+		{
+			set_compiler_error(ctx, "Can only take the address of a variable", node_token(ctx, node));
+			return false;
+		}
+		struct Variable *variable = find_variable(ctx, node_token(ctx, operand)->symbol);
+		if (!variable)
+		{
+			set_compiler_error(ctx, "Undeclared identifier", node_token(ctx, operand));
+			return false;
+		}
+		*value = (struct TypedValue)
+		{
+			.type = (struct TypeDescriptor){ .base_type = variable->type.base_type, .ptr_count = variable->type.ptr_count + 1 },
+			.location = VAL_LOC_TEMP,
+			.ir_var_number = ir_push_addrof(&ctx->ir_context, variable->ir_var_number)
+		};
+		return true;
+	}
+	case NODE_STRING:
+	case NODE_NULL:
+		set_compiler_error(ctx, "Strings and null cannot be compiled yet", node_token(ctx, node));
+		return false;
+	default:
+		set_compiler_error(ctx, "Expected a value", node_token(ctx, node));
+		return false;
 	}
-
-	struct IrInst *extend = ir_push_extend(ctx, value.ir_var_number, new_ir_type, value_info.is_signed);
-	value.ir_var_number = extend->dst_var;
-	value.type.base_type = td.base_type;
-	value.type.ptr_count = td.ptr_count;
-	push_value(&value);
-	return;
 }
 
-bool evaluate(struct CompilerContext *ctx, Token *current_token)
+//First visit of a node on the operator stack. An operator pushes itself back and then its operands, so
+//the operands are lowered first and in order. Any other node is lowered right away.
+static bool expand_node(struct CompilerContext *ctx, NodeIndex index)
 {
-	enum LangOperator operator = pop_operator();
-	if (operator == LANG_OP_ADD)
+	AstNode *node = get_node(ctx, index);
+	switch (node->type)
 	{
-		struct TypedValue v2 = pop_value();
-		struct TypedValue v1 = pop_value();
-		compile_add(ctx, &v1, &v2, current_token);
+	case NODE_ADD:
+	case NODE_SUBTRACT:
+	case NODE_MULTIPLY:
+	case NODE_COMMA:
+		push_pending_node(ctx, index, true);
+		push_pending_node(ctx, node->right, false);
+		push_pending_node(ctx, node->left, false);
 		return true;
-	}
-	if (operator == LANG_OP_MUL)
+	case NODE_CAST:
+	case NODE_DEREF:
+		push_pending_node(ctx, index, true);
+		push_pending_node(ctx, node->left, false);
+		return true;
+	case NODE_ASSIGN:
 	{
-		struct TypedValue v2 = pop_value();
-		struct TypedValue v1 = pop_value();
-		compile_mul(ctx, &v1, &v2, current_token);
+		//Only the right side is a value. The target is resolved once the value is known.
+		AstNode *target = get_node(ctx, node->left);
+		if (target->type == NODE_DEREF)
+		{
+			//Except for the address a dereferenced target stores to, which is lowered first
+			push_pending_node(ctx, index, true);
+			push_pending_node(ctx, node->right, false);
+			push_pending_node(ctx, target->left, false);
+			return true;
+		}
+		if (target->type != NODE_VAR && target->type != NODE_VAR_DECL)
+		{
+			set_compiler_error(ctx, "Cannot assign to this expression", node_token(ctx, node));
+			return false;
+		}
+		push_pending_node(ctx, index, true);
+		push_pending_node(ctx, node->right, false);
 		return true;
 	}
-	if (operator == LANG_OP_ASSIGN)
+	case NODE_FUNC_CALL:
 	{
-		struct TypedValue v2 = pop_value();
-		struct TypedValue v1 = pop_value();
-		compile_assign(ctx, &v1, &v2, current_token);
+		FuncDescriptor *callee = find_callee(ctx, node);
+		if (!callee)
+		{
+			set_compiler_error(ctx, "Undeclared function", node_token(ctx, node));
+			return false;
+		}
+
+		//The arguments are a left leaning chain of commas. Walking it from the root meets the last argument
+		//first, so pushing them in that order leaves the first argument on top.
+		push_pending_node(ctx, index, true);
+		int arg_count = 0;
+		NodeIndex argument = node->left;
+		while (argument != NODE_INDEX_NONE && get_node(ctx, argument)->type == NODE_COMMA)
+		{
+			push_pending_node(ctx, get_node(ctx, argument)->right, false);
+			argument = get_node(ctx, argument)->left;
+			arg_count++;
+		}
+		if (argument != NODE_INDEX_NONE)
+		{
+			push_pending_node(ctx, argument, false);
+			arg_count++;
+		}
+
+		if (arg_count != callee->parameters.size)
+		{
+			set_compiler_error(ctx, "Wrong number of arguments", node_token(ctx, node));
+			return false;
+		}
 		return true;
 	}
-	if (operator == LANG_OP_CAST)
+	default:
 	{
-		compile_cast(ctx, current_token);
+		struct TypedValue value;
+		if (!lower_leaf(ctx, index, &value)) return false;
+		typed_value_vector_push(&ctx->value_stack, value);
 		return true;
 	}
-	return false;
+	}
 }
 
-bool parse_type_descriptor(Token **tokens, int index, int token_count, int *next_index, struct TypeDescriptor *td)
+//Second visit of an operator. Its operands are the top entries of the value stack and are replaced by its result.
+static bool apply_node(struct CompilerContext *ctx, NodeIndex index)
 {
-	Token *token = tokens[index];
-	enum LangBaseType base_type = lang_base_type_from_token(token->type);
-	if (base_type == LANG_TYPE_INVALID) return false;
+	AstNode *node = get_node(ctx, index);
+	struct TypedValue result;
+	switch (node->type)
+	{
+	case NODE_ADD:
+	case NODE_SUBTRACT:
+	case NODE_MULTIPLY:
+	{
+		struct TypedValue v2 = typed_value_vector_pop(&ctx->value_stack);
+		struct TypedValue v1 = typed_value_vector_pop(&ctx->value_stack);
+		if (!compile_arithmetic(ctx, node->type, &v1, &v2, &result, node_token(ctx, node))) return false;
+		break;
+	}
+	case NODE_COMMA:
+		result = typed_value_vector_pop(&ctx->value_stack);
+		typed_value_vector_pop(&ctx->value_stack);
+		break;
+	case NODE_CAST:
+	{
+		struct TypeDescriptor td = lang_type_descriptor(ast_node_type_descriptor(node));
+		result = typed_value_vector_pop(&ctx->value_stack);
+		if (!compile_cast(ctx, &result, &td, node_token(ctx, node))) return false;
+		break;
+	}
+	case NODE_DEREF:
+		result = typed_value_vector_pop(&ctx->value_stack);
+		if (!lower_load(ctx, &result, node_token(ctx, node))) return false;
+		break;
+	case NODE_ASSIGN:
+		if (!lower_assign(ctx, node, typed_value_vector_pop(&ctx->value_stack), &result)) return false;
+		break;
+	case NODE_FUNC_CALL:
+		if (!lower_call(ctx, node, &result)) return false;
+		break;
+	default:
+		assert(false);
+		return false;
+	}
 
-	index++;
-	if (index >= token_count) return false;
-	token = tokens[index];
+	typed_value_vector_push(&ctx->value_stack, result);
+	return true;
+}
+
+static bool lower_expression(struct CompilerContext *ctx, NodeIndex index, struct TypedValue *value)
+{
+	//The stacks can already hold the entries of an expression this one is nested in
+	int operator_base = ctx->operator_stack.size;
+	int value_base = ctx->value_stack.size;
 
-	int ptr_count = 0;
-	while (token->type == TOKEN_STAR)
+	push_pending_node(ctx, index, false);
+	bool success = true;
+	while (success && ctx->operator_stack.size > operator_base)
 	{
-		ptr_count++;
-		index++;
-		if (index >= token_count) return false;
-		token = tokens[index];
+		struct PendingNode pending = pending_node_vector_pop(&ctx->operator_stack);
+		success = pending.operands_pushed ? apply_node(ctx, pending.node) : expand_node(ctx, pending.node);
 	}
 
-	*td = (struct TypeDescriptor)
+	if (success)
 	{
-		.base_type = base_type,
-		.ptr_count = ptr_count
-	};
-	*next_index = index;
+		assert(ctx->value_stack.size == value_base + 1);
+		*value = ctx->value_stack.data[value_base];
+	}
+	ctx->operator_stack.size = operator_base;
+	ctx->value_stack.size = value_base;
+	return success;
+}
+
+//Emits a conditional jump on the comparison of two values
+static bool lower_comparison(struct CompilerContext *ctx, AstNode *node, int true_label, int false_label)
+{
+	struct TypedValue v1;
+	struct TypedValue v2;
+	if (!lower_expression(ctx, node->left, &v1)) return false;
+	if (!lower_expression(ctx, node->right, &v2)) return false;
+	if (!upgrade_ints(ctx, &v1, &v2, node_token(ctx, node))) return false;
+	define_ir_number(ctx, &v1);
+	define_ir_number(ctx, &v2);
+
+	struct TypeInfo info = {0};
+	type_info(&v1.type, &info);
+
+	enum IrCompare compare = IRCMP_EQ;
+	switch (node->type)
+	{
+	case NODE_CMP_NEQ:
+	{
+		int label = true_label;
+		true_label = false_label;
+		false_label = label;
+		break;
+	}
+	case NODE_CMP_LT:
+		compare = IRCMP_LT;
+		break;
+	case NODE_CMP_GT:
+		compare = IRCMP_GT;
+		break;
+	case NODE_CMP_LE:
+		compare = IRCMP_LE;
+		break;
+	case NODE_CMP_GE:
+		compare = IRCMP_GE;
+		break;
+	}
+
+	ir_push_branch(&ctx->ir_context, compare, info.is_signed, v1.ir_var_number, v2.ir_var_number, true_label, false_label);
 	return true;
 }
 
-bool push_var_decl(Token **tokens, int index, int token_count, int *next_index)
+static void push_pending_condition(struct CompilerContext *ctx, NodeIndex index, int true_label, int false_label)
 {
-	int new_idx = 0;
-	struct TypeDescriptor td;
-	bool r = parse_type_descriptor(tokens, index, token_count, &new_idx, &td);
-	if (!r) return r;
+	pending_condition_vector_push(&ctx->condition_stack, (struct PendingCondition)
+	{
+		.node = index,
+		.true_label = true_label,
+		.false_label = false_label
+	});
+}
+
+//Lowers one entry of the condition stack. && and || push their operands back with a label between them,
+//so the right side is skipped once the left side decides the result.
+static bool lower_pending_condition(struct CompilerContext *ctx, struct PendingCondition pending)
+{
+	if (pending.node == NODE_INDEX_NONE)
+	{
+		ir_push_label(&ctx->ir_context, pending.true_label);
+		return true;
+	}
+
+	AstNode *node = get_node(ctx, pending.node);
+	switch (node->type)
+	{
+	case NODE_LOGIC_AND:
+	case NODE_LOGIC_OR:
+	{
+		int right_label = ir_new_label(&ctx->ir_context);
+		push_pending_condition(ctx, node->right, pending.true_label, pending.false_label);
+		push_pending_condition(ctx, NODE_INDEX_NONE, right_label, 0);
+		if (node->type == NODE_LOGIC_AND)
+			push_pending_condition(ctx, node->left, right_label, pending.false_label);
+		else
+			push_pending_condition(ctx, node->left, pending.true_label, right_label);
+		return true;
+	}
+	case NODE_TRUE:
+		ir_push_jump(&ctx->ir_context, pending.true_label);
+		return true;
+	case NODE_FALSE:
+		ir_push_jump(&ctx->ir_context, pending.false_label);
+		return true;
+	case NODE_CMP_EQ:
+	case NODE_CMP_NEQ:
+	case NODE_CMP_LT:
+	case NODE_CMP_GT:
+	case NODE_CMP_LE:
+	case NODE_CMP_GE:
+		return lower_comparison(ctx, node, pending.true_label, pending.false_label);
+	default:
+	{
+		//Any other value holds if it is not 0
+		struct TypedValue value;
+		if (!lower_expression(ctx, pending.node, &value)) return false;
+		struct TypeInfo info = {0};
+		type_info(&value.type, &info);
+		if (!info.is_algebraic)
+		{
+			set_compiler_error(ctx, "Condition must be a number or a pointer", node_token(ctx, node));
+			return false;
+		}
+		define_ir_number(ctx, &value);
+		int zero = ir_push_define(&ctx->ir_context, convert_type_descriptor(&value.type), 0);
+		ir_push_branch(&ctx->ir_context, IRCMP_EQ, false, value.ir_var_number, zero, pending.false_label, pending.true_label);
+		return true;
+	}
+	}
+}
+
+//Jumps to true_label if the condition holds and to false_label otherwise
+static bool lower_condition(struct CompilerContext *ctx, NodeIndex index, int true_label, int false_label)
+{
+	//The stack can already hold the entries of a condition this one is nested in
+	int condition_base = ctx->condition_stack.size;
+
+	push_pending_condition(ctx, index, true_label, false_label);
+	bool success = true;
+	while (success && ctx->condition_stack.size > condition_base)
+		success = lower_pending_condition(ctx, pending_condition_vector_pop(&ctx->condition_stack));
+
+	ctx->condition_stack.size = condition_base;
+	return success;
+}
 
-	index = new_idx;
-	if (index >= token_count) return false;
-	Token *token = tokens[index];
+//Lowers the body of an if, else or while, which is a scope of its own
+static bool lower_body(struct CompilerContext *ctx, NodeIndex index)
+{
+	compiler_enter_scope(ctx);
+	bool r = lower_statement(ctx, index);
+	compiler_exit_scope(ctx);
+	return r;
+}
 
-	if (token->type != TOKEN_IDENTIFIER) return false;
+static bool lower_if(struct CompilerContext *ctx, AstNode *node)
+{
+	if (node->left == NODE_INDEX_NONE)
+	{
+		set_compiler_error(ctx, "Expected a condition", node_token(ctx, node));
+		return false;
+	}
 
-	push_value(&(struct TypedValue)
+	AstNode *branch = get_node(ctx, node->right);
+	int then_label = ir_new_label(&ctx->ir_context);
+	int else_label = ir_new_label(&ctx->ir_context);
+	int end_label = branch->right != NODE_INDEX_NONE ? ir_new_label(&ctx->ir_context) : else_label;
+
+	if (!lower_condition(ctx, node->left, then_label, else_label)) return false;
+	ir_push_label(&ctx->ir_context, then_label);
+	if (!lower_body(ctx, branch->left)) return false;
+	if (branch->right == NODE_INDEX_NONE)
 	{
-		.type = td,
-		.location = VAL_LOC_DECL,
-		.token = token
-	});
+		ir_push_label(&ctx->ir_context, end_label);
+		return true;
+	}
 
-	*next_index = index + 1;
+	ir_push_jump(&ctx->ir_context, end_label);
+	ir_push_label(&ctx->ir_context, else_label);
+	if (!lower_body(ctx, branch->right)) return false;
+	ir_push_label(&ctx->ir_context, end_label);
 	return true;
 }
 
-//Parses a cast. ex. (i16 **)
-bool parse_cast(struct CompilerContext *ctx, Token **tokens, int index, int token_count, int *next_index, struct TypeDescriptor *td)
+static bool lower_while(struct CompilerContext *ctx, AstNode *node)
 {
-	if (tokens[index]->type != TOKEN_OPEN_PAREN) return false;
-	index++;
-	if (index >= token_count) return false;
-	bool r = parse_type_descriptor(tokens, index, token_count, next_index, td);
+	if (node->left == NODE_INDEX_NONE)
+	{
+		set_compiler_error(ctx, "Expected a condition", node_token(ctx, node));
+		return false;
+	}
+
+	struct LoopLabels loop = (struct LoopLabels)
+	{
+		.continue_label = ir_new_label(&ctx->ir_context),
+		.break_label = ir_new_label(&ctx->ir_context)
+	};
+	int body_label = ir_new_label(&ctx->ir_context);
+
+	ir_push_label(&ctx->ir_context, loop.continue_label);
+	if (!lower_condition(ctx, node->left, body_label, loop.break_label)) return false;
+	ir_push_label(&ctx->ir_context, body_label);
+	loop_vector_push(&ctx->loops, loop);
+	bool r = lower_body(ctx, node->right);
+	loop_vector_pop(&ctx->loops);
 	if (!r) return false;
-	index = *next_index;
-	if (index >= token_count) return false;
-	if (tokens[index]->type != TOKEN_CLOSE_PAREN) return false;
-	*next_index = index + 1;
+	ir_push_jump(&ctx->ir_context, loop.continue_label);
+	ir_push_label(&ctx->ir_context, loop.break_label);
 	return true;
 }
 
-bool compile_expression(struct CompilerContext *ctx, Token **tokens, int index, int token_count, int *next_index, bool start)
+static bool lower_return(struct CompilerContext *ctx, AstNode *node)
 {
-	bool can_deref = true;
-
-	if (start)
+	struct TypeDescriptor return_type = lang_type_descriptor(ctx->function->signature.return_type);
+	if (node->left == NODE_INDEX_NONE)
 	{
-		int new_idx = 0;
-		bool r = push_var_decl(tokens, index, token_count, &new_idx);
-		if (r)
+		if (!type_is_void(&return_type))
 		{
-			index = new_idx;
+			set_compiler_error(ctx, "Missing return value", node_token(ctx, node));
+			return false;
 		}
+		ir_push_return(&ctx->ir_context, 0);
+		return true;
 	}
 
-	while (1)
+	if (type_is_void(&return_type))
 	{
-		if (index >= token_count) return false;
-		Token *token = tokens[index];
-		if (token->type == TOKEN_OPEN_PAREN)
-		{
-			int new_idx = 0;
-			struct TypeDescriptor td = {0};
-			bool r = parse_cast(ctx, tokens, index, token_count, &new_idx, &td);
-			if (r)
-			{
-				push_value(&(struct TypedValue)
-				{
-					.type = td,
-					.token = token
-				});
-				push_operator(LANG_OP_CAST);
-
-				index = new_idx;
-				can_deref = true;
-				continue;
-			}
-		}
-		if (token->type == TOKEN_OPEN_PAREN)
-		{
-			int new_index = 0;
-			int old_value_stack_min = value_stack_min;
-			int old_op_stack_min = operator_stack_min;
-			value_stack_min = value_stack_size;
-			operator_stack_min = operator_stack_size;
-			bool r = compile_expression(ctx, tokens, index + 1, token_count, &new_index, false);
-			if (!r) return r;
-			index = new_index;
-			value_stack_min = old_value_stack_min;
-			operator_stack_min = old_op_stack_min;
-			can_deref = false;
-			continue;
-		}
-		if (token->type == TOKEN_CLOSE_PAREN || token->type == TOKEN_SEMICOLON)
-		{
-			while (evaluate(ctx, token));
-			*next_index = index + 1;
-			return true;
-		}
-		if (token->type == TOKEN_INT)
+		set_compiler_error(ctx, "A void function cannot return a value", node_token(ctx, node));
+		return false;
+	}
+
+	struct TypedValue value;
+	if (!lower_expression(ctx, node->left, &value)) return false;
+	if (!implicit_cast(ctx, &value, &return_type, node_token(ctx, node))) return false;
+	define_ir_number(ctx, &value);
+	ir_push_return(&ctx->ir_context, value.ir_var_number);
+	return true;
+}
+
+static bool lower_statement(struct CompilerContext *ctx, NodeIndex index)
+{
+	if (index == NODE_INDEX_NONE) return true;
+	AstNode *node = get_node(ctx, index);
+
+	switch (node->type)
+	{
+	case NODE_EXP_SEQ:
+	{
+		//Statements are chained to the left, so the chain is collected from the last statement back
+		//instead of recursing once per statement
+		NodeIndexVector statements = node_index_vector_create(0);
+		while (node->type == NODE_EXP_SEQ)
 		{
-			push_value(&(struct TypedValue)
-			{
-				.type = (struct TypeDescriptor)
-				{
-					.base_type = int_literal_base_type(token)
-				},
-				.location = VAL_LOC_TOKEN,
-				.token = token
-			});
-			index++;
-			can_deref = false;
-			continue;
-		}
-		if (token->type == TOKEN_PLUS)
-		{
-			enum LangOperator next_operator = LANG_OP_ADD;
-			while (should_evaluate(next_operator))
-			{
-				bool r = evaluate(ctx, token);
-				if (!r) return r;
-			}
-			push_operator(next_operator);
-			index++;
-			can_deref = true;
-			continue;
+			node_index_vector_push(&statements, node->right);
+			index = node->left;
+			node = get_node(ctx, index);
 		}
-		if (token->type == TOKEN_EQUAL)
+		bool r = lower_statement(ctx, index);
+		for (int i = statements.size - 1; i >= 0 && r; i--)
+			r = lower_statement(ctx, statements.data[i]);
+		node_index_vector_free(&statements);
+		return r;
+	}
+	case NODE_IF:
+		return lower_if(ctx, node);
+	case NODE_WHILE:
+		return lower_while(ctx, node);
+	case NODE_RETURN:
+		return lower_return(ctx, node);
+	case NODE_BREAK:
+	case NODE_CONTINUE:
+	{
+		if (ctx->loops.size == 0)
 		{
-			enum LangOperator next_operator = LANG_OP_ASSIGN;
-			while (should_evaluate(next_operator))
-			{
-				bool r = evaluate(ctx, token);
-				if (!r) return r;
-			}
-			push_operator(next_operator);
-			index++;
-			can_deref = true;
-			continue;
+			set_compiler_error(ctx, "Not inside a loop", node_token(ctx, node));
+			return false;
 		}
-		if (token->type == TOKEN_STAR && !can_deref)
+		struct LoopLabels *loop = loop_vector_last(&ctx->loops);
+		ir_push_jump(&ctx->ir_context, node->type == NODE_BREAK ? loop->break_label : loop->continue_label);
+		return true;
+	}
+	default:
+	{
+		struct TypedValue value;
+		return lower_expression(ctx, index, &value);
+	}
+	}
+}
+
+//True if control can reach the end of the function body. Code after a return, or a label after an if
+//whose branches both return, can come last without being reachable, so the graph decides unless the
+//last instruction already leaves the function. Conditions are not evaluated, so a loop whose condition is
+//always true still counts as one that can exit.
+static bool function_falls_through(struct IrFunction *function)
+{
+	IrInstIndex last = function->insts.last;
+	uint8_t opcode = function->insts.opcodes[last];
+	if (opcode == IRINST_RETURN || opcode == IRINST_JUMP)
+		return false;
+
+	struct IrCfg cfg = ir_cfg_create(function);
+	bool reachable = cfg.blocks.data[cfg.inst_blocks.data[last]].order_index >= 0;
+	ir_cfg_free(&cfg);
+	return reachable;
+}
+
+static bool compile_function(struct CompilerContext *ctx, AstFunction *function)
+{
+	ctx->function = function;
+	ctx->tree = &function->tree;
+	FuncDescriptor *signature = &function->signature;
+	FuncParamDescriptor *params = func_param_vector_data(&signature->parameters);
+
+	IrBaseTypeVector param_types = ir_base_type_vector_create(signature->parameters.size);
+	for (int i = 0; i < signature->parameters.size; i++)
+	{
+		struct TypeDescriptor type = lang_type_descriptor(params[i].type);
+		if (type_is_void(&type))
 		{
-			enum LangOperator next_operator = LANG_OP_MUL;
-			while (should_evaluate(next_operator))
-			{
-				bool r = evaluate(ctx, token);
-				if (!r) return r;
-			}
-			push_operator(LANG_OP_MUL);
-			index++;
-			can_deref = true;
-			continue;
+			set_compiler_error(ctx, "Cannot declare a void variable", get_token(ctx, params[i].name_token));
+			ir_base_type_vector_free(&param_types);
+			return false;
 		}
-		if (token->type == TOKEN_IDENTIFIER)
+		ir_base_type_vector_push(&param_types, convert_type_descriptor(&type));
+	}
+
+	Token *name = get_token(ctx, signature->name_token);
+	struct IrFunction *ir_function = ir_push_function(&ctx->ir_context, token_text(ctx->unit->list, name), name->length,
+		param_types.data, param_types.size);
+	ir_base_type_vector_free(&param_types);
+
+	compiler_enter_scope(ctx);
+	for (int i = 0; i < signature->parameters.size; i++)
+	{
+		declare_variable(ctx, (struct Variable)
 		{
-			struct Variable *var = find_variable(ctx, token->name);
-			if (!var)
-			{
-				set_compiler_error("Undeclared identifier", token);
-				print_compiler_error();
-				return false;
-			}
-			struct TypedValue value = (struct TypedValue)
-			{
-				.type = var->type,
-				.location = VAL_LOC_VARIABLE,
-				.token = var->name_token,
-				.ir_var_number = var->ir_var_number
-			};
-			push_value(&value);
-			index++;
-			can_deref = false;
-			continue;
-		}
-
-		set_compiler_error("Unexepcted token", token);
-		print_compiler_error();
+			.name = get_token(ctx, params[i].name_token)->symbol,
+			.type = lang_type_descriptor(params[i].type),
+			.ir_var_number = ir_function->params[i]
+		});
+	}
+
+	AstNode *root = get_node(ctx, ctx->tree->root);
+	bool r = lower_statement(ctx, root->left);
+	compiler_exit_scope(ctx);
+	if (!r) return false;
+
+	if (!function_falls_through(ir_function))
+		return true;
+
+	//A void function can end without a return statement
+	struct TypeDescriptor return_type = lang_type_descriptor(signature->return_type);
+	if (!type_is_void(&return_type))
+	{
+		set_compiler_error(ctx, "Missing return value", get_token(ctx, function->end_token - 1));
 		return false;
 	}
+	ir_push_return(&ctx->ir_context, 0);
+	return true;
 }
 
-bool compile_tokens(struct CompilerContext *ctx, Token **tokens, int index, int token_count)
+bool compile_unit(struct CompilerContext *ctx, AstUnit *unit)
 {
-	int next_index = 0;
-	bool r = true;
-	while (r)
+	ctx->unit = unit;
+
+	//Every signature is known before any body is lowered, so a function can call the ones after it
+	for (int i = 0; i < unit->functions.size; i++)
+	{
+		AstFunction *function = &unit->functions.data[i];
+		if (!function->success)
+		{
+			set_compiler_error(ctx, "Failed to parse function", get_token(ctx, function->first_token));
+			return false;
+		}
+
+		Token *name = get_token(ctx, function->signature.name_token);
+		if (function_map_get(&ctx->function_lookup, name->symbol))
+		{
+			set_compiler_error(ctx, "Function is already defined", name);
+			return false;
+		}
+		function_map_put(&ctx->function_lookup, name->symbol, i);
+	}
+
+	for (int i = 0; i < unit->functions.size; i++)
 	{
-		r = compile_expression(ctx, tokens, next_index, token_count, &next_index, true);
-		if (!r) return false;
-		if (next_index >= token_count) break;
+		MemPhase phase = mem_set_phase(MEM_PHASE_PARSE);
+		AstTree *tree = ast_function_tree(unit, i);
+		mem_set_phase(phase);
+		if (!tree)
+		{
+			set_compiler_error(ctx, "Failed to parse function", get_token(ctx, unit->functions.data[i].first_token));
+			return false;
+		}
+
+		if (!compile_function(ctx, &unit->functions.data[i]))
+		{
+			return false;
+		}
 	}
 
-	ir_print_context(&ctx->ir_context);
+	return true;
 }
 
-struct CompilerContext compiler_create_context()
+struct CompilerContext compiler_create_context(Arena *arena)
 {
 	return (struct CompilerContext)
 	{
-		.ir_context = ir_create_context(),
-		.variables = vec_new(struct Variable, 10)
+		.ir_context = ir_create_context(arena),
+		.variables = variable_vector_create(10),
+		.variable_lookup = variable_map_create(),
+		.scopes = scope_vector_create(0),
+		.function_lookup = function_map_create(),
+		.loops = loop_vector_create(0),
+		.operator_stack = pending_node_vector_create(16),
+		.value_stack = typed_value_vector_create(16),
+		.condition_stack = pending_condition_vector_create(0)
 	};
 }
+
+void compiler_free_context(struct CompilerContext *ctx)
+{
+	ir_free_context(&ctx->ir_context);
+	variable_vector_free(&ctx->variables);
+	variable_map_free(&ctx->variable_lookup);
+	scope_vector_free(&ctx->scopes);
+	function_map_free(&ctx->function_lookup);
+	loop_vector_free(&ctx->loops);
+	pending_node_vector_free(&ctx->operator_stack);
+	typed_value_vector_free(&ctx->value_stack);
+	pending_condition_vector_free(&ctx->condition_stack);
+}
@@ -1,15 +1,110 @@
 #ifndef COMPILER_H
 #define COMPILER_H
 #include "language.h"
+#include "ast.h"
 #include "ir.h"
+#include <stdio.h>
+
+#define ERRMSG_SIZE 100
+
+enum ValueLocation
+{
+	//An integer literal. It gets an IR variable from define_ir_number once its type is settled.
+	VAL_LOC_TOKEN,
+	//The result of an operation
+	VAL_LOC_TEMP,
+	VAL_LOC_VARIABLE,
+};
+
+struct TypedValue
+{
+	struct TypeDescriptor type;
+	enum ValueLocation location;
+	//Literal of a VAL_LOC_TOKEN value
+	Token *token;
+	int ir_var_number;
+};
+
+struct Variable
+{
+	SymbolId name;
+	struct TypeDescriptor type;
+	int ir_var_number;
+	//Index of the binding of the same name that this one hides, or -1
+	int shadowed;
+};
+
+VECTOR_DEFINE(VariableVector, variable_vector, struct Variable)
+//Maps a variable name to the index of its innermost binding in CompilerContext.variables
+HASH_MAP_DEFINE(VariableMap, variable_map, SymbolId, int, hash_int, equal_int)
+VECTOR_DEFINE(ScopeVector, scope_vector, int)
+//Maps a function name to its index in AstUnit.functions
+HASH_MAP_DEFINE(FunctionMap, function_map, SymbolId, int, hash_int, equal_int)
+
+//Labels that continue and break jump to in a loop
+struct LoopLabels
+{
+	int continue_label;
+	int break_label;
+};
+
+VECTOR_DEFINE(LoopVector, loop_vector, struct LoopLabels)
+
+//An expression node on the operator stack. A node is visited once to push its operands and once more,
+//with operands_pushed set, to combine the values they left on the value stack.
+struct PendingNode
+{
+	NodeIndex node;
+	bool operands_pushed;
+};
+
+VECTOR_DEFINE(PendingNodeVector, pending_node_vector, struct PendingNode)
+VECTOR_DEFINE(TypedValueVector, typed_value_vector, struct TypedValue)
+
+//A condition waiting to be lowered. NODE_INDEX_NONE places true_label instead.
+struct PendingCondition
+{
+	NodeIndex node;
+	int true_label;
+	int false_label;
+};
+
+VECTOR_DEFINE(PendingConditionVector, pending_condition_vector, struct PendingCondition)
 
 struct CompilerContext
 {
 	struct IrContext ir_context;
-	Vector variables;
+	//Stack of bindings. Leaving a scope pops the bindings declared in it and restores the ones they hid.
+	VariableVector variables;
+	VariableMap variable_lookup;
+	//Size of variables when each open scope was entered
+	ScopeVector scopes;
+	FunctionMap function_lookup;
+	//Loops enclosing the statement being lowered, innermost last
+	LoopVector loops;
+	//Unit being compiled, used to resolve calls and report error locations
+	AstUnit *unit;
+	//Function being lowered and its tree
+	AstFunction *function;
+	AstTree *tree;
+	//Expressions and conditions are lowered from these stacks rather than by recursion, so long operator
+	//chains do not exhaust the C stack. They grow as needed and are shared by nested lowering calls,
+	//each of which only uses the entries above the ones it found.
+	PendingNodeVector operator_stack;
+	TypedValueVector value_stack;
+	PendingConditionVector condition_stack;
+	//Message of the error that stopped compile_unit
+	char errmsg[ERRMSG_SIZE];
 };
 
-extern struct CompilerContext compiler_create_context();
-extern bool compile_tokens(struct CompilerContext *ctx, Token **tokens, int index, int token_count);
+extern struct CompilerContext compiler_create_context(Arena *arena);
+extern void compiler_free_context(struct CompilerContext *ctx);
+//Lowers every function of the unit to ctx->ir_context. Bodies that have not been parsed yet are parsed on
+//the way. Stops at the first error and leaves its message in ctx->errmsg.
+//All state lives in the context, so separate contexts can compile on different threads at the same time.
+extern bool compile_unit(struct CompilerContext *ctx, AstUnit *unit);
+extern void print_compiler_error(struct CompilerContext *ctx, FILE *file);
+extern void compiler_enter_scope(struct CompilerContext *ctx);
+extern void compiler_exit_scope(struct CompilerContext *ctx);
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,44 @@
+//fileno, mmap and munmap are POSIX and are only declared by the C headers when it is asked for
+#define _POSIX_C_SOURCE 200809L
+
+#include "file_map.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#include <io.h>
+
+const char *file_map(FILE *file, size_t length)
+{
+	HANDLE handle = (HANDLE)_get_osfhandle(_fileno(file));
+	if (handle == INVALID_HANDLE_VALUE) return NULL;
+
+	HANDLE mapping = CreateFileMappingA(handle, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (!mapping) return NULL;
+
+	//The view keeps the mapping object alive after its handle is closed
+	const char *view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, length);
+	CloseHandle(mapping);
+	return view;
+}
+
+void file_unmap(const char *data, size_t length)
+{
+	UnmapViewOfFile(data);
+}
+
+#else
+#include <sys/mman.h>
+
+const char *file_map(FILE *file, size_t length)
+{
+	void *view = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fileno(file), 0);
+	if (view == MAP_FAILED) return NULL;
+	return view;
+}
+
+void file_unmap(const char *data, size_t length)
+{
+	munmap((void *)data, length);
+}
+
+#endif
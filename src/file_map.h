@@ -0,0 +1,11 @@
+#ifndef FILE_MAP_H
+#define FILE_MAP_H
+#include <stdio.h>
+#include <stddef.h>
+
+//Maps length bytes of an open file read-only. Returns NULL if the file cannot be mapped.
+//The mapping is not NUL terminated and outlives the FILE it was created from.
+extern const char *file_map(FILE *file, size_t length);
+extern void file_unmap(const char *data, size_t length);
+
+#endif
@@ -2,87 +2,181 @@
 #include <string.h>
 #include <assert.h>
 #include <stdio.h>
+#include <inttypes.h>
 #include "ir.h"
+#include "memstat.h"
 
-struct IrContext ir_create_context()
+struct IrContext ir_create_context(Arena *arena)
 {
 	return (struct IrContext)
 	{
-		.inst_vector = vec_new(struct IrInst *, 10),
-		.variables = vec_new(struct IrVar, 10),
-		.next_var_number = 1
+		.arena = arena,
+		.variables = ir_var_vector_create(16),
+		.functions = ir_function_vector_create(4),
+		.next_var_number = 1,
+		.next_label_number = 1
 	};
 }
 
-void ir_free_context(struct IrContext *ctx)
+uint64_t ir_type_mask(enum IrBaseType type)
 {
-	for (int i = 0; i < ctx->inst_vector.size; i++)
+	switch (type)
 	{
-		free(vec_at(struct IrInst *, &ctx->inst_vector, i));
+	case IRTYPE_I8:
+		return 0xff;
+	case IRTYPE_I16:
+		return 0xffff;
+	case IRTYPE_PTR:
+		return PTR_WIDTH_BYTES == 2 ? 0xffff : 0xff;
+	default:
+		return 0;
 	}
-	vec_free(&ctx->inst_vector);
-	vec_free(&ctx->variables);
 }
 
-struct IrVar *find_var(struct IrContext *ctx, int var_number)
+static struct IrInstBuffer inst_buffer_create(void)
+{
+	return (struct IrInstBuffer){ .first = IR_INST_INDEX_NONE, .last = IR_INST_INDEX_NONE };
+}
+
+//The arrays always share one capacity
+static void inst_buffer_reserve(struct IrInstBuffer *insts, uint32_t capacity)
+{
+	if (capacity <= insts->capacity) return;
+	insts->opcodes = mem_realloc(insts->opcodes, sizeof(uint8_t) * capacity);
+	insts->types = mem_realloc(insts->types, sizeof(uint8_t) * capacity);
+	insts->flags = mem_realloc(insts->flags, sizeof(uint8_t) * capacity);
+	insts->dst_vars = mem_realloc(insts->dst_vars, sizeof(int32_t) * capacity);
+	insts->operands = mem_realloc(insts->operands, sizeof(union IrOperands) * capacity);
+	insts->next = mem_realloc(insts->next, sizeof(IrInstIndex) * capacity);
+	insts->prev = mem_realloc(insts->prev, sizeof(IrInstIndex) * capacity);
+	insts->first_uses = mem_realloc(insts->first_uses, sizeof(IrUseIndex) * capacity);
+	insts->capacity = capacity;
+}
+
+static void inst_buffer_free(struct IrInstBuffer *insts)
+{
+	mem_free(insts->opcodes);
+	mem_free(insts->types);
+	mem_free(insts->flags);
+	mem_free(insts->dst_vars);
+	mem_free(insts->operands);
+	mem_free(insts->next);
+	mem_free(insts->prev);
+	mem_free(insts->first_uses);
+	*insts = inst_buffer_create();
+}
+
+void ir_free_context(struct IrContext *ctx)
 {
-	for (int i = 0; i < ctx->variables.size; i++)
+	for (int i = 0; i < ctx->functions.size; i++)
 	{
-		struct IrVar *var = &vec_at(struct IrVar, &ctx->variables, i);
-		if (var->var_number == var_number)
-			return var;
+		inst_buffer_free(&ctx->functions.data[i].insts);
+		ir_call_site_vector_free(&ctx->functions.data[i].calls);
+		ir_use_vector_free(&ctx->functions.data[i].uses);
 	}
-	return NULL;
+	ir_function_vector_free(&ctx->functions);
+	ir_var_vector_free(&ctx->variables);
+}
+
+struct IrVar *find_var(struct IrContext *ctx, int var_number)
+{
+	if (var_number <= 0 || var_number >= ctx->variables.size)
+		return NULL;
+	struct IrVar *var = &ctx->variables.data[var_number];
+	return var->definition != IR_INST_INDEX_NONE ? var : NULL;
+}
+
+static struct IrFunction *current_function(struct IrContext *ctx)
+{
+	assert(ctx->functions.size > 0);
+	return &ctx->functions.data[ctx->functions.size - 1];
 }
 
-void ir_push_inst(struct IrContext *ctx, struct IrInst *inst)
+//Adds a use of each variable the instruction reads to the front of the variable's list
+static void link_uses(struct IrContext *ctx, struct IrFunction *function, IrInstIndex index)
 {
-	struct IrVar *var = find_var(ctx, inst->dst_var);
-	if (var == NULL)
+	int *vars;
+	int var_count = ir_inst_uses(function, index, &vars);
+	function->insts.first_uses[index] = function->uses.size;
+	for (int i = 0; i < var_count; i++)
 	{
-		struct IrVar new_var = (struct IrVar)
+		struct IrVar *var = &ctx->variables.data[vars[i]];
+		IrUseIndex use = function->uses.size;
+		ir_use_vector_push(&function->uses, (struct IrUse)
 		{
-			.var_number = inst->dst_var,
-			.type = inst->dst_type
-		};
-		vec_push(struct IrVar, &ctx->variables, &new_var);
+			.inst = index,
+			.operand = i,
+			.next = var->first_use,
+			.prev = IR_USE_INDEX_NONE
+		});
+		if (var->first_use != IR_USE_INDEX_NONE)
+			function->uses.data[var->first_use].prev = use;
+		var->first_use = use;
+		var->use_count++;
 	}
+}
 
-	vec_push(struct IrInst *, &ctx->inst_vector, &inst);
-	if (ctx->last_instruction == NULL || ctx->first_instruction == NULL) 
+//Records the instruction as the definition of var_number unless the variable is already defined
+static void define_var(struct IrContext *ctx, int var_number, struct IrTypeDescriptor type, IrInstIndex index)
+{
+	if (var_number >= ctx->variables.capacity)
+		ir_var_vector_grow(&ctx->variables, var_number + 1);
+	while (ctx->variables.size <= var_number)
+		ir_var_vector_push(&ctx->variables, (struct IrVar){ .definition = IR_INST_INDEX_NONE, .first_use = IR_USE_INDEX_NONE });
+
+	struct IrVar *var = &ctx->variables.data[var_number];
+	if (var->definition == IR_INST_INDEX_NONE)
 	{
-		ctx->last_instruction = inst;
-		ctx->first_instruction = inst;
-		return;
+		var->type = type;
+		var->definition = index;
 	}
-	inst->prev = ctx->last_instruction;
-	ctx->last_instruction->next = inst;
-	ctx->last_instruction = inst;
 }
 
-struct IrInst *ir_push_define(struct IrContext *ctx, enum IrBaseType base_type, uint64_t value)
+//Appends an instruction to the current function and returns its index
+static IrInstIndex push_inst(struct IrContext *ctx, enum IrInstType opcode, int dst_var, enum IrBaseType dst_type, uint8_t flags, union IrOperands operands)
+{
+	struct IrFunction *function = current_function(ctx);
+	struct IrInstBuffer *insts = &function->insts;
+	if (insts->size == insts->capacity)
+		inst_buffer_reserve(insts, insts->capacity < 16 ? 16 : insts->capacity * 2);
+
+	IrInstIndex index = insts->size++;
+	insts->opcodes[index] = opcode;
+	insts->types[index] = dst_type;
+	insts->flags[index] = flags;
+	insts->dst_vars[index] = dst_var;
+	insts->operands[index] = operands;
+	insts->next[index] = IR_INST_INDEX_NONE;
+	insts->prev[index] = insts->last;
+	if (insts->last == IR_INST_INDEX_NONE)
+		insts->first = index;
+	else
+		insts->next[insts->last] = index;
+	insts->last = index;
+	link_uses(ctx, function, index);
+
+	//Control flow instructions and calls without a result have no destination
+	if (dst_var != 0)
+		define_var(ctx, dst_var, (struct IrTypeDescriptor){ .base_type = dst_type }, index);
+
+	return index;
+}
+
+int ir_push_define(struct IrContext *ctx, enum IrBaseType base_type, uint64_t value)
 {
-	struct IrInst *inst = malloc(sizeof(struct IrInst));
-	*inst = (struct IrInst)
+	int dst_var = ctx->next_var_number++;
+	push_inst(ctx, IRINST_DEFINE, dst_var, base_type, 0, (union IrOperands)
 	{
-		.type = IRINST_DEFINE,
-		.dst_var = ctx->next_var_number++,
-		.dst_type = (struct IrTypeDescriptor)
-		{
-			.base_type = base_type
-		},
 		.define = (struct IrInstDefine)
 		{
-			.value = value
+			.value = value & ir_type_mask(base_type)
 		}
-	};
-
-	ir_push_inst(ctx, inst);
+	});
 
-	return inst;
+	return dst_var;
 }
 
-struct IrInst *ir_push_add(struct IrContext *ctx, int lvar, int rvar, int dst_var)
+int ir_push_add(struct IrContext *ctx, int lvar, int rvar, int dst_var)
 {
 	//TODO: Check that lvar and rvar and dst_var exist and are of the same type
 	struct IrVar *lvar_definition = find_var(ctx, lvar);
@@ -101,25 +195,19 @@ struct IrInst *ir_push_add(struct IrContext *ctx, int lvar, int rvar, int dst_va
 		dst_var = ctx->next_var_number++;
 	}
 
-	struct IrInst *inst = malloc(sizeof(struct IrInst));
-	*inst = (struct IrInst)
+	push_inst(ctx, IRINST_ADD, dst_var, lvar_definition->type.base_type, 0, (union IrOperands)
 	{
-		.type = IRINST_ADD,
-		.dst_var = dst_var,
-		.dst_type = lvar_definition->type,
 		.add = (struct IrInstAdd)
 		{
 			.lvar = lvar,
 			.rvar = rvar
 		}
-	};
-
-	ir_push_inst(ctx, inst);
+	});
 
-	return inst;
+	return dst_var;
 }
 
-struct IrInst *ir_push_mul(struct IrContext *ctx, int lvar, int rvar, int dst_var)
+int ir_push_mul(struct IrContext *ctx, int lvar, int rvar, int dst_var)
 {
 	//TODO: Check that lvar and rvar and dst_var exist and are of the same type
 	struct IrVar *lvar_definition = find_var(ctx, lvar);
@@ -138,75 +226,56 @@ struct IrInst *ir_push_mul(struct IrContext *ctx, int lvar, int rvar, int dst_va
 		dst_var = ctx->next_var_number++;
 	}
 
-	struct IrInst *inst = malloc(sizeof(struct IrInst));
-	*inst = (struct IrInst)
+	push_inst(ctx, IRINST_MUL, dst_var, lvar_definition->type.base_type, 0, (union IrOperands)
 	{
-		.type = IRINST_MUL,
-		.dst_var = dst_var,
-		.dst_type = lvar_definition->type,
-		.add = (struct IrInstAdd)
+		.mul = (struct IrInstMul)
 		{
 			.lvar = lvar,
 			.rvar = rvar
 		}
-	};
-
-	ir_push_inst(ctx, inst);
+	});
 
-	return inst;
+	return dst_var;
 }
 
-struct IrInst *ir_push_trunc(struct IrContext *ctx, int src_var, enum IrBaseType dst_type)
+int ir_push_trunc(struct IrContext *ctx, int src_var, enum IrBaseType dst_type)
 {
 	//TODO: Check that src exists
 	struct IrVar *src_var_definition = find_var(ctx, src_var);
 	assert(src_var_definition != NULL);
 	int dst_var = ctx->next_var_number++;
 
-	struct IrInst *inst = malloc(sizeof(struct IrInst));
-	*inst = (struct IrInst)
+	push_inst(ctx, IRINST_TRUNC, dst_var, dst_type, 0, (union IrOperands)
 	{
-		.type = IRINST_TRUNC,
-		.dst_var = dst_var,
-		.dst_type = dst_type,
 		.trunc = (struct IrInstTrunc)
 		{
 			.src_var = src_var
 		}
-	};
-
-	ir_push_inst(ctx, inst);
+	});
 
-	return inst;
+	return dst_var;
 
 }
 
-struct IrInst *ir_push_extend(struct IrContext *ctx, int src_var, enum IrBaseType dst_type, bool sign_extend)
+int ir_push_extend(struct IrContext *ctx, int src_var, enum IrBaseType dst_type, bool sign_extend)
 {
 	//TODO: Check that src exists
 	struct IrVar *src_var_definition = find_var(ctx, src_var);
 	assert(src_var_definition != NULL);
 	int dst_var = ctx->next_var_number++;
 
-	struct IrInst *inst = malloc(sizeof(struct IrInst));
-	*inst = (struct IrInst)
+	push_inst(ctx, IRINST_EXTEND, dst_var, dst_type, sign_extend ? IR_FLAG_SIGNED : 0, (union IrOperands)
 	{
-		.type = IRINST_EXTEND,
-		.dst_var = dst_var,
-		.dst_type = dst_type,
 		.extend = (struct IrInstExtend)
 		{
-			.src_var = src_var,
-			.sign_extend = sign_extend
+			.src_var = src_var
 		}
-	};
+	});
 
-	ir_push_inst(ctx, inst);
-
-	return inst;
+	return dst_var;
 }
 
-struct IrInst *ir_push_copy(struct IrContext *ctx, int src_var, int dst_var)
+int ir_push_copy(struct IrContext *ctx, int src_var, int dst_var)
 {
 	//TODO: error checking
 	struct IrVar *src_definition = find_var(ctx, src_var);
@@ -223,21 +292,418 @@ struct IrInst *ir_push_copy(struct IrContext *ctx, int src_var, int dst_var)
 		dst_var = ctx->next_var_number++;
 	}
 
-	struct IrInst *inst = malloc(sizeof(struct IrInst));
-	*inst = (struct IrInst)
+	push_inst(ctx, IRINST_COPY, dst_var, src_definition->type.base_type, 0, (union IrOperands)
 	{
-		.type = IRINST_COPY,
-		.dst_var = dst_var,
-		.dst_type = src_definition->type,
 		.copy = (struct IrInstCopy)
 		{
 			.src_var = src_var
 		}
+	});
+
+	return dst_var;
+}
+
+int ir_push_sub(struct IrContext *ctx, int lvar, int rvar, int dst_var)
+{
+	struct IrVar *lvar_definition = find_var(ctx, lvar);
+	struct IrVar *rvar_definition = find_var(ctx, rvar);
+	assert(lvar_definition != NULL);
+	assert(rvar_definition != NULL);
+	assert(lvar_definition->type.base_type == rvar_definition->type.base_type);
+	if (dst_var != 0)
+	{
+		struct IrVar *dst_var_definition = find_var(ctx, dst_var);
+		assert(dst_var_definition != NULL);
+		assert(dst_var_definition->type.base_type == lvar_definition->type.base_type);
+	}
+	else
+	{
+		dst_var = ctx->next_var_number++;
+	}
+
+	push_inst(ctx, IRINST_SUB, dst_var, lvar_definition->type.base_type, 0, (union IrOperands)
+	{
+		.sub = (struct IrInstSub)
+		{
+			.lvar = lvar,
+			.rvar = rvar
+		}
+	});
+
+	return dst_var;
+}
+
+struct IrFunction *ir_push_function(struct IrContext *ctx, const char *name, int name_length, enum IrBaseType *param_types, int param_count)
+{
+	int *params = arena_alloc(ctx->arena, sizeof(int) * (param_count > 0 ? param_count : 1));
+	ir_function_vector_push(&ctx->functions, (struct IrFunction)
+	{
+		.name = name,
+		.name_length = name_length,
+		.params = params,
+		.param_count = param_count,
+		.first_var = ctx->next_var_number,
+		.insts = inst_buffer_create(),
+		.calls = ir_call_site_vector_create(0),
+		.uses = ir_use_vector_create(16)
+	});
+
+	IrInstIndex index = push_inst(ctx, IRINST_FUNCTION, 0, IRTYPE_I0, 0, (union IrOperands){0});
+	for (int i = 0; i < param_count; i++)
+	{
+		params[i] = ctx->next_var_number++;
+		define_var(ctx, params[i], (struct IrTypeDescriptor){ .base_type = param_types[i] }, index);
+	}
+
+	return current_function(ctx);
+}
+
+int ir_push_call(struct IrContext *ctx, const char *name, int name_length, enum IrBaseType return_type, int *args, int arg_count)
+{
+	int *call_args = arena_alloc(ctx->arena, sizeof(int) * (arg_count > 0 ? arg_count : 1));
+	for (int i = 0; i < arg_count; i++)
+	{
+		assert(find_var(ctx, args[i]) != NULL);
+		call_args[i] = args[i];
+	}
+
+	struct IrFunction *function = current_function(ctx);
+	ir_call_site_vector_push(&function->calls, (struct IrCallSite)
+	{
+		.name = name,
+		.name_length = name_length,
+		.args = call_args,
+		.arg_count = arg_count
+	});
+
+	int dst_var = return_type == IRTYPE_I0 ? 0 : ctx->next_var_number++;
+	push_inst(ctx, IRINST_CALL, dst_var, return_type, 0, (union IrOperands)
+	{
+		.call = (struct IrInstCall)
+		{
+			.call = function->calls.size - 1
+		}
+	});
+
+	return dst_var;
+}
+
+IrInstIndex ir_push_return(struct IrContext *ctx, int src_var)
+{
+	assert(src_var == 0 || find_var(ctx, src_var) != NULL);
+	return push_inst(ctx, IRINST_RETURN, 0, IRTYPE_I0, 0, (union IrOperands)
+	{
+		.ret = (struct IrInstReturn)
+		{
+			.src_var = src_var
+		}
+	});
+}
+
+int ir_new_label(struct IrContext *ctx)
+{
+	return ctx->next_label_number++;
+}
+
+IrInstIndex ir_push_label(struct IrContext *ctx, int label)
+{
+	return push_inst(ctx, IRINST_LABEL, 0, IRTYPE_I0, 0, (union IrOperands)
+	{
+		.label = (struct IrInstLabel)
+		{
+			.label = label
+		}
+	});
+}
+
+IrInstIndex ir_push_jump(struct IrContext *ctx, int label)
+{
+	return push_inst(ctx, IRINST_JUMP, 0, IRTYPE_I0, 0, (union IrOperands)
+	{
+		.jump = (struct IrInstJump)
+		{
+			.label = label
+		}
+	});
+}
+
+IrInstIndex ir_push_branch(struct IrContext *ctx, enum IrCompare compare, bool is_signed, int lvar, int rvar, int true_label, int false_label)
+{
+	struct IrVar *lvar_definition = find_var(ctx, lvar);
+	struct IrVar *rvar_definition = find_var(ctx, rvar);
+	assert(lvar_definition != NULL);
+	assert(rvar_definition != NULL);
+	assert(lvar_definition->type.base_type == rvar_definition->type.base_type);
+
+	return push_inst(ctx, IRINST_BRANCH, 0, IRTYPE_I0, compare | (is_signed ? IR_FLAG_SIGNED : 0), (union IrOperands)
+	{
+		.branch = (struct IrInstBranch)
+		{
+			.lvar = lvar,
+			.rvar = rvar,
+			.true_label = true_label,
+			.false_label = false_label
+		}
+	});
+}
+
+int ir_push_load(struct IrContext *ctx, int ptr_var, enum IrBaseType dst_type)
+{
+	struct IrVar *ptr_definition = find_var(ctx, ptr_var);
+	assert(ptr_definition != NULL);
+	assert(ptr_definition->type.base_type == PTR_IR_TYPE);
+	int dst_var = ctx->next_var_number++;
+
+	push_inst(ctx, IRINST_LOAD, dst_var, dst_type, 0, (union IrOperands)
+	{
+		.load = (struct IrInstLoad)
+		{
+			.ptr_var = ptr_var
+		}
+	});
+
+	return dst_var;
+}
+
+IrInstIndex ir_push_store(struct IrContext *ctx, int ptr_var, int src_var)
+{
+	struct IrVar *ptr_definition = find_var(ctx, ptr_var);
+	assert(ptr_definition != NULL);
+	assert(ptr_definition->type.base_type == PTR_IR_TYPE);
+	assert(find_var(ctx, src_var) != NULL);
+
+	return push_inst(ctx, IRINST_STORE, 0, IRTYPE_I0, 0, (union IrOperands)
+	{
+		.store = (struct IrInstStore)
+		{
+			.ptr_var = ptr_var,
+			.src_var = src_var
+		}
+	});
+}
+
+int ir_push_addrof(struct IrContext *ctx, int src_var)
+{
+	struct IrVar *src_definition = find_var(ctx, src_var);
+	assert(src_definition != NULL);
+	src_definition->address_taken = true;
+	int dst_var = ctx->next_var_number++;
+
+	push_inst(ctx, IRINST_ADDROF, dst_var, PTR_IR_TYPE, 0, (union IrOperands)
+	{
+		.addrof = (struct IrInstAddrof)
+		{
+			.src_var = src_var
+		}
+	});
+
+	return dst_var;
+}
+
+int ir_inst_uses(struct IrFunction *function, IrInstIndex index, int **uses)
+{
+	union IrOperands *operands = &function->insts.operands[index];
+	switch (function->insts.opcodes[index])
+	{
+	case IRINST_ADD:
+	case IRINST_MUL:
+	case IRINST_SUB:
+	case IRINST_BRANCH:
+	case IRINST_STORE:
+		*uses = operands->vars;
+		return 2;
+	case IRINST_COPY:
+	case IRINST_EXTEND:
+	case IRINST_TRUNC:
+	case IRINST_LOAD:
+	case IRINST_ADDROF:
+		*uses = operands->vars;
+		return 1;
+	case IRINST_RETURN:
+		*uses = operands->vars;
+		return operands->ret.src_var != 0 ? 1 : 0;
+	case IRINST_CALL:
+	{
+		struct IrCallSite *call = &function->calls.data[operands->call.call];
+		*uses = call->args;
+		return call->arg_count;
+	}
+	default:
+		*uses = NULL;
+		return 0;
+	}
+}
+
+int ir_function_var_end(struct IrContext *ctx, struct IrFunction *function)
+{
+	int function_index = (int)(function - ctx->functions.data);
+	if (function_index + 1 < ctx->functions.size)
+		return ctx->functions.data[function_index + 1].first_var;
+	return ctx->next_var_number;
+}
+
+int *ir_use_operand(struct IrFunction *function, IrUseIndex use)
+{
+	int *vars;
+	ir_inst_uses(function, function->uses.data[use].inst, &vars);
+	return &vars[function->uses.data[use].operand];
+}
+
+void ir_replace_uses(struct IrContext *ctx, struct IrFunction *function, int from_var, int to_var)
+{
+	struct IrVar *from = &ctx->variables.data[from_var];
+	struct IrVar *to = &ctx->variables.data[to_var];
+	assert(from->type.base_type == to->type.base_type);
+	assert(!from->address_taken);
+	if (from_var == to_var || from->first_use == IR_USE_INDEX_NONE) return;
+
+	IrUseIndex last = from->first_use;
+	for (IrUseIndex use = from->first_use; use != IR_USE_INDEX_NONE; use = function->uses.data[use].next)
+	{
+		*ir_use_operand(function, use) = to_var;
+		last = use;
+	}
+
+	//The list of from_var goes in front of the list of to_var
+	function->uses.data[last].next = to->first_use;
+	if (to->first_use != IR_USE_INDEX_NONE)
+		function->uses.data[to->first_use].prev = last;
+	to->first_use = from->first_use;
+	to->use_count += from->use_count;
+	from->first_use = IR_USE_INDEX_NONE;
+	from->use_count = 0;
+}
+
+//Unlinks the uses of an instruction's operands before they are replaced
+static void drop_uses(struct IrContext *ctx, struct IrFunction *function, IrInstIndex index)
+{
+	int *vars;
+	int var_count = ir_inst_uses(function, index, &vars);
+	for (int i = 0; i < var_count; i++)
+	{
+		struct IrVar *var = &ctx->variables.data[vars[i]];
+		struct IrUse *use = &function->uses.data[function->insts.first_uses[index] + i];
+		if (use->prev == IR_USE_INDEX_NONE)
+			var->first_use = use->next;
+		else
+			function->uses.data[use->prev].next = use->next;
+		if (use->next != IR_USE_INDEX_NONE)
+			function->uses.data[use->next].prev = use->prev;
+		var->use_count--;
+	}
+}
+
+void ir_rewrite_define(struct IrContext *ctx, struct IrFunction *function, IrInstIndex index, uint64_t value)
+{
+	struct IrInstBuffer *insts = &function->insts;
+	assert(insts->dst_vars[index] != 0);
+
+	drop_uses(ctx, function, index);
+	insts->opcodes[index] = IRINST_DEFINE;
+	insts->flags[index] = 0;
+	insts->operands[index] = (union IrOperands)
+	{
+		.define = (struct IrInstDefine)
+		{
+			.value = value & ir_type_mask(insts->types[index])
+		}
 	};
+}
 
-	ir_push_inst(ctx, inst);
+void ir_rewrite_jump(struct IrContext *ctx, struct IrFunction *function, IrInstIndex index, int label)
+{
+	struct IrInstBuffer *insts = &function->insts;
+	assert(insts->dst_vars[index] == 0);
 
-	return inst;
+	drop_uses(ctx, function, index);
+	insts->opcodes[index] = IRINST_JUMP;
+	insts->flags[index] = 0;
+	insts->operands[index] = (union IrOperands)
+	{
+		.jump = (struct IrInstJump)
+		{
+			.label = label
+		}
+	};
+}
+
+void ir_remove_inst(struct IrContext *ctx, struct IrFunction *function, IrInstIndex index)
+{
+	struct IrInstBuffer *insts = &function->insts;
+	//The parameters stay defined by the function header
+	assert(insts->opcodes[index] != IRINST_FUNCTION && insts->opcodes[index] != IRINST_REMOVED);
+
+	drop_uses(ctx, function, index);
+
+	int dst_var = insts->dst_vars[index];
+	if (dst_var != 0 && ctx->variables.data[dst_var].definition == index)
+		ctx->variables.data[dst_var].definition = IR_INST_INDEX_NONE;
+
+	IrInstIndex prev = insts->prev[index];
+	IrInstIndex next = insts->next[index];
+	if (prev == IR_INST_INDEX_NONE)
+		insts->first = next;
+	else
+		insts->next[prev] = next;
+	if (next == IR_INST_INDEX_NONE)
+		insts->last = prev;
+	else
+		insts->prev[next] = prev;
+
+	insts->opcodes[index] = IRINST_REMOVED;
+	insts->next[index] = IR_INST_INDEX_NONE;
+	insts->prev[index] = IR_INST_INDEX_NONE;
+	insts->removed++;
+}
+
+void ir_compact_function(struct IrContext *ctx, struct IrFunction *function)
+{
+	struct IrInstBuffer *old = &function->insts;
+	struct IrInstBuffer insts = inst_buffer_create();
+	inst_buffer_reserve(&insts, old->size - old->removed);
+
+	//The uses are linked again in the new order, which also drops the ones that were unlinked
+	int var_end = ir_function_var_end(ctx, function);
+	for (int var_number = function->first_var; var_number < var_end && var_number < ctx->variables.size; var_number++)
+	{
+		ctx->variables.data[var_number].first_use = IR_USE_INDEX_NONE;
+		ctx->variables.data[var_number].use_count = 0;
+	}
+	ir_use_vector_clear(&function->uses);
+
+	//New index of every old slot
+	IrInstIndex *moved_to = mem_alloc(sizeof(IrInstIndex) * (old->size > 0 ? old->size : 1));
+	for (IrInstIndex i = old->first; i != IR_INST_INDEX_NONE; i = old->next[i])
+	{
+		IrInstIndex index = insts.size++;
+		insts.opcodes[index] = old->opcodes[i];
+		insts.types[index] = old->types[i];
+		insts.flags[index] = old->flags[i];
+		insts.dst_vars[index] = old->dst_vars[i];
+		insts.operands[index] = old->operands[i];
+		insts.prev[index] = insts.last;
+		insts.next[index] = IR_INST_INDEX_NONE;
+		if (insts.last == IR_INST_INDEX_NONE)
+			insts.first = index;
+		else
+			insts.next[insts.last] = index;
+		insts.last = index;
+		moved_to[i] = index;
+	}
+
+	//Definitions move with their instructions. Only the variables of this function can refer to it.
+	for (int var_number = function->first_var; var_number < var_end && var_number < ctx->variables.size; var_number++)
+	{
+		struct IrVar *var = &ctx->variables.data[var_number];
+		if (var->definition != IR_INST_INDEX_NONE)
+			var->definition = moved_to[var->definition];
+	}
+
+	mem_free(moved_to);
+	inst_buffer_free(old);
+	*old = insts;
+	for (IrInstIndex i = insts.first; i != IR_INST_INDEX_NONE; i = insts.next[i])
+		link_uses(ctx, function, i);
 }
 
 const char *get_base_type_str(enum IrBaseType type)
@@ -256,42 +722,116 @@ const char *get_base_type_str(enum IrBaseType type)
 	return "";
 }
 
-void ir_print_context(struct IrContext *ctx)
+//Signed ordered comparisons are printed with an s prefix, eg. sjgt
+static const char *get_compare_str(enum IrCompare compare)
 {
-	puts("Printing IR context");
-	if (ctx->first_instruction == NULL) return;
+	switch (compare)
+	{
+	case IRCMP_EQ:
+		return "je";
+	case IRCMP_GT:
+		return "jgt";
+	case IRCMP_LT:
+		return "jlt";
+	case IRCMP_GE:
+		return "jge";
+	case IRCMP_LE:
+		return "jle";
+	}
+	return "";
+}
 
-	struct IrInst *inst = ctx->first_instruction;
+void ir_print_context(struct IrContext *ctx, FILE *file)
+{
+	fputs("Printing IR context\n", file);
 
-	while (inst != NULL)
+	for (int f = 0; f < ctx->functions.size; f++)
 	{
-		switch (inst->type)
+		struct IrFunction *function = &ctx->functions.data[f];
+		struct IrInstBuffer *insts = &function->insts;
+		for (IrInstIndex i = insts->first; i != IR_INST_INDEX_NONE; i = insts->next[i])
 		{
-		case IRINST_DEFINE:
-			printf("v%i %s = %lli\n", inst->dst_var, get_base_type_str(inst->dst_type.base_type), inst->define.value);
-			break;
-		case IRINST_ADD:
-			printf("v%i %s = add v%i v%i\n", inst->dst_var, get_base_type_str(inst->dst_type.base_type), inst->add.lvar, inst->add.rvar);
-			break;
-		case IRINST_MUL:
-			printf("v%i %s = mul v%i v%i\n", inst->dst_var, get_base_type_str(inst->dst_type.base_type), inst->mul.lvar, inst->mul.rvar);
-			break;
-		case IRINST_COPY:
-			printf("v%i %s = v%i\n", inst->dst_var, get_base_type_str(inst->dst_type.base_type), inst->copy.src_var);
-			break;
-		case IRINST_TRUNC:
-			printf("v%i %s = trunc v%i\n", inst->dst_var, get_base_type_str(inst->dst_type.base_type), inst->trunc.src_var);
-			break;
-		case IRINST_EXTEND:
-			if (inst->extend.sign_extend)
-				printf("v%i %s = sextend v%i\n", inst->dst_var, get_base_type_str(inst->dst_type.base_type), inst->copy.src_var);
-			else
-				printf("v%i %s = uextend v%i\n", inst->dst_var, get_base_type_str(inst->dst_type.base_type), inst->copy.src_var);
-			break;
-		default:
-			printf("Unknown IRINST %i\n", inst->type);
+			int dst_var = insts->dst_vars[i];
+			const char *type = get_base_type_str(insts->types[i]);
+			union IrOperands *operands = &insts->operands[i];
+			switch (insts->opcodes[i])
+			{
+			case IRINST_DEFINE:
+				fprintf(file, "v%i %s = %" PRIu64 "\n", dst_var, type, operands->define.value);
+				break;
+			case IRINST_ADD:
+				fprintf(file, "v%i %s = add v%i v%i\n", dst_var, type, operands->add.lvar, operands->add.rvar);
+				break;
+			case IRINST_MUL:
+				fprintf(file, "v%i %s = mul v%i v%i\n", dst_var, type, operands->mul.lvar, operands->mul.rvar);
+				break;
+			case IRINST_COPY:
+				fprintf(file, "v%i %s = v%i\n", dst_var, type, operands->copy.src_var);
+				break;
+			case IRINST_TRUNC:
+				fprintf(file, "v%i %s = trunc v%i\n", dst_var, type, operands->trunc.src_var);
+				break;
+			case IRINST_EXTEND:
+				if (insts->flags[i] & IR_FLAG_SIGNED)
+					fprintf(file, "v%i %s = sextend v%i\n", dst_var, type, operands->extend.src_var);
+				else
+					fprintf(file, "v%i %s = uextend v%i\n", dst_var, type, operands->extend.src_var);
+				break;
+			case IRINST_SUB:
+				fprintf(file, "v%i %s = sub v%i v%i\n", dst_var, type, operands->sub.lvar, operands->sub.rvar);
+				break;
+			case IRINST_FUNCTION:
+				fprintf(file, ":func %.*s(", function->name_length, function->name);
+				for (int p = 0; p < function->param_count; p++)
+				{
+					int param = function->params[p];
+					fprintf(file, "%sv%i %s", p ? ", " : "", param, get_base_type_str(ctx->variables.data[param].type.base_type));
+				}
+				fputs(")\n", file);
+				break;
+			case IRINST_CALL:
+			{
+				struct IrCallSite *call = &function->calls.data[operands->call.call];
+				if (dst_var != 0)
+					fprintf(file, "v%i %s = ", dst_var, type);
+				fprintf(file, "call %.*s", call->name_length, call->name);
+				for (int a = 0; a < call->arg_count; a++)
+					fprintf(file, " v%i", call->args[a]);
+				fputc('\n', file);
+				break;
+			}
+			case IRINST_RETURN:
+				if (operands->ret.src_var != 0)
+					fprintf(file, "ret v%i\n", operands->ret.src_var);
+				else
+					fputs("ret\n", file);
+				break;
+			case IRINST_LABEL:
+				fprintf(file, ":L%i\n", operands->label.label);
+				break;
+			case IRINST_JUMP:
+				fprintf(file, "jmp L%i\n", operands->jump.label);
+				break;
+			case IRINST_BRANCH:
+			{
+				enum IrCompare compare = insts->flags[i] & IR_FLAG_COMPARE_MASK;
+				bool is_signed = insts->flags[i] & IR_FLAG_SIGNED;
+				fprintf(file, "%s%s v%i v%i L%i L%i\n", is_signed && compare != IRCMP_EQ ? "s" : "", get_compare_str(compare),
+					operands->branch.lvar, operands->branch.rvar, operands->branch.true_label, operands->branch.false_label);
+				break;
+			}
+			case IRINST_LOAD:
+				fprintf(file, "v%i %s = load v%i\n", dst_var, type, operands->load.ptr_var);
+				break;
+			case IRINST_STORE:
+				fprintf(file, "store v%i v%i\n", operands->store.ptr_var, operands->store.src_var);
+				break;
+			case IRINST_ADDROF:
+				fprintf(file, "v%i %s = addrof v%i\n", dst_var, type, operands->addrof.src_var);
+				break;
+			default:
+				fprintf(file, "Unknown IRINST %i\n", insts->opcodes[i]);
+			}
 		}
-
-		inst = inst->next;
 	}
 }
@@ -6,8 +6,10 @@
 #ifndef IR_H
 #define IR_H
 #include "list.h"
+#include "arena.h"
 #include <stdint.h>
 #include <stdbool.h>
+#include <stdio.h>
 
 #define PTR_WIDTH_BYTES 2
 #define PTR_IR_TYPE IRTYPE_I16
@@ -20,6 +22,9 @@ enum IrBaseType
 	IRTYPE_PTR,
 };
 
+//Bits of a 64-bit value that a variable of the type holds, 0 for IRTYPE_I0
+extern uint64_t ir_type_mask(enum IrBaseType type);
+
 struct IrTypeDescriptor
 {
 	enum IrBaseType base_type;
@@ -33,6 +38,29 @@ enum IrInstType
 	IRINST_COPY,
 	IRINST_EXTEND,
 	IRINST_TRUNC,
+	IRINST_SUB,
+	//Starts a function. Defines the parameter variables.
+	IRINST_FUNCTION,
+	IRINST_CALL,
+	IRINST_RETURN,
+	IRINST_LABEL,
+	IRINST_JUMP,
+	IRINST_BRANCH,
+	IRINST_LOAD,
+	IRINST_STORE,
+	IRINST_ADDROF,
+	//Slot of a removed instruction. Scans over the arrays skip it until ir_compact_function reclaims it.
+	IRINST_REMOVED,
+};
+
+//Comparison of a conditional jump. Not equal is an equal test with the targets swapped.
+enum IrCompare
+{
+	IRCMP_EQ,
+	IRCMP_GT,
+	IRCMP_LT,
+	IRCMP_GE,
+	IRCMP_LE,
 };
 
 struct IrInstDefine
@@ -60,7 +88,6 @@ struct IrInstCopy
 struct IrInstExtend
 {
 	int src_var;
-	bool sign_extend;
 };
 
 struct IrInstTrunc
@@ -68,47 +95,242 @@ struct IrInstTrunc
 	int src_var;
 };
 
-struct IrInst
+struct IrInstSub
+{
+	int lvar;
+	int rvar;
+};
+
+//Index into IrFunction.calls. dst_var is 0 if the function returns nothing.
+struct IrInstCall
+{
+	int call;
+};
+
+//src_var is 0 if nothing is returned
+struct IrInstReturn
+{
+	int src_var;
+};
+
+//Labels are numbered from 1 and are used by IRINST_LABEL, IRINST_JUMP and IRINST_BRANCH
+struct IrInstLabel
+{
+	int label;
+};
+
+struct IrInstJump
 {
-	enum IrInstType type;
-	int dst_var;
-	struct IrTypeDescriptor dst_type;
-	struct IrInst *next;
-	struct IrInst *prev;
-	union
-	{
-		struct IrInstDefine define;
-		struct IrInstAdd add;
-		struct IrInstMul mul;
-		struct IrInstCopy copy;
-		struct IrInstExtend extend;
-		struct IrInstTrunc trunc;
-	};
+	int label;
 };
 
+//Jumps to true_label if the comparison of lvar with rvar holds, otherwise to false_label.
+//The comparison is kept in the instruction's flags.
+struct IrInstBranch
+{
+	int lvar;
+	int rvar;
+	int true_label;
+	int false_label;
+};
+
+//Reads a value of the destination type from the address in ptr_var
+struct IrInstLoad
+{
+	int ptr_var;
+};
+
+//Writes src_var to the address in ptr_var
+struct IrInstStore
+{
+	int ptr_var;
+	int src_var;
+};
+
+//Gives the address of src_var. The variable is kept in memory from then on.
+struct IrInstAddrof
+{
+	int src_var;
+};
+
+//Operands of an instruction. IRINST_FUNCTION has none, its parameters are kept in IrFunction.
+union IrOperands
+{
+	struct IrInstDefine define;
+	struct IrInstAdd add;
+	struct IrInstMul mul;
+	struct IrInstCopy copy;
+	struct IrInstExtend extend;
+	struct IrInstTrunc trunc;
+	struct IrInstSub sub;
+	struct IrInstCall call;
+	struct IrInstReturn ret;
+	struct IrInstLabel label;
+	struct IrInstJump jump;
+	struct IrInstBranch branch;
+	struct IrInstLoad load;
+	struct IrInstStore store;
+	struct IrInstAddrof addrof;
+	//The variables an instruction reads come first in its operands, so they can also be reached as an array
+	int vars[4];
+};
+
+//Flags of an instruction. The low bits hold the IrCompare of a branch.
+#define IR_FLAG_COMPARE_MASK 0x07
+//Set on sign extensions and on branches that compare signed numbers
+#define IR_FLAG_SIGNED 0x08
+
+typedef uint32_t IrInstIndex;
+#define IR_INST_INDEX_NONE UINT32_MAX
+
+typedef uint32_t IrUseIndex;
+#define IR_USE_INDEX_NONE UINT32_MAX
+
+//A read of a variable by an operand of an instruction. The uses of each variable are linked into a list that
+//starts at IrVar.first_use, so the readers of a variable are found without scanning the function.
+struct IrUse
+{
+	IrInstIndex inst;
+	//Position among the variables the instruction reads, as given by ir_inst_uses
+	int operand;
+	IrUseIndex next;
+	IrUseIndex prev;
+};
+
+VECTOR_DEFINE(IrUseVector, ir_use_vector, struct IrUse)
+
+//Instructions of one function, stored as parallel arrays indexed by IrInstIndex so a pass that only looks at
+//opcodes or operands reads just those arrays. Program order is kept by the next and prev links, so instructions
+//can be removed without moving the others. Removed slots are reclaimed by ir_compact_function.
+struct IrInstBuffer
+{
+	uint8_t *opcodes;
+	//IrBaseType of the destination
+	uint8_t *types;
+	uint8_t *flags;
+	int32_t *dst_vars;
+	union IrOperands *operands;
+	IrInstIndex *next;
+	IrInstIndex *prev;
+	//The uses of an instruction's operands are consecutive in IrFunction.uses, starting at first_uses
+	IrUseIndex *first_uses;
+	uint32_t size;
+	uint32_t capacity;
+	IrInstIndex first;
+	IrInstIndex last;
+	//Number of slots that have been removed from the order but not reclaimed yet
+	uint32_t removed;
+};
+
+//Callee and arguments of an IRINST_CALL. Names point into the source text and are not NUL terminated.
+struct IrCallSite
+{
+	const char *name;
+	int name_length;
+	int *args;
+	int arg_count;
+};
+
+VECTOR_DEFINE(IrCallSiteVector, ir_call_site_vector, struct IrCallSite)
+
+struct IrFunction
+{
+	const char *name;
+	int name_length;
+	//Variables holding the arguments, in order. They are defined by the IRINST_FUNCTION instruction that
+	//starts the buffer.
+	int *params;
+	int param_count;
+	//Variables created while the function is current are numbered from first_var up to the first_var of the
+	//next function
+	int first_var;
+	struct IrInstBuffer insts;
+	IrCallSiteVector calls;
+	//Uses of the operands of removed or rewritten instructions are unlinked and left in place until the function
+	//is compacted
+	IrUseVector uses;
+};
+
+VECTOR_DEFINE(IrFunctionVector, ir_function_vector, struct IrFunction)
+
+//Variables are numbered densely from 1 across the whole context, so the table is indexed by variable number.
+//Entry 0 is never defined. A variable is only used within the function it was created in.
 struct IrVar
 {
-	int var_number;
 	struct IrTypeDescriptor type;
+	//First instruction that assigned the variable, IR_INST_INDEX_NONE while the variable is undefined
+	IrInstIndex definition;
+	//Number of instruction operands that read the variable and the first of them in IrFunction.uses
+	int use_count;
+	IrUseIndex first_use;
+	//Set once an IRINST_ADDROF has taken the address of the variable, after which stores and calls can change it
+	bool address_taken;
 };
 
+VECTOR_DEFINE(IrVarVector, ir_var_vector, struct IrVar)
+
 struct IrContext
 {
-	Vector inst_vector;
-	Vector variables;
-	struct IrInst *last_instruction;
-	struct IrInst *first_instruction;
+	//Parameter and argument lists are allocated from the compilation's arena and released with it
+	Arena *arena;
+	IrVarVector variables;
+	//Instructions are pushed to the last function
+	IrFunctionVector functions;
 	int next_var_number;
+	int next_label_number;
 };
 
-extern struct IrContext ir_create_context();
+extern struct IrContext ir_create_context(Arena *arena);
 extern void ir_free_context(struct IrContext *ctx);
-extern void ir_print_context(struct IrContext *ctx);
-extern struct IrInst *ir_push_define(struct IrContext *ctx, enum IrBaseType base_type, uint64_t value);
-extern struct IrInst *ir_push_add(struct IrContext *ctx, int lvar, int rvar, int dst_var);
-extern struct IrInst *ir_push_mul(struct IrContext *ctx, int lvar, int rvar, int dst_var);
-extern struct IrInst *ir_push_copy(struct IrContext *ctx, int src_var, int dst_var);
-extern struct IrInst *ir_push_extend(struct IrContext *ctx, int src_var, enum IrBaseType dst_type, bool sign_extend);
-extern struct IrInst *ir_push_trunc(struct IrContext *ctx, int src_var, enum IrBaseType dst_type);
+extern void ir_print_context(struct IrContext *ctx, FILE *file);
+//Returns NULL if var_number has not been defined. The pointer is invalidated by the next ir_push_*.
+extern struct IrVar *find_var(struct IrContext *ctx, int var_number);
+
+//Pushes that produce a value return the variable it was assigned to. The others return the index of the
+//instruction in the current function.
+//The value is truncated to the width of base_type, so constants are stored and printed the same way
+//whether the front end sign extended them or not.
+extern int ir_push_define(struct IrContext *ctx, enum IrBaseType base_type, uint64_t value);
+extern int ir_push_add(struct IrContext *ctx, int lvar, int rvar, int dst_var);
+extern int ir_push_mul(struct IrContext *ctx, int lvar, int rvar, int dst_var);
+extern int ir_push_copy(struct IrContext *ctx, int src_var, int dst_var);
+extern int ir_push_extend(struct IrContext *ctx, int src_var, enum IrBaseType dst_type, bool sign_extend);
+extern int ir_push_trunc(struct IrContext *ctx, int src_var, enum IrBaseType dst_type);
+extern int ir_push_sub(struct IrContext *ctx, int lvar, int rvar, int dst_var);
+//Starts a new function and defines a new variable of each parameter type. The name is not copied.
+//The pointer is invalidated by the next ir_push_function.
+extern struct IrFunction *ir_push_function(struct IrContext *ctx, const char *name, int name_length, enum IrBaseType *param_types, int param_count);
+//return_type IRTYPE_I0 calls a function that returns nothing and gives 0. The name is not copied.
+extern int ir_push_call(struct IrContext *ctx, const char *name, int name_length, enum IrBaseType return_type, int *args, int arg_count);
+extern IrInstIndex ir_push_return(struct IrContext *ctx, int src_var);
+//Returns a label number that has not been used yet
+extern int ir_new_label(struct IrContext *ctx);
+extern IrInstIndex ir_push_label(struct IrContext *ctx, int label);
+extern IrInstIndex ir_push_jump(struct IrContext *ctx, int label);
+extern IrInstIndex ir_push_branch(struct IrContext *ctx, enum IrCompare compare, bool is_signed, int lvar, int rvar, int true_label, int false_label);
+extern int ir_push_load(struct IrContext *ctx, int ptr_var, enum IrBaseType dst_type);
+extern IrInstIndex ir_push_store(struct IrContext *ctx, int ptr_var, int src_var);
+extern int ir_push_addrof(struct IrContext *ctx, int src_var);
+
+//One past the last variable of the function
+extern int ir_function_var_end(struct IrContext *ctx, struct IrFunction *function);
+//Points uses at the variables the instruction reads and returns how many there are
+extern int ir_inst_uses(struct IrFunction *function, IrInstIndex index, int **uses);
+//Points the operand of a use at the variable it reads
+extern int *ir_use_operand(struct IrFunction *function, IrUseIndex use);
+//Makes every operand that reads from_var read to_var instead. Each operand is rewritten, so the cost is linear
+//in the number of uses of from_var. The list is then spliced onto to_var's as a whole. The variables must have
+//the same type and from_var must not have had its address taken.
+extern void ir_replace_uses(struct IrContext *ctx, struct IrFunction *function, int from_var, int to_var);
+//Turns an instruction with a destination into a define of value, keeping its destination and type
+extern void ir_rewrite_define(struct IrContext *ctx, struct IrFunction *function, IrInstIndex index, uint64_t value);
+//Turns an instruction without a destination into a jump to label
+extern void ir_rewrite_jump(struct IrContext *ctx, struct IrFunction *function, IrInstIndex index, int label);
+//Unlinks the instruction from the order of its function. Its slot is kept until the function is compacted.
+//Removing the instruction that defined a variable leaves the variable undefined.
+extern void ir_remove_inst(struct IrContext *ctx, struct IrFunction *function, IrInstIndex index);
+//Moves the instructions of the function to new storage in program order, dropping removed slots.
+//Instruction and use indices held from before are invalidated.
+extern void ir_compact_function(struct IrContext *ctx, struct IrFunction *function);
 
 #endif
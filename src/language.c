@@ -2,33 +2,7 @@
 
 enum LangBaseType parse_base_type(Token *token)
 {
-	if (!strcmp(token->name, "void")) return LANG_TYPE_VOID;
-	if (!strcmp(token->name, "u8")) return LANG_TYPE_U8;
-	if (!strcmp(token->name, "u16")) return LANG_TYPE_U16;
-	if (!strcmp(token->name, "i8")) return LANG_TYPE_I8;
-	if (!strcmp(token->name, "i16")) return LANG_TYPE_I16;
-	return LANG_TYPE_INVALID;
-}
-
-int operator_precedence(enum LangOperator operator)
-{
-	switch (operator)
-	{
-	case LANG_OP_ADD:
-		return 4;
-	case LANG_OP_SUB:
-		return 4;
-	case LANG_OP_MUL:
-		return 3;
-	case LANG_OP_REF:
-	case LANG_OP_DEREF:
-	case LANG_OP_CAST:
-		return 2;
-	case LANG_OP_ASSIGN:
-		return 14;
-	}
-
-	return 0;
+	return lang_base_type_from_token(token->type);
 }
 
 void lang_base_type_info(enum LangBaseType type, struct BaseTypeInfo *info)
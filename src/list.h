@@ -1,19 +1,279 @@
 #ifndef LIST_H
 #define LIST_H
 
-typedef struct
-{
-	void *data;
-	int size;
-	int capacity;
-} Vector;
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "memstat.h"
+
+//Typed containers. Each DEFINE macro declares a struct and static inline functions named after prefix,
+//so every element type gets its own checked functions and no call site passes sizeof by hand.
+//Storage comes from mem_alloc, so container memory shows up in the per-phase counts of memstat.h.
+
+//Growable array. VECTOR_DEFINE(TokenVector, token_vector, Token) declares
+//	typedef struct { Token *data; int size; int capacity; } TokenVector;
+//with token_vector_create, _reserve, _push, _append, _pop, _last, _clear, _shrink and _free.
+//Elements are read through data directly. A vector created with capacity 0 does not allocate until the first push.
+//Growth doubles the capacity with realloc, so pointers into data are invalidated by any call that can grow it.
+#define VECTOR_DEFINE(Name, prefix, type) \
+	typedef struct \
+	{ \
+		type *data; \
+		int size; \
+		int capacity; \
+	} Name; \
+	\
+	static inline Name prefix##_create(int capacity) \
+	{ \
+		return (Name){ .data = capacity > 0 ? mem_alloc(sizeof(type) * capacity) : NULL, .capacity = capacity }; \
+	} \
+	\
+	static inline void prefix##_reserve(Name *vector, int capacity) \
+	{ \
+		if (capacity <= vector->capacity) return; \
+		vector->data = mem_realloc(vector->data, sizeof(type) * capacity); \
+		vector->capacity = capacity; \
+	} \
+	\
+	static inline void prefix##_grow(Name *vector, int min_capacity) \
+	{ \
+		int capacity = vector->capacity < 4 ? 4 : vector->capacity * 2; \
+		prefix##_reserve(vector, capacity < min_capacity ? min_capacity : capacity); \
+	} \
+	\
+	static inline type *prefix##_push(Name *vector, type value) \
+	{ \
+		if (vector->size == vector->capacity) \
+			prefix##_grow(vector, vector->size + 1); \
+		vector->data[vector->size] = value; \
+		return &vector->data[vector->size++]; \
+	} \
+	\
+	static inline void prefix##_append(Name *vector, const type *values, int count) \
+	{ \
+		if (vector->size + count > vector->capacity) \
+			prefix##_grow(vector, vector->size + count); \
+		if (count > 0) \
+			memcpy(vector->data + vector->size, values, sizeof(type) * count); \
+		vector->size += count; \
+	} \
+	\
+	static inline type prefix##_pop(Name *vector) \
+	{ \
+		return vector->data[--vector->size]; \
+	} \
+	\
+	static inline type *prefix##_last(Name *vector) \
+	{ \
+		return &vector->data[vector->size - 1]; \
+	} \
+	\
+	static inline void prefix##_clear(Name *vector) \
+	{ \
+		vector->size = 0; \
+	} \
+	\
+	static inline void prefix##_shrink(Name *vector) \
+	{ \
+		if (vector->size == vector->capacity) return; \
+		if (vector->size == 0) \
+		{ \
+			mem_free(vector->data); \
+			vector->data = NULL; \
+		} \
+		else \
+		{ \
+			vector->data = mem_realloc(vector->data, sizeof(type) * vector->size); \
+		} \
+		vector->capacity = vector->size; \
+	} \
+	\
+	static inline void prefix##_free(Name *vector) \
+	{ \
+		mem_free(vector->data); \
+		*vector = (Name){0}; \
+	}
+
+//Vector that keeps its first inline_capacity elements inside the struct and only allocates once it grows
+//past them. It holds no pointer to itself, so it can be copied and returned by value like the other
+//result structs, and a zeroed struct is an empty vector. Elements are reached through prefix##_data,
+//since they move to the heap on growth. capacity is 0 while the elements are inline.
+#define SMALL_VECTOR_DEFINE(Name, prefix, type, inline_capacity) \
+	typedef struct \
+	{ \
+		int size; \
+		int capacity; \
+		type *heap; \
+		type inline_data[inline_capacity]; \
+	} Name; \
+	\
+	static inline Name prefix##_create() \
+	{ \
+		return (Name){0}; \
+	} \
+	\
+	static inline type *prefix##_data(Name *vector) \
+	{ \
+		return vector->capacity ? vector->heap : vector->inline_data; \
+	} \
+	\
+	static inline type *prefix##_push(Name *vector, type value) \
+	{ \
+		if (vector->size == (vector->capacity ? vector->capacity : inline_capacity)) \
+		{ \
+			int capacity = vector->size * 2; \
+			if (vector->capacity) \
+			{ \
+				vector->heap = mem_realloc(vector->heap, sizeof(type) * capacity); \
+			} \
+			else \
+			{ \
+				vector->heap = mem_alloc(sizeof(type) * capacity); \
+				memcpy(vector->heap, vector->inline_data, sizeof(type) * vector->size); \
+			} \
+			vector->capacity = capacity; \
+		} \
+		type *data = prefix##_data(vector); \
+		data[vector->size] = value; \
+		return &data[vector->size++]; \
+	} \
+	\
+	static inline void prefix##_free(Name *vector) \
+	{ \
+		if (vector->capacity) \
+			mem_free(vector->heap); \
+		*vector = (Name){0}; \
+	}
 
-void vector_push_back(Vector *vector, void *data, int data_size);
+//Open addressing hash map with linear probing.
+//HASH_MAP_DEFINE(VariableMap, variable_map, SymbolId, int, hash_int, equal_int) declares VariableMap with
+//variable_map_create, _get, _put, _remove, _clear and _free. hash_function(key) returns a uint32_t and
+//equal_function(a, b) a bool. The slot count is a power of two and at most half of the slots are used.
+//Slots can be iterated directly: every slot with used set holds an entry.
+#define HASH_MAP_DEFINE(Name, prefix, key_type, value_type, hash_function, equal_function) \
+	typedef struct \
+	{ \
+		key_type key; \
+		value_type value; \
+		bool used; \
+	} Name##Slot; \
+	\
+	typedef struct \
+	{ \
+		Name##Slot *slots; \
+		int slot_count; \
+		int size; \
+	} Name; \
+	\
+	static inline Name prefix##_create() \
+	{ \
+		return (Name){0}; \
+	} \
+	\
+	static inline value_type *prefix##_get(Name *map, key_type key) \
+	{ \
+		if (map->size == 0) return NULL; \
+		uint32_t mask = map->slot_count - 1; \
+		for (uint32_t i = hash_function(key) & mask; map->slots[i].used; i = (i + 1) & mask) \
+		{ \
+			if (equal_function(map->slots[i].key, key)) \
+				return &map->slots[i].value; \
+		} \
+		return NULL; \
+	} \
+	\
+	static inline void prefix##_rehash(Name *map, int slot_count) \
+	{ \
+		Name##Slot *old_slots = map->slots; \
+		int old_slot_count = map->slot_count; \
+		map->slots = mem_calloc(slot_count, sizeof(Name##Slot)); \
+		map->slot_count = slot_count; \
+		uint32_t mask = slot_count - 1; \
+		for (int j = 0; j < old_slot_count; j++) \
+		{ \
+			if (!old_slots[j].used) continue; \
+			uint32_t i = hash_function(old_slots[j].key) & mask; \
+			while (map->slots[i].used) \
+				i = (i + 1) & mask; \
+			map->slots[i] = old_slots[j]; \
+		} \
+		mem_free(old_slots); \
+	} \
+	\
+	/* Inserts key or overwrites its value. Returns the stored value, valid until the next put. */ \
+	static inline value_type *prefix##_put(Name *map, key_type key, value_type value) \
+	{ \
+		if ((map->size + 1) * 2 > map->slot_count) \
+			prefix##_rehash(map, map->slot_count ? map->slot_count * 2 : 16); \
+		uint32_t mask = map->slot_count - 1; \
+		uint32_t i = hash_function(key) & mask; \
+		while (map->slots[i].used && !equal_function(map->slots[i].key, key)) \
+			i = (i + 1) & mask; \
+		if (!map->slots[i].used) \
+		{ \
+			map->slots[i].used = true; \
+			map->slots[i].key = key; \
+			map->size++; \
+		} \
+		map->slots[i].value = value; \
+		return &map->slots[i].value; \
+	} \
+	\
+	/* Removes key by shifting later entries of its probe run back, so no tombstones are needed */ \
+	static inline bool prefix##_remove(Name *map, key_type key) \
+	{ \
+		if (map->size == 0) return false; \
+		uint32_t mask = map->slot_count - 1; \
+		uint32_t i = hash_function(key) & mask; \
+		while (map->slots[i].used && !equal_function(map->slots[i].key, key)) \
+			i = (i + 1) & mask; \
+		if (!map->slots[i].used) return false; \
+		\
+		uint32_t hole = i; \
+		for (uint32_t j = (hole + 1) & mask; map->slots[j].used; j = (j + 1) & mask) \
+		{ \
+			uint32_t home = hash_function(map->slots[j].key) & mask; \
+			/* The entry can fill the hole if its home slot is not cyclically in (hole, j] */ \
+			if (((j - home) & mask) >= ((j - hole) & mask)) \
+			{ \
+				map->slots[hole] = map->slots[j]; \
+				hole = j; \
+			} \
+		} \
+		map->slots[hole].used = false; \
+		map->size--; \
+		return true; \
+	} \
+	\
+	static inline void prefix##_clear(Name *map) \
+	{ \
+		if (map->slots) \
+			memset(map->slots, 0, sizeof(Name##Slot) * map->slot_count); \
+		map->size = 0; \
+	} \
+	\
+	static inline void prefix##_free(Name *map) \
+	{ \
+		mem_free(map->slots); \
+		*map = (Name){0}; \
+	}
 
-#define vec_at(type, vector, index) ((type*)(vector)->data)[index]
-#define vec_last(type, vector) ((type*)(vector)->data)[(vector)->size - 1]
-#define vec_new(type, initial_capacity) (Vector){ .data = malloc(sizeof(type) * initial_capacity), .capacity = initial_capacity }
-#define vec_push(type, vector, value) vector_push_back(vector, value, sizeof(type))
-#define vec_free(vector) free((vector)->data);
+static inline uint32_t hash_int(int key)
+{
+	//Final mix of MurmurHash3, so consecutive keys spread over the slots
+	uint32_t h = (uint32_t)key;
+	h ^= h >> 16;
+	h *= 0x85ebca6b;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35;
+	h ^= h >> 16;
+	return h;
+}
+
+static inline bool equal_int(int a, int b)
+{
+	return a == b;
+}
 
-#endif
\ No newline at end of file
+#endif
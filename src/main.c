@@ -1,26 +1,98 @@
 #include "list.h"
 #include "tokenize.h"
+#include "ast.h"
 #include "compiler.h"
+#include "cfg.h"
+#include "opt.h"
+#include "arena.h"
+#include "memstat.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
-int main()
+//Options:
+//	--mem-stats			print allocation counts and peak memory per phase to stderr
+//	--mem-stats-json <path>	write the same numbers to a JSON file
+//	--print-cfg			print the blocks, edges and dominators of every function after the IR
+//	--no-opt			print the IR as it was lowered, without running the optimization passes
+int main(int argc, char **argv)
 {
-	Vector tokens = vec_new(Token*, 50);
-	tokenize_file("/code/kc_test.txt", &tokens);
+	bool print_mem_stats = false;
+	bool print_cfg = false;
+	bool optimize = true;
+	const char *mem_stats_path = NULL;
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--mem-stats") == 0)
+			print_mem_stats = true;
+		else if (strcmp(argv[i], "--mem-stats-json") == 0 && i + 1 < argc)
+			mem_stats_path = argv[++i];
+		else if (strcmp(argv[i], "--print-cfg") == 0)
+			print_cfg = true;
+		else if (strcmp(argv[i], "--no-opt") == 0)
+			optimize = false;
+	}
+
+	const char *source_path = "/code/kc_test.txt";
+	mem_set_phase(MEM_PHASE_LEX);
+	TokenList list = token_list_create();
+	tokenize_file(source_path, &list);
+
+	//The dump only looks at one token at a time, so it streams the file instead of reading the list
+	mem_set_phase(MEM_PHASE_PRINT);
+	SymbolTable dump_symbols = symbol_table_create();
+	Lexer *lexer = lexer_open(source_path, &dump_symbols);
+	if (lexer)
+	{
+		for (Token token = lexer_next(lexer); token.type != TOKEN_INVALID; token = lexer_next(lexer))
+		{
+			SourceLocation location = lexer_location(lexer, &token);
+			printf("%.*s\t\t\t%d\t%d\n", (int)token.length, lexer_token_text(lexer, &token), location.line, location.column);
+			if (token.type == TOKEN_INT)
+			{
+				printf("INT: %ld\n", token.int_literal);
+			}
+		}
+		lexer_close(lexer);
+	}
+	symbol_table_free(&dump_symbols);
+
+	//The tokens are parsed once into a tree per function, and the tree is lowered to IR
+	mem_set_phase(MEM_PHASE_PARSE);
+	AstUnit unit;
+	ast_parse_unit(&list, &unit);
+
+	//The parameter and argument lists of the IR live in one arena and are released together
+	mem_set_phase(MEM_PHASE_IR);
+	Arena arena = arena_create(0);
+	struct CompilerContext ctx = compiler_create_context(&arena);
+	bool r = compile_unit(&ctx, &unit);
+	if (r && optimize)
+		ir_optimize(&ctx.ir_context);
 
-	for (int i = 0; i < tokens.size; i++)
+	mem_set_phase(MEM_PHASE_PRINT);
+	if (r)
 	{
-		Token *token = vec_at(Token*, &tokens, i);
-		printf("%s\t\t\t%d\t%d\n", token->name, token->line, token->column);
-		if (token->type == TOKEN_INT)
+		ir_print_context(&ctx.ir_context, stdout);
+		for (int i = 0; print_cfg && i < ctx.ir_context.functions.size; i++)
 		{
-			printf("INT: %ld\n", token->int_literal);
+			struct IrFunction *function = &ctx.ir_context.functions.data[i];
+			struct IrCfg cfg = ir_cfg_create(function);
+			ir_print_cfg(&cfg, function, stdout);
+			ir_cfg_free(&cfg);
 		}
 	}
+	else
+		print_compiler_error(&ctx, stdout);
 
-	struct CompilerContext ctx = compiler_create_context();
-	bool r = compile_tokens(&ctx, tokens.data, 0, tokens.size);
+	mem_set_phase(MEM_PHASE_OTHER);
+	compiler_free_context(&ctx);
+	ast_unit_free(&unit);
+	arena_free(&arena);
+	token_list_free(&list);
 
-	//ast_tokens(&tokens);
-}
\ No newline at end of file
+	if (print_mem_stats)
+		mem_print_stats(stderr);
+	if (mem_stats_path && !mem_write_stats_json(mem_stats_path))
+		fprintf(stderr, "Failed to write %s\n", mem_stats_path);
+}
@@ -0,0 +1,190 @@
+#include <stdlib.h>
+#include <string.h>
+#include "memstat.h"
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+//Every block starts with a header padded to 16 bytes, so the memory handed out keeps malloc's alignment
+typedef struct
+{
+	size_t size;
+	MemPhase phase;
+} MemHeader;
+
+#define HEADER_SIZE 16
+
+typedef struct
+{
+	volatile int64_t allocations;
+	volatile int64_t bytes;
+	volatile int64_t live;
+	volatile int64_t peak;
+} PhaseCounters;
+
+static PhaseCounters phase_counters[MEM_PHASE_COUNT];
+static volatile int64_t total_live;
+static volatile int64_t total_peak;
+static volatile MemPhase current_phase = MEM_PHASE_OTHER;
+
+static const char *phase_names[MEM_PHASE_COUNT] = { "other", "lex", "parse", "ir", "print" };
+
+//The parallel lexer allocates from several threads, so the counters are updated atomically
+static bool compare_exchange(volatile int64_t *value, int64_t expected, int64_t desired)
+{
+#ifdef _MSC_VER
+	return _InterlockedCompareExchange64(value, desired, expected) == expected;
+#else
+	return __atomic_compare_exchange_n(value, &expected, desired, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+#endif
+}
+
+static int64_t atomic_read(volatile int64_t *value)
+{
+#ifdef _MSC_VER
+	//A plain 64-bit read can tear on 32-bit targets. Exchanging 0 for 0 reads the value in one locked operation.
+	return _InterlockedCompareExchange64(value, 0, 0);
+#else
+	return __atomic_load_n(value, __ATOMIC_RELAXED);
+#endif
+}
+
+static int64_t atomic_add(volatile int64_t *value, int64_t amount)
+{
+#ifdef _MSC_VER
+	int64_t old;
+	do
+	{
+		old = atomic_read(value);
+	} while (!compare_exchange(value, old, old + amount));
+	return old + amount;
+#else
+	return __atomic_add_fetch(value, amount, __ATOMIC_RELAXED);
+#endif
+}
+
+static void atomic_max(volatile int64_t *value, int64_t candidate)
+{
+	int64_t old = atomic_read(value);
+	while (candidate > old && !compare_exchange(value, old, candidate))
+		old = atomic_read(value);
+}
+
+static void charge(MemPhase phase, size_t size)
+{
+	PhaseCounters *counters = &phase_counters[phase];
+	atomic_add(&counters->allocations, 1);
+	atomic_add(&counters->bytes, (int64_t)size);
+	atomic_add(&counters->live, (int64_t)size);
+	int64_t live = atomic_add(&total_live, (int64_t)size);
+	atomic_max(&counters->peak, live);
+	atomic_max(&total_peak, live);
+}
+
+static void release(MemHeader *header)
+{
+	atomic_add(&phase_counters[header->phase].live, -(int64_t)header->size);
+	atomic_add(&total_live, -(int64_t)header->size);
+}
+
+static void *finish_block(MemHeader *header, size_t size)
+{
+	header->size = size;
+	header->phase = current_phase;
+	charge(header->phase, size);
+	return (char *)header + HEADER_SIZE;
+}
+
+void *mem_alloc(size_t size)
+{
+	MemHeader *header = malloc(HEADER_SIZE + size);
+	if (!header) return NULL;
+	return finish_block(header, size);
+}
+
+void *mem_calloc(size_t count, size_t size)
+{
+	MemHeader *header = calloc(1, HEADER_SIZE + count * size);
+	if (!header) return NULL;
+	return finish_block(header, count * size);
+}
+
+void *mem_realloc(void *memory, size_t size)
+{
+	if (!memory) return mem_alloc(size);
+
+	MemHeader *header = (MemHeader *)((char *)memory - HEADER_SIZE);
+	MemHeader old_header = *header;
+	header = realloc(header, HEADER_SIZE + size);
+	if (!header) return NULL;
+	release(&old_header);
+	return finish_block(header, size);
+}
+
+void mem_free(void *memory)
+{
+	if (!memory) return;
+	MemHeader *header = (MemHeader *)((char *)memory - HEADER_SIZE);
+	release(header);
+	free(header);
+}
+
+MemPhase mem_set_phase(MemPhase phase)
+{
+	MemPhase previous = current_phase;
+	current_phase = phase;
+	return previous;
+}
+
+MemPhaseStats mem_phase_stats(MemPhase phase)
+{
+	PhaseCounters *counters = &phase_counters[phase];
+	return (MemPhaseStats)
+	{
+		.allocations = (uint64_t)counters->allocations,
+		.bytes = (uint64_t)counters->bytes,
+		.live = counters->live,
+		.peak = counters->peak
+	};
+}
+
+const char *mem_phase_name(MemPhase phase)
+{
+	return phase < MEM_PHASE_COUNT ? phase_names[phase] : "";
+}
+
+int64_t mem_peak()
+{
+	return total_peak;
+}
+
+void mem_print_stats(FILE *file)
+{
+	fprintf(file, "%-8s %12s %14s %14s %14s\n", "phase", "allocations", "bytes", "live", "peak");
+	for (int i = 0; i < MEM_PHASE_COUNT; i++)
+	{
+		MemPhaseStats stats = mem_phase_stats(i);
+		fprintf(file, "%-8s %12llu %14llu %14lld %14lld\n", mem_phase_name(i),
+			(unsigned long long)stats.allocations, (unsigned long long)stats.bytes, (long long)stats.live, (long long)stats.peak);
+	}
+	fprintf(file, "%-8s %12s %14s %14lld %14lld\n", "total", "", "", (long long)total_live, (long long)total_peak);
+}
+
+bool mem_write_stats_json(const char *path)
+{
+	FILE *file = fopen(path, "w");
+	if (!file) return false;
+
+	fputs("{\n\t\"phases\": {\n", file);
+	for (int i = 0; i < MEM_PHASE_COUNT; i++)
+	{
+		MemPhaseStats stats = mem_phase_stats(i);
+		fprintf(file, "\t\t\"%s\": { \"allocations\": %llu, \"bytes\": %llu, \"live\": %lld, \"peak\": %lld }%s\n", mem_phase_name(i),
+			(unsigned long long)stats.allocations, (unsigned long long)stats.bytes, (long long)stats.live, (long long)stats.peak,
+			i + 1 < MEM_PHASE_COUNT ? "," : "");
+	}
+	fprintf(file, "\t},\n\t\"live\": %lld,\n\t\"peak\": %lld\n}\n", (long long)total_live, (long long)total_peak);
+
+	return fclose(file) == 0;
+}
@@ -0,0 +1,51 @@
+#ifndef MEMSTAT_H
+#define MEMSTAT_H
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+//Counting allocator. The containers, the arena, the symbol table and the lexer allocate through mem_alloc,
+//mem_calloc, mem_realloc and mem_free, and every call is charged to the phase that is current at the time.
+//Each block carries a small header with its size and phase so frees and reallocs are charged back correctly.
+//Memory from these functions must be released with mem_free, never with free.
+
+typedef enum
+{
+	MEM_PHASE_OTHER,
+	MEM_PHASE_LEX,
+	MEM_PHASE_PARSE,
+	MEM_PHASE_IR,
+	MEM_PHASE_PRINT,
+	MEM_PHASE_COUNT
+} MemPhase;
+
+typedef struct
+{
+	//Number of mem_alloc, mem_calloc and mem_realloc calls made during the phase
+	uint64_t allocations;
+	//Bytes requested during the phase. A realloc counts the new size.
+	uint64_t bytes;
+	//Bytes allocated during the phase that are still allocated
+	int64_t live;
+	//Highest number of bytes live in the whole program while the phase was current
+	int64_t peak;
+} MemPhaseStats;
+
+extern void *mem_alloc(size_t size);
+extern void *mem_calloc(size_t count, size_t size);
+extern void *mem_realloc(void *memory, size_t size);
+extern void mem_free(void *memory);
+
+//Makes phase current and returns the phase that was current before, so nested phases can restore it
+extern MemPhase mem_set_phase(MemPhase phase);
+extern MemPhaseStats mem_phase_stats(MemPhase phase);
+extern const char *mem_phase_name(MemPhase phase);
+//Highest number of bytes live at any point
+extern int64_t mem_peak();
+
+//Prints one line per phase, meant for stderr
+extern void mem_print_stats(FILE *file);
+extern bool mem_write_stats_json(const char *path);
+
+#endif
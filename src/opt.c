@@ -0,0 +1,921 @@
+#include "opt.h"
+#include "cfg.h"
+
+VECTOR_DEFINE(WorkVector, work_vector, int)
+
+//Instructions that assign each variable of a function. The IR links the uses of a variable but only the first
+//assignment, and copies assign variables again, so passes that need every assignment list them here.
+struct Assignments
+{
+	int first_var;
+	//The assignments to variable v are insts[starts[v - first_var]] through insts[starts[v - first_var + 1] - 1].
+	//Parameters are also assigned by the function header, which is not listed.
+	int *starts;
+	IrInstIndex *insts;
+};
+
+static struct Assignments assignments_create(struct IrContext *ctx, struct IrFunction *function)
+{
+	struct IrInstBuffer *insts = &function->insts;
+	int var_count = ir_function_var_end(ctx, function) - function->first_var;
+	struct Assignments assignments =
+	{
+		.first_var = function->first_var,
+		.starts = mem_calloc(var_count + 1, sizeof(int))
+	};
+
+	for (IrInstIndex i = insts->first; i != IR_INST_INDEX_NONE; i = insts->next[i])
+	{
+		if (insts->dst_vars[i] != 0)
+			assignments.starts[insts->dst_vars[i] - assignments.first_var + 1]++;
+	}
+	for (int v = 0; v < var_count; v++)
+		assignments.starts[v + 1] += assignments.starts[v];
+
+	int *filled = mem_calloc(var_count + 1, sizeof(int));
+	assignments.insts = mem_alloc(sizeof(IrInstIndex) * (assignments.starts[var_count] + 1));
+	for (IrInstIndex i = insts->first; i != IR_INST_INDEX_NONE; i = insts->next[i])
+	{
+		int v = insts->dst_vars[i] - assignments.first_var;
+		if (insts->dst_vars[i] != 0)
+			assignments.insts[assignments.starts[v] + filled[v]++] = i;
+	}
+	mem_free(filled);
+	return assignments;
+}
+
+static void assignments_free(struct Assignments *assignments)
+{
+	mem_free(assignments->starts);
+	mem_free(assignments->insts);
+}
+
+enum LatticeState
+{
+	//No definition that can run has been seen to give a value yet
+	LATTICE_UNKNOWN,
+	LATTICE_CONSTANT,
+	//Can hold more than one value
+	LATTICE_VARYING,
+};
+
+struct LatticeValue
+{
+	enum LatticeState state;
+	//Masked to the width of the variable
+	uint64_t value;
+};
+
+//Phi of a variable at the start of a block where assignments from different paths meet
+struct SccpPhi
+{
+	int var;
+	int block;
+	//The definition reaching the phi along each predecessor of its block starts at Sccp.phi_args[first_arg]
+	int first_arg;
+};
+
+VECTOR_DEFINE(SccpPhiVector, sccp_phi_vector, struct SccpPhi)
+
+//A variable that is assigned again would fall to varying with one lattice value per variable, so SCCP runs
+//on an SSA view of the function that leaves the IR as it is. Every instruction with a destination is a
+//definition of its own, phis are placed at the iterated dominance frontiers of the blocks that assign a
+//variable, and every operand is resolved to the one definition that reaches it by a walk over the dominator
+//tree. Definitions are numbered by instruction index, then by phi, and the last number stands for a value
+//that is unknown at compile time, like a parameter, an uninitialized variable or one whose address is taken.
+struct Sccp
+{
+	struct IrContext *ctx;
+	struct IrFunction *function;
+	struct IrCfg cfg;
+	int first_var;
+	int var_count;
+	//Ordered by block. The phis of block b are phis.data[phi_starts[b]] through phis.data[phi_starts[b + 1] - 1].
+	SccpPhiVector phis;
+	int *phi_starts;
+	int *phi_args;
+	int varying_def;
+	//Definition read by every use in IrFunction.uses
+	int *use_defs;
+	//Instructions and phis (numbered like their definitions) that read definition d are
+	//users[user_starts[d]] through users[user_starts[d + 1] - 1]
+	int *user_starts;
+	int *users;
+	//Position of an edge among the predecessors of its target, indexed like IrCfg.succs, and the edge of every
+	//predecessor, indexed like IrCfg.preds
+	int *edge_preds;
+	int *pred_edges;
+	struct LatticeValue *values;
+	bool *edge_executable;
+	bool *executable;
+	WorkVector block_worklist;
+	WorkVector def_worklist;
+};
+
+//Reads a masked value of the type as a two's complement number
+static int64_t sign_extend(uint64_t value, enum IrBaseType type)
+{
+	uint64_t mask = ir_type_mask(type);
+	uint64_t sign = (mask >> 1) + 1;
+	return (value & sign) ? (int64_t)(value | ~mask) : (int64_t)value;
+}
+
+static struct LatticeValue constant(uint64_t value, enum IrBaseType type)
+{
+	return (struct LatticeValue){ .state = LATTICE_CONSTANT, .value = value & ir_type_mask(type) };
+}
+
+static struct LatticeValue meet(struct LatticeValue a, struct LatticeValue b)
+{
+	if (a.state == LATTICE_UNKNOWN) return b;
+	if (b.state == LATTICE_UNKNOWN) return a;
+	if (a.state == LATTICE_VARYING || b.state == LATTICE_VARYING || a.value != b.value)
+		return (struct LatticeValue){ .state = LATTICE_VARYING };
+	return a;
+}
+
+static bool is_tracked(struct Sccp *sccp, int var_number)
+{
+	return !sccp->ctx->variables.data[var_number].address_taken;
+}
+
+static enum IrBaseType var_type(struct Sccp *sccp, int var_number)
+{
+	return sccp->ctx->variables.data[var_number].type.base_type;
+}
+
+//Dominance frontiers as in Cooper, Harvey and Kennedy. A block with several predecessors is in the frontier
+//of every block on the dominator tree paths from its predecessors up to, but not including, its immediate
+//dominator. The frontier of block b is blocks[starts[b]] through blocks[starts[b + 1] - 1].
+struct Frontiers
+{
+	int *starts;
+	int *blocks;
+};
+
+static struct Frontiers frontiers_create(struct IrCfg *cfg)
+{
+	int block_count = cfg->blocks.size;
+	WorkVector pairs = work_vector_create(16);
+	int *last_added = mem_alloc(sizeof(int) * (block_count + 1));
+	for (int b = 0; b < block_count; b++)
+		last_added[b] = -1;
+
+	for (int b = 0; b < block_count; b++)
+	{
+		struct IrBlock *block = &cfg->blocks.data[b];
+		if (block->order_index < 0 || block->pred_count < 2) continue;
+		for (int p = 0; p < block->pred_count; p++)
+		{
+			//A walk that reaches a block already given b has the rest of its path done too
+			int runner = cfg->preds.data[block->first_pred + p];
+			if (cfg->blocks.data[runner].order_index < 0) continue;
+			while (runner != block->idom && last_added[runner] != b)
+			{
+				last_added[runner] = b;
+				work_vector_push(&pairs, runner);
+				work_vector_push(&pairs, b);
+				runner = cfg->blocks.data[runner].idom;
+			}
+		}
+	}
+
+	struct Frontiers frontiers =
+	{
+		.starts = mem_calloc(block_count + 1, sizeof(int)),
+		.blocks = mem_alloc(sizeof(int) * (pairs.size / 2 + 1))
+	};
+	for (int i = 0; i < pairs.size; i += 2)
+		frontiers.starts[pairs.data[i] + 1]++;
+	for (int b = 0; b < block_count; b++)
+	{
+		frontiers.starts[b + 1] += frontiers.starts[b];
+		last_added[b] = frontiers.starts[b];
+	}
+	for (int i = 0; i < pairs.size; i += 2)
+		frontiers.blocks[last_added[pairs.data[i]]++] = pairs.data[i + 1];
+
+	mem_free(last_added);
+	work_vector_free(&pairs);
+	return frontiers;
+}
+
+static void frontiers_free(struct Frontiers *frontiers)
+{
+	mem_free(frontiers->starts);
+	mem_free(frontiers->blocks);
+}
+
+//Places phis at the iterated dominance frontiers of the blocks that assign each variable. Only a variable
+//that some block reads before assigning it can be read from a phi, so the others get none.
+static void place_phis(struct Sccp *sccp)
+{
+	struct IrCfg *cfg = &sccp->cfg;
+	struct IrFunction *function = sccp->function;
+	struct IrInstBuffer *insts = &function->insts;
+	int block_count = cfg->blocks.size;
+	struct Assignments assignments = assignments_create(sccp->ctx, function);
+	struct Frontiers frontiers = frontiers_create(cfg);
+
+	bool *read_first = mem_calloc(sccp->var_count + 1, sizeof(bool));
+	int *assigned_in = mem_alloc(sizeof(int) * (sccp->var_count + 1));
+	for (int v = 0; v < sccp->var_count; v++)
+		assigned_in[v] = -1;
+	for (int o = 0; o < cfg->order.size; o++)
+	{
+		int b = cfg->order.data[o];
+		struct IrBlock *block = &cfg->blocks.data[b];
+		for (IrInstIndex i = block->first; ; i = insts->next[i])
+		{
+			int *vars;
+			int var_count = ir_inst_uses(function, i, &vars);
+			for (int k = 0; k < var_count; k++)
+			{
+				if (assigned_in[vars[k] - sccp->first_var] != b)
+					read_first[vars[k] - sccp->first_var] = true;
+			}
+			if (insts->dst_vars[i] != 0)
+				assigned_in[insts->dst_vars[i] - sccp->first_var] = b;
+			if (i == block->last) break;
+		}
+	}
+
+	//Both arrays hold the variable a block was last handled for, and variable numbers start at 1
+	SccpPhiVector placed = sccp_phi_vector_create(16);
+	int *has_phi = mem_calloc(block_count + 1, sizeof(int));
+	int *queued = mem_calloc(block_count + 1, sizeof(int));
+	WorkVector worklist = work_vector_create(16);
+	for (int v = sccp->first_var; v < sccp->first_var + sccp->var_count; v++)
+	{
+		int index = v - sccp->first_var;
+		if (!read_first[index] || !is_tracked(sccp, v)) continue;
+
+		for (int a = assignments.starts[index]; a < assignments.starts[index + 1]; a++)
+		{
+			int b = cfg->inst_blocks.data[assignments.insts[a]];
+			if (cfg->blocks.data[b].order_index >= 0 && queued[b] != v)
+			{
+				queued[b] = v;
+				work_vector_push(&worklist, b);
+			}
+		}
+
+		while (worklist.size > 0)
+		{
+			int b = work_vector_pop(&worklist);
+			for (int f = frontiers.starts[b]; f < frontiers.starts[b + 1]; f++)
+			{
+				int d = frontiers.blocks[f];
+				if (has_phi[d] != v)
+				{
+					has_phi[d] = v;
+					sccp_phi_vector_push(&placed, (struct SccpPhi){ .var = v, .block = d });
+				}
+				if (queued[d] != v)
+				{
+					queued[d] = v;
+					work_vector_push(&worklist, d);
+				}
+			}
+		}
+	}
+
+	//The phis are grouped by block and given one argument per predecessor
+	sccp->phi_starts = mem_calloc(block_count + 1, sizeof(int));
+	for (int p = 0; p < placed.size; p++)
+		sccp->phi_starts[placed.data[p].block + 1]++;
+	for (int b = 0; b < block_count; b++)
+	{
+		sccp->phi_starts[b + 1] += sccp->phi_starts[b];
+		queued[b] = sccp->phi_starts[b];
+	}
+	sccp->phis = sccp_phi_vector_create(placed.size);
+	sccp->phis.size = placed.size;
+	for (int p = 0; p < placed.size; p++)
+		sccp->phis.data[queued[placed.data[p].block]++] = placed.data[p];
+
+	int arg_count = 0;
+	for (int p = 0; p < sccp->phis.size; p++)
+	{
+		sccp->phis.data[p].first_arg = arg_count;
+		arg_count += cfg->blocks.data[sccp->phis.data[p].block].pred_count;
+	}
+	sccp->varying_def = insts->size + sccp->phis.size;
+	sccp->phi_args = mem_alloc(sizeof(int) * (arg_count + 1));
+	for (int a = 0; a < arg_count; a++)
+		sccp->phi_args[a] = sccp->varying_def;
+
+	work_vector_free(&worklist);
+	mem_free(queued);
+	mem_free(has_phi);
+	sccp_phi_vector_free(&placed);
+	mem_free(assigned_in);
+	mem_free(read_first);
+	frontiers_free(&frontiers);
+	assignments_free(&assignments);
+}
+
+//Numbers the edges the way ir_cfg_create fills the predecessor lists, so both directions can be looked up
+static void number_edges(struct Sccp *sccp)
+{
+	struct IrCfg *cfg = &sccp->cfg;
+	sccp->edge_preds = mem_alloc(sizeof(int) * (cfg->succs.size + 1));
+	sccp->pred_edges = mem_alloc(sizeof(int) * (cfg->preds.size + 1));
+	int *filled = mem_calloc(cfg->blocks.size + 1, sizeof(int));
+	for (int b = 0; b < cfg->blocks.size; b++)
+	{
+		struct IrBlock *block = &cfg->blocks.data[b];
+		for (int e = block->first_succ; e < block->first_succ + block->succ_count; e++)
+		{
+			struct IrBlock *succ = &cfg->blocks.data[cfg->succs.data[e]];
+			int position = filled[cfg->succs.data[e]]++;
+			sccp->edge_preds[e] = position;
+			sccp->pred_edges[succ->first_pred + position] = e;
+		}
+	}
+	mem_free(filled);
+}
+
+struct RenameEntry
+{
+	int var;
+	int previous_def;
+};
+
+VECTOR_DEFINE(RenameLog, rename_log, struct RenameEntry)
+
+//Walks the dominator tree, so the definition of a variable that is current in a block is the one that reaches
+//it. Each definition is logged with the one it hides, which is restored once the walk leaves the block.
+static void rename_vars(struct Sccp *sccp)
+{
+	struct IrCfg *cfg = &sccp->cfg;
+	struct IrFunction *function = sccp->function;
+	struct IrInstBuffer *insts = &function->insts;
+	int *current = mem_alloc(sizeof(int) * (sccp->var_count + 1));
+	for (int v = 0; v < sccp->var_count; v++)
+		current[v] = sccp->varying_def;
+	sccp->use_defs = mem_alloc(sizeof(int) * (function->uses.size + 1));
+	for (int u = 0; u < function->uses.size; u++)
+		sccp->use_defs[u] = sccp->varying_def;
+
+	RenameLog log = rename_log_create(16);
+	int *log_marks = mem_alloc(sizeof(int) * (cfg->blocks.size + 1));
+	//A block is pushed as b to enter it and as ~b to leave it
+	WorkVector stack = work_vector_create(16);
+	work_vector_push(&stack, 0);
+	while (stack.size > 0)
+	{
+		int b = work_vector_pop(&stack);
+		if (b < 0)
+		{
+			while (log.size > log_marks[~b])
+			{
+				struct RenameEntry entry = rename_log_pop(&log);
+				current[entry.var] = entry.previous_def;
+			}
+			continue;
+		}
+		log_marks[b] = log.size;
+		work_vector_push(&stack, ~b);
+
+		for (int p = sccp->phi_starts[b]; p < sccp->phi_starts[b + 1]; p++)
+		{
+			int var = sccp->phis.data[p].var - sccp->first_var;
+			rename_log_push(&log, (struct RenameEntry){ .var = var, .previous_def = current[var] });
+			current[var] = insts->size + p;
+		}
+
+		struct IrBlock *block = &cfg->blocks.data[b];
+		for (IrInstIndex i = block->first; ; i = insts->next[i])
+		{
+			int *vars;
+			int var_count = ir_inst_uses(function, i, &vars);
+			for (int k = 0; k < var_count; k++)
+			{
+				if (is_tracked(sccp, vars[k]))
+					sccp->use_defs[insts->first_uses[i] + k] = current[vars[k] - sccp->first_var];
+			}
+
+			int dst_var = insts->dst_vars[i];
+			if (dst_var != 0 && is_tracked(sccp, dst_var))
+			{
+				int var = dst_var - sccp->first_var;
+				rename_log_push(&log, (struct RenameEntry){ .var = var, .previous_def = current[var] });
+				current[var] = i;
+			}
+			if (i == block->last) break;
+		}
+
+		for (int e = block->first_succ; e < block->first_succ + block->succ_count; e++)
+		{
+			int succ = cfg->succs.data[e];
+			for (int p = sccp->phi_starts[succ]; p < sccp->phi_starts[succ + 1]; p++)
+			{
+				struct SccpPhi *phi = &sccp->phis.data[p];
+				sccp->phi_args[phi->first_arg + sccp->edge_preds[e]] = current[phi->var - sccp->first_var];
+			}
+		}
+
+		for (int c = block->first_child; c < block->first_child + block->child_count; c++)
+			work_vector_push(&stack, cfg->dom_children.data[c]);
+	}
+
+	work_vector_free(&stack);
+	mem_free(log_marks);
+	rename_log_free(&log);
+	mem_free(current);
+}
+
+//Lists the readers of every definition. The varying definition never changes, so its readers are left out.
+static void link_users(struct Sccp *sccp)
+{
+	struct IrFunction *function = sccp->function;
+	struct IrInstBuffer *insts = &function->insts;
+	int *filled = mem_calloc(sccp->varying_def + 1, sizeof(int));
+	sccp->user_starts = mem_calloc(sccp->varying_def + 2, sizeof(int));
+
+	//The first pass counts the readers and the second one stores them
+	for (int pass = 0; pass < 2; pass++)
+	{
+		for (IrInstIndex i = insts->first; i != IR_INST_INDEX_NONE; i = insts->next[i])
+		{
+			int *vars;
+			int var_count = ir_inst_uses(function, i, &vars);
+			for (int k = 0; k < var_count; k++)
+			{
+				int def = sccp->use_defs[insts->first_uses[i] + k];
+				if (def == sccp->varying_def) continue;
+				if (pass == 0)
+					sccp->user_starts[def + 1]++;
+				else
+					sccp->users[sccp->user_starts[def] + filled[def]++] = i;
+			}
+		}
+		for (int p = 0; p < sccp->phis.size; p++)
+		{
+			struct SccpPhi *phi = &sccp->phis.data[p];
+			int pred_count = sccp->cfg.blocks.data[phi->block].pred_count;
+			for (int a = phi->first_arg; a < phi->first_arg + pred_count; a++)
+			{
+				int def = sccp->phi_args[a];
+				if (def == sccp->varying_def) continue;
+				if (pass == 0)
+					sccp->user_starts[def + 1]++;
+				else
+					sccp->users[sccp->user_starts[def] + filled[def]++] = insts->size + p;
+			}
+		}
+
+		if (pass == 0)
+		{
+			for (int d = 0; d < sccp->varying_def; d++)
+				sccp->user_starts[d + 1] += sccp->user_starts[d];
+			sccp->users = mem_alloc(sizeof(int) * (sccp->user_starts[sccp->varying_def] + 1));
+		}
+	}
+	mem_free(filled);
+}
+
+//Meets the value of a definition with a value it is found to give
+static void lower_def(struct Sccp *sccp, int def, struct LatticeValue value)
+{
+	struct LatticeValue *current = &sccp->values[def];
+	struct LatticeValue lowered = meet(*current, value);
+	if (lowered.state == current->state && (lowered.state != LATTICE_CONSTANT || lowered.value == current->value)) return;
+
+	*current = lowered;
+	work_vector_push(&sccp->def_worklist, def);
+}
+
+//Value of the k-th variable the instruction reads
+static struct LatticeValue operand_value(struct Sccp *sccp, IrInstIndex index, int k)
+{
+	return sccp->values[sccp->use_defs[sccp->function->insts.first_uses[index] + k]];
+}
+
+static void mark_edge_executable(struct Sccp *sccp, int edge)
+{
+	if (sccp->edge_executable[edge]) return;
+	sccp->edge_executable[edge] = true;
+	work_vector_push(&sccp->block_worklist, sccp->cfg.succs.data[edge]);
+}
+
+static uint64_t fold_arithmetic(enum IrInstType opcode, uint64_t l, uint64_t r)
+{
+	switch (opcode)
+	{
+	case IRINST_ADD:
+		return l + r;
+	case IRINST_SUB:
+		return l - r;
+	default:
+		return l * r;
+	}
+}
+
+static bool compare_holds(enum IrCompare compare, bool is_signed, uint64_t l, uint64_t r, enum IrBaseType type)
+{
+	int64_t lv = is_signed ? sign_extend(l, type) : (int64_t)l;
+	int64_t rv = is_signed ? sign_extend(r, type) : (int64_t)r;
+	switch (compare)
+	{
+	case IRCMP_EQ:
+		return lv == rv;
+	case IRCMP_GT:
+		return lv > rv;
+	case IRCMP_LT:
+		return lv < rv;
+	case IRCMP_GE:
+		return lv >= rv;
+	case IRCMP_LE:
+		return lv <= rv;
+	}
+	return false;
+}
+
+//Taken target of a branch whose operands are both constant
+static bool branch_taken(struct Sccp *sccp, IrInstIndex index)
+{
+	struct IrInstBuffer *insts = &sccp->function->insts;
+	return compare_holds(insts->flags[index] & IR_FLAG_COMPARE_MASK, insts->flags[index] & IR_FLAG_SIGNED,
+		operand_value(sccp, index, 0).value, operand_value(sccp, index, 1).value, var_type(sccp, insts->operands[index].branch.lvar));
+}
+
+//A phi takes the meet of the definitions that reach it along the edges that can run
+static void visit_phi(struct Sccp *sccp, int p)
+{
+	struct SccpPhi *phi = &sccp->phis.data[p];
+	struct IrBlock *block = &sccp->cfg.blocks.data[phi->block];
+	struct LatticeValue value = { .state = LATTICE_UNKNOWN };
+	for (int k = 0; k < block->pred_count && value.state != LATTICE_VARYING; k++)
+	{
+		if (sccp->edge_executable[sccp->pred_edges[block->first_pred + k]])
+			value = meet(value, sccp->values[sccp->phi_args[phi->first_arg + k]]);
+	}
+	lower_def(sccp, sccp->function->insts.size + p, value);
+}
+
+static void visit_inst(struct Sccp *sccp, IrInstIndex index)
+{
+	struct IrInstBuffer *insts = &sccp->function->insts;
+	union IrOperands *operands = &insts->operands[index];
+	enum IrBaseType type = insts->types[index];
+	struct IrBlock *block = &sccp->cfg.blocks.data[sccp->cfg.inst_blocks.data[index]];
+
+	switch (insts->opcodes[index])
+	{
+	case IRINST_DEFINE:
+		lower_def(sccp, index, constant(operands->define.value, type));
+		break;
+	case IRINST_ADD:
+	case IRINST_SUB:
+	case IRINST_MUL:
+	{
+		struct LatticeValue l = operand_value(sccp, index, 0);
+		struct LatticeValue r = operand_value(sccp, index, 1);
+		if (l.state == LATTICE_VARYING || r.state == LATTICE_VARYING)
+			lower_def(sccp, index, (struct LatticeValue){ .state = LATTICE_VARYING });
+		else if (l.state == LATTICE_CONSTANT && r.state == LATTICE_CONSTANT)
+			lower_def(sccp, index, constant(fold_arithmetic(insts->opcodes[index], l.value, r.value), type));
+		break;
+	}
+	case IRINST_COPY:
+		lower_def(sccp, index, operand_value(sccp, index, 0));
+		break;
+	case IRINST_EXTEND:
+	{
+		struct LatticeValue src = operand_value(sccp, index, 0);
+		if (src.state == LATTICE_CONSTANT && (insts->flags[index] & IR_FLAG_SIGNED))
+			src.value = (uint64_t)sign_extend(src.value, var_type(sccp, operands->extend.src_var));
+		lower_def(sccp, index, src.state == LATTICE_CONSTANT ? constant(src.value, type) : src);
+		break;
+	}
+	case IRINST_TRUNC:
+	{
+		struct LatticeValue src = operand_value(sccp, index, 0);
+		lower_def(sccp, index, src.state == LATTICE_CONSTANT ? constant(src.value, type) : src);
+		break;
+	}
+	case IRINST_LOAD:
+	case IRINST_CALL:
+	case IRINST_ADDROF:
+		if (insts->dst_vars[index] != 0)
+			lower_def(sccp, index, (struct LatticeValue){ .state = LATTICE_VARYING });
+		break;
+	case IRINST_JUMP:
+		mark_edge_executable(sccp, block->first_succ);
+		break;
+	case IRINST_BRANCH:
+	{
+		struct LatticeValue l = operand_value(sccp, index, 0);
+		struct LatticeValue r = operand_value(sccp, index, 1);
+		if (l.state == LATTICE_CONSTANT && r.state == LATTICE_CONSTANT)
+		{
+			mark_edge_executable(sccp, branch_taken(sccp, index) ? block->first_succ : block->first_succ + block->succ_count - 1);
+		}
+		else if (l.state == LATTICE_VARYING || r.state == LATTICE_VARYING)
+		{
+			for (int e = block->first_succ; e < block->first_succ + block->succ_count; e++)
+				mark_edge_executable(sccp, e);
+		}
+		break;
+	}
+	default:
+		break;
+	}
+}
+
+//The phis of a block are visited again whenever another edge into it can run. Its instructions are only
+//visited the first time, and after that when a definition they read changes.
+static void visit_block(struct Sccp *sccp, int b)
+{
+	for (int p = sccp->phi_starts[b]; p < sccp->phi_starts[b + 1]; p++)
+		visit_phi(sccp, p);
+	if (sccp->executable[b]) return;
+	sccp->executable[b] = true;
+
+	struct IrInstBuffer *insts = &sccp->function->insts;
+	struct IrBlock *block = &sccp->cfg.blocks.data[b];
+	for (IrInstIndex i = block->first; ; i = insts->next[i])
+	{
+		visit_inst(sccp, i);
+		if (i == block->last) break;
+	}
+
+	//A block that does not end in a jump, branch or return falls through to the next one
+	enum IrInstType opcode = insts->opcodes[block->last];
+	if (opcode != IRINST_JUMP && opcode != IRINST_BRANCH && opcode != IRINST_RETURN && block->succ_count > 0)
+		mark_edge_executable(sccp, block->first_succ);
+}
+
+static void propagate(struct Sccp *sccp)
+{
+	struct IrInstBuffer *insts = &sccp->function->insts;
+	sccp->values[sccp->varying_def] = (struct LatticeValue){ .state = LATTICE_VARYING };
+
+	work_vector_push(&sccp->block_worklist, 0);
+	while (sccp->block_worklist.size > 0 || sccp->def_worklist.size > 0)
+	{
+		while (sccp->block_worklist.size > 0)
+			visit_block(sccp, work_vector_pop(&sccp->block_worklist));
+
+		while (sccp->def_worklist.size > 0)
+		{
+			int def = work_vector_pop(&sccp->def_worklist);
+			for (int u = sccp->user_starts[def]; u < sccp->user_starts[def + 1]; u++)
+			{
+				int user = sccp->users[u];
+				if (user >= (int)insts->size)
+				{
+					if (sccp->executable[sccp->phis.data[user - insts->size].block])
+						visit_phi(sccp, user - insts->size);
+				}
+				else if (sccp->executable[sccp->cfg.inst_blocks.data[user]])
+					visit_inst(sccp, user);
+			}
+		}
+	}
+}
+
+static bool is_foldable(enum IrInstType opcode)
+{
+	return opcode == IRINST_ADD || opcode == IRINST_SUB || opcode == IRINST_MUL ||
+		opcode == IRINST_COPY || opcode == IRINST_EXTEND || opcode == IRINST_TRUNC;
+}
+
+static void rewrite(struct Sccp *sccp)
+{
+	struct IrContext *ctx = sccp->ctx;
+	struct IrFunction *function = sccp->function;
+	struct IrInstBuffer *insts = &function->insts;
+
+	for (IrInstIndex i = insts->first; i != IR_INST_INDEX_NONE; )
+	{
+		IrInstIndex next = insts->next[i];
+		enum IrInstType opcode = insts->opcodes[i];
+
+		if (!sccp->executable[sccp->cfg.inst_blocks.data[i]])
+			ir_remove_inst(ctx, function, i);
+		else if (is_foldable(opcode) && sccp->values[i].state == LATTICE_CONSTANT)
+			ir_rewrite_define(ctx, function, i, sccp->values[i].value);
+		else if (opcode == IRINST_BRANCH && operand_value(sccp, i, 0).state == LATTICE_CONSTANT &&
+			operand_value(sccp, i, 1).state == LATTICE_CONSTANT)
+		{
+			struct IrInstBranch *branch = &insts->operands[i].branch;
+			ir_rewrite_jump(ctx, function, i, branch_taken(sccp, i) ? branch->true_label : branch->false_label);
+		}
+		i = next;
+	}
+}
+
+void ir_sccp(struct IrContext *ctx, struct IrFunction *function)
+{
+	struct Sccp sccp =
+	{
+		.ctx = ctx,
+		.function = function,
+		.cfg = ir_cfg_create(function),
+		.first_var = function->first_var,
+		.var_count = ir_function_var_end(ctx, function) - function->first_var,
+		.block_worklist = work_vector_create(16),
+		.def_worklist = work_vector_create(16)
+	};
+
+	place_phis(&sccp);
+	number_edges(&sccp);
+	rename_vars(&sccp);
+	link_users(&sccp);
+	sccp.values = mem_calloc(sccp.varying_def + 1, sizeof(struct LatticeValue));
+	sccp.edge_executable = mem_calloc(sccp.cfg.succs.size + 1, sizeof(bool));
+	sccp.executable = mem_calloc(sccp.cfg.blocks.size, sizeof(bool));
+
+	propagate(&sccp);
+	rewrite(&sccp);
+	ir_compact_function(ctx, function);
+
+	mem_free(sccp.values);
+	mem_free(sccp.edge_executable);
+	mem_free(sccp.executable);
+	mem_free(sccp.users);
+	mem_free(sccp.user_starts);
+	mem_free(sccp.use_defs);
+	mem_free(sccp.pred_edges);
+	mem_free(sccp.edge_preds);
+	mem_free(sccp.phi_args);
+	mem_free(sccp.phi_starts);
+	sccp_phi_vector_free(&sccp.phis);
+	work_vector_free(&sccp.block_worklist);
+	work_vector_free(&sccp.def_worklist);
+	ir_cfg_free(&sccp.cfg);
+}
+
+static bool is_param(struct IrContext *ctx, struct IrFunction *function, int var_number)
+{
+	return ctx->variables.data[var_number].definition == function->insts.first;
+}
+
+//Returns the only instruction that assigns the variable, or IR_INST_INDEX_NONE if there is not exactly one.
+//The only assignment to a parameter that is never assigned again is the function header.
+static IrInstIndex single_assignment(struct Assignments *assignments, struct IrContext *ctx, struct IrFunction *function, int var_number)
+{
+	int v = var_number - assignments->first_var;
+	int count = assignments->starts[v + 1] - assignments->starts[v];
+	if (is_param(ctx, function, var_number))
+		return count == 0 ? function->insts.first : IR_INST_INDEX_NONE;
+	return count == 1 ? assignments->insts[assignments->starts[v]] : IR_INST_INDEX_NONE;
+}
+
+//Instructions of one block are ordered by their position in the function
+static bool inst_dominates(struct IrCfg *cfg, uint32_t *positions, IrInstIndex a, IrInstIndex b)
+{
+	int block_a = cfg->inst_blocks.data[a];
+	int block_b = cfg->inst_blocks.data[b];
+	if (block_a != block_b)
+		return ir_cfg_dominates(cfg, block_a, block_b);
+	return positions[a] < positions[b];
+}
+
+void ir_propagate_copies(struct IrContext *ctx, struct IrFunction *function)
+{
+	struct IrInstBuffer *insts = &function->insts;
+	struct IrCfg cfg = ir_cfg_create(function);
+	struct Assignments assignments = assignments_create(ctx, function);
+	uint32_t *positions = mem_alloc(sizeof(uint32_t) * insts->size);
+	uint32_t position = 0;
+	for (IrInstIndex i = insts->first; i != IR_INST_INDEX_NONE; i = insts->next[i])
+		positions[i] = position++;
+
+	//With both variables assigned once, the copy dominating the readers of dst_var and the assignment of
+	//src_var dominating the copy, no path reaches a reader through the assignment without going through the
+	//copy after it, so src_var still holds the copied value wherever dst_var is read
+	for (IrInstIndex i = insts->first; i != IR_INST_INDEX_NONE; i = insts->next[i])
+	{
+		if (insts->opcodes[i] != IRINST_COPY) continue;
+		int dst_var = insts->dst_vars[i];
+		int src_var = insts->operands[i].copy.src_var;
+		struct IrVar *dst = &ctx->variables.data[dst_var];
+		if (dst->address_taken || ctx->variables.data[src_var].address_taken) continue;
+		if (single_assignment(&assignments, ctx, function, dst_var) != i) continue;
+		IrInstIndex src_assignment = single_assignment(&assignments, ctx, function, src_var);
+		if (src_assignment == IR_INST_INDEX_NONE || !inst_dominates(&cfg, positions, src_assignment, i)) continue;
+
+		bool dominates_uses = true;
+		for (IrUseIndex use = dst->first_use; use != IR_USE_INDEX_NONE && dominates_uses; use = function->uses.data[use].next)
+			dominates_uses = inst_dominates(&cfg, positions, i, function->uses.data[use].inst);
+		if (dominates_uses)
+			ir_replace_uses(ctx, function, dst_var, src_var);
+	}
+
+	mem_free(positions);
+	assignments_free(&assignments);
+	ir_cfg_free(&cfg);
+}
+
+VECTOR_DEFINE(InstWorkVector, inst_work_vector, IrInstIndex)
+
+//Aggressive dead code elimination. Only instructions with effects beyond their destination are taken to be
+//needed at first, then every assignment to a variable that a needed instruction reads, so values that only
+//feed each other, like a counter nothing else looks at, are removed along with the rest.
+struct Dce
+{
+	struct IrContext *ctx;
+	struct IrFunction *function;
+	struct Assignments assignments;
+	bool *live_insts;
+	//Indexed by variable number minus first_var
+	bool *live_vars;
+	InstWorkVector worklist;
+};
+
+static bool has_side_effects(enum IrInstType opcode)
+{
+	switch (opcode)
+	{
+	case IRINST_FUNCTION:
+	case IRINST_CALL:
+	case IRINST_RETURN:
+	case IRINST_LABEL:
+	case IRINST_JUMP:
+	case IRINST_BRANCH:
+	case IRINST_STORE:
+		return true;
+	default:
+		return false;
+	}
+}
+
+static void mark_inst_live(struct Dce *dce, IrInstIndex index)
+{
+	if (dce->live_insts[index]) return;
+	dce->live_insts[index] = true;
+	inst_work_vector_push(&dce->worklist, index);
+}
+
+static void mark_var_live(struct Dce *dce, int var_number)
+{
+	int v = var_number - dce->assignments.first_var;
+	if (dce->live_vars[v]) return;
+	dce->live_vars[v] = true;
+	for (int a = dce->assignments.starts[v]; a < dce->assignments.starts[v + 1]; a++)
+		mark_inst_live(dce, dce->assignments.insts[a]);
+}
+
+void ir_dce(struct IrContext *ctx, struct IrFunction *function)
+{
+	struct IrInstBuffer *insts = &function->insts;
+	int var_end = ir_function_var_end(ctx, function);
+	struct Dce dce =
+	{
+		.ctx = ctx,
+		.function = function,
+		.assignments = assignments_create(ctx, function),
+		.live_insts = mem_calloc(insts->size, sizeof(bool)),
+		.live_vars = mem_calloc(var_end - function->first_var + 1, sizeof(bool)),
+		.worklist = inst_work_vector_create(16)
+	};
+
+	for (IrInstIndex i = insts->first; i != IR_INST_INDEX_NONE; i = insts->next[i])
+	{
+		if (has_side_effects(insts->opcodes[i]))
+			mark_inst_live(&dce, i);
+	}
+	//Stores and calls can read a variable whose address was taken
+	for (int v = function->first_var; v < var_end; v++)
+	{
+		if (ctx->variables.data[v].address_taken)
+			mark_var_live(&dce, v);
+	}
+
+	while (dce.worklist.size > 0)
+	{
+		int *uses;
+		int use_count = ir_inst_uses(function, inst_work_vector_pop(&dce.worklist), &uses);
+		for (int u = 0; u < use_count; u++)
+			mark_var_live(&dce, uses[u]);
+	}
+
+	for (IrInstIndex i = insts->first; i != IR_INST_INDEX_NONE; )
+	{
+		IrInstIndex next = insts->next[i];
+		if (!dce.live_insts[i])
+			ir_remove_inst(ctx, function, i);
+		i = next;
+	}
+	ir_compact_function(ctx, function);
+
+	assignments_free(&dce.assignments);
+	mem_free(dce.live_insts);
+	mem_free(dce.live_vars);
+	inst_work_vector_free(&dce.worklist);
+}
+
+void ir_optimize(struct IrContext *ctx)
+{
+	for (int i = 0; i < ctx->functions.size; i++)
+	{
+		struct IrFunction *function = &ctx->functions.data[i];
+		ir_sccp(ctx, function);
+		ir_propagate_copies(ctx, function);
+		ir_dce(ctx, function);
+	}
+}
@@ -0,0 +1,19 @@
+#ifndef OPT_H
+#define OPT_H
+#include "ir.h"
+
+//Optimization passes over the IR of a function. Each pass leaves the function compacted.
+
+//Sparse conditional constant propagation. Arithmetic, extensions, truncations and copies whose result is
+//known are replaced by defines, branches whose outcome is known by jumps, and blocks that cannot run are
+//removed. Defines left without readers are removed by ir_dce.
+extern void ir_sccp(struct IrContext *ctx, struct IrFunction *function);
+//Makes the readers of a variable that is only assigned by a copy read the source of the copy instead, when
+//the source cannot change in between. The copies are left without readers for ir_dce.
+extern void ir_propagate_copies(struct IrContext *ctx, struct IrFunction *function);
+//Removes instructions whose results are never needed by a call, store, return or branch
+extern void ir_dce(struct IrContext *ctx, struct IrFunction *function);
+//Runs every pass over every function of the context
+extern void ir_optimize(struct IrContext *ctx);
+
+#endif
@@ -0,0 +1,118 @@
+#include <stdlib.h>
+#include <stdbool.h>
+#include "parallel.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+typedef struct
+{
+	ParallelTask task;
+	void *context;
+	int count;
+	int first_index;
+	int stride;
+} ParallelWorker;
+
+static void run_worker(ParallelWorker *worker)
+{
+	for (int i = worker->first_index; i < worker->count; i += worker->stride)
+		worker->task(worker->context, i);
+}
+
+#ifdef _WIN32
+static DWORD WINAPI worker_main(LPVOID arg)
+{
+	run_worker(arg);
+	return 0;
+}
+
+int parallel_thread_count()
+{
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return info.dwNumberOfProcessors;
+}
+#else
+static void *worker_main(void *arg)
+{
+	run_worker(arg);
+	return NULL;
+}
+
+int parallel_thread_count()
+{
+	long count = sysconf(_SC_NPROCESSORS_ONLN);
+	return count > 0 ? (int)count : 1;
+}
+#endif
+
+void parallel_for(int count, ParallelTask task, void *context)
+{
+	int thread_count = parallel_thread_count();
+	if (thread_count > count) thread_count = count;
+	if (thread_count <= 1)
+	{
+		for (int i = 0; i < count; i++)
+			task(context, i);
+		return;
+	}
+
+	ParallelWorker *workers = malloc(sizeof(ParallelWorker) * thread_count);
+#ifdef _WIN32
+	HANDLE *threads = malloc(sizeof(HANDLE) * thread_count);
+#else
+	pthread_t *threads = malloc(sizeof(pthread_t) * thread_count);
+	bool *started = calloc(thread_count, sizeof(bool));
+#endif
+
+	for (int i = 0; i < thread_count; i++)
+	{
+		workers[i] = (ParallelWorker)
+		{
+			.task = task,
+			.context = context,
+			.count = count,
+			.first_index = i,
+			.stride = thread_count
+		};
+	}
+
+	//Worker 0 runs on the calling thread. If a thread cannot be created its indexes run here too.
+	for (int i = 1; i < thread_count; i++)
+	{
+#ifdef _WIN32
+		threads[i] = CreateThread(NULL, 0, worker_main, &workers[i], 0, NULL);
+		if (!threads[i])
+			run_worker(&workers[i]);
+#else
+		started[i] = pthread_create(&threads[i], NULL, worker_main, &workers[i]) == 0;
+		if (!started[i])
+			run_worker(&workers[i]);
+#endif
+	}
+
+	run_worker(&workers[0]);
+
+	for (int i = 1; i < thread_count; i++)
+	{
+#ifdef _WIN32
+		if (!threads[i]) continue;
+		WaitForSingleObject(threads[i], INFINITE);
+		CloseHandle(threads[i]);
+#else
+		if (!started[i]) continue;
+		pthread_join(threads[i], NULL);
+#endif
+	}
+
+#ifndef _WIN32
+	free(started);
+#endif
+	free(threads);
+	free(workers);
+}
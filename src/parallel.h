@@ -0,0 +1,14 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+typedef void (*ParallelTask)(void *context, int index);
+
+//Number of hardware threads available to the process
+extern int parallel_thread_count();
+//Calls task(context, i) for every i in [0, count) on up to parallel_thread_count() threads, including the
+//calling thread, and returns once every call has finished. Indexes are split between the threads statically.
+//There is no thread pool: every call creates its threads and joins them before returning, which costs in
+//the order of tens of microseconds per thread. Callers only use it for work large enough to hide that.
+extern void parallel_for(int count, ParallelTask task, void *context);
+
+#endif
@@ -0,0 +1,295 @@
+#include "scan.h"
+#include <stdint.h>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define SCAN_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define TARGET_SSE2
+#define TARGET_AVX2
+#else
+#define TARGET_SSE2 __attribute__((target("sse2")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+typedef const char *(*ScanFunc)(const char *data, const char *end);
+
+static int is_space(char c)
+{
+	return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+static int is_word(char c)
+{
+	return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+}
+
+static const char *scan_space_scalar(const char *data, const char *end)
+{
+	while (data < end && is_space(*data))
+		data++;
+	return data;
+}
+
+static const char *scan_word_scalar(const char *data, const char *end)
+{
+	while (data < end && is_word(*data))
+		data++;
+	return data;
+}
+
+static const char *scan_quote_scalar(const char *data, const char *end)
+{
+	while (data < end && *data != '"')
+		data++;
+	return data;
+}
+
+static const char *scan_newline_scalar(const char *data, const char *end)
+{
+	while (data < end && *data != '\n')
+		data++;
+	return data;
+}
+
+#ifdef SCAN_X86
+
+static int first_set_bit(uint32_t mask)
+{
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward(&index, mask);
+	return index;
+#else
+	return __builtin_ctz(mask);
+#endif
+}
+
+//Bytes in [low, low + range] compare as unsigned after subtracting low, since SSE2 has no unsigned compare
+#define SSE2_IN_RANGE(x, low, range) _mm_cmpeq_epi8(_mm_min_epu8(_mm_sub_epi8((x), _mm_set1_epi8(low)), _mm_set1_epi8(range)), _mm_sub_epi8((x), _mm_set1_epi8(low)))
+#define AVX2_IN_RANGE(x, low, range) _mm256_cmpeq_epi8(_mm256_min_epu8(_mm256_sub_epi8((x), _mm256_set1_epi8(low)), _mm256_set1_epi8(range)), _mm256_sub_epi8((x), _mm256_set1_epi8(low)))
+
+TARGET_SSE2 static __m128i sse2_space_mask(__m128i x)
+{
+	return _mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8(' ')), SSE2_IN_RANGE(x, '\t', '\r' - '\t'));
+}
+
+TARGET_SSE2 static __m128i sse2_word_mask(__m128i x)
+{
+	//Setting bit 5 folds upper case letters onto lower case ones without creating new matches
+	__m128i letter = SSE2_IN_RANGE(_mm_or_si128(x, _mm_set1_epi8(0x20)), 'a', 'z' - 'a');
+	__m128i digit = SSE2_IN_RANGE(x, '0', 9);
+	__m128i underscore = _mm_cmpeq_epi8(x, _mm_set1_epi8('_'));
+	return _mm_or_si128(_mm_or_si128(letter, digit), underscore);
+}
+
+TARGET_SSE2 static const char *scan_space_sse2(const char *data, const char *end)
+{
+	while (end - data >= 16)
+	{
+		uint32_t mask = ~_mm_movemask_epi8(sse2_space_mask(_mm_loadu_si128((const __m128i *)data))) & 0xFFFF;
+		if (mask) return data + first_set_bit(mask);
+		data += 16;
+	}
+	return scan_space_scalar(data, end);
+}
+
+TARGET_SSE2 static const char *scan_word_sse2(const char *data, const char *end)
+{
+	while (end - data >= 16)
+	{
+		uint32_t mask = ~_mm_movemask_epi8(sse2_word_mask(_mm_loadu_si128((const __m128i *)data))) & 0xFFFF;
+		if (mask) return data + first_set_bit(mask);
+		data += 16;
+	}
+	return scan_word_scalar(data, end);
+}
+
+TARGET_SSE2 static const char *scan_quote_sse2(const char *data, const char *end)
+{
+	while (end - data >= 16)
+	{
+		uint32_t mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)data), _mm_set1_epi8('"')));
+		if (mask) return data + first_set_bit(mask);
+		data += 16;
+	}
+	return scan_quote_scalar(data, end);
+}
+
+TARGET_SSE2 static const char *scan_newline_sse2(const char *data, const char *end)
+{
+	while (end - data >= 16)
+	{
+		uint32_t mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)data), _mm_set1_epi8('\n')));
+		if (mask) return data + first_set_bit(mask);
+		data += 16;
+	}
+	return scan_newline_scalar(data, end);
+}
+
+TARGET_AVX2 static const char *scan_space_avx2(const char *data, const char *end)
+{
+	while (end - data >= 32)
+	{
+		__m256i x = _mm256_loadu_si256((const __m256i *)data);
+		__m256i space = _mm256_or_si256(_mm256_cmpeq_epi8(x, _mm256_set1_epi8(' ')), AVX2_IN_RANGE(x, '\t', '\r' - '\t'));
+		uint32_t mask = ~(uint32_t)_mm256_movemask_epi8(space);
+		if (mask) return data + first_set_bit(mask);
+		data += 32;
+	}
+	return scan_space_scalar(data, end);
+}
+
+TARGET_AVX2 static const char *scan_word_avx2(const char *data, const char *end)
+{
+	while (end - data >= 32)
+	{
+		__m256i x = _mm256_loadu_si256((const __m256i *)data);
+		__m256i letter = AVX2_IN_RANGE(_mm256_or_si256(x, _mm256_set1_epi8(0x20)), 'a', 'z' - 'a');
+		__m256i digit = AVX2_IN_RANGE(x, '0', 9);
+		__m256i underscore = _mm256_cmpeq_epi8(x, _mm256_set1_epi8('_'));
+		uint32_t mask = ~(uint32_t)_mm256_movemask_epi8(_mm256_or_si256(_mm256_or_si256(letter, digit), underscore));
+		if (mask) return data + first_set_bit(mask);
+		data += 32;
+	}
+	return scan_word_scalar(data, end);
+}
+
+TARGET_AVX2 static const char *scan_quote_avx2(const char *data, const char *end)
+{
+	while (end - data >= 32)
+	{
+		uint32_t mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)data), _mm256_set1_epi8('"')));
+		if (mask) return data + first_set_bit(mask);
+		data += 32;
+	}
+	return scan_quote_scalar(data, end);
+}
+
+TARGET_AVX2 static const char *scan_newline_avx2(const char *data, const char *end)
+{
+	while (end - data >= 32)
+	{
+		uint32_t mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)data), _mm256_set1_epi8('\n')));
+		if (mask) return data + first_set_bit(mask);
+		data += 32;
+	}
+	return scan_newline_scalar(data, end);
+}
+
+static int cpu_has_sse2()
+{
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 1);
+	return (info[3] >> 26) & 1;
+#else
+	return __builtin_cpu_supports("sse2");
+#endif
+}
+
+static int cpu_has_avx2()
+{
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7) return 0;
+	__cpuid(info, 1);
+	//The OS must save the YMM registers for AVX to be usable
+	if (!((info[2] >> 27) & 1) || !((info[2] >> 28) & 1)) return 0;
+	if ((_xgetbv(0) & 6) != 6) return 0;
+	__cpuidex(info, 7, 0);
+	return (info[1] >> 5) & 1;
+#else
+	return __builtin_cpu_supports("avx2");
+#endif
+}
+
+#endif
+
+static const char *scan_space_resolve(const char *data, const char *end);
+static const char *scan_word_resolve(const char *data, const char *end);
+static const char *scan_quote_resolve(const char *data, const char *end);
+static const char *scan_newline_resolve(const char *data, const char *end);
+
+static ScanFunc scan_space_impl = scan_space_resolve;
+static ScanFunc scan_word_impl = scan_word_resolve;
+static ScanFunc scan_quote_impl = scan_quote_resolve;
+static ScanFunc scan_newline_impl = scan_newline_resolve;
+
+//Picks the implementations on the first call. Concurrent first calls all store the same pointers.
+static void scan_resolve()
+{
+	ScanFunc space = scan_space_scalar;
+	ScanFunc word = scan_word_scalar;
+	ScanFunc quote = scan_quote_scalar;
+	ScanFunc newline = scan_newline_scalar;
+
+#ifdef SCAN_X86
+	if (cpu_has_avx2())
+	{
+		space = scan_space_avx2;
+		word = scan_word_avx2;
+		quote = scan_quote_avx2;
+		newline = scan_newline_avx2;
+	}
+	else if (cpu_has_sse2())
+	{
+		space = scan_space_sse2;
+		word = scan_word_sse2;
+		quote = scan_quote_sse2;
+		newline = scan_newline_sse2;
+	}
+#endif
+
+	scan_space_impl = space;
+	scan_word_impl = word;
+	scan_quote_impl = quote;
+	scan_newline_impl = newline;
+}
+
+static const char *scan_space_resolve(const char *data, const char *end)
+{
+	scan_resolve();
+	return scan_space_impl(data, end);
+}
+
+static const char *scan_word_resolve(const char *data, const char *end)
+{
+	scan_resolve();
+	return scan_word_impl(data, end);
+}
+
+static const char *scan_quote_resolve(const char *data, const char *end)
+{
+	scan_resolve();
+	return scan_quote_impl(data, end);
+}
+
+static const char *scan_newline_resolve(const char *data, const char *end)
+{
+	scan_resolve();
+	return scan_newline_impl(data, end);
+}
+
+const char *scan_space(const char *data, const char *end)
+{
+	return scan_space_impl(data, end);
+}
+
+const char *scan_word(const char *data, const char *end)
+{
+	return scan_word_impl(data, end);
+}
+
+const char *scan_quote(const char *data, const char *end)
+{
+	return scan_quote_impl(data, end);
+}
+
+const char *scan_newline(const char *data, const char *end)
+{
+	return scan_newline_impl(data, end);
+}
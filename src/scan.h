@@ -0,0 +1,17 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+//Character class scanners used by the lexer. Each returns a pointer to the first byte in [data, end)
+//that ends the run, or end if the run reaches it. The fastest implementation the CPU supports
+//(AVX2, SSE2 or scalar) is picked on first use.
+
+//First byte that is not whitespace (' ', '\t', '\n', '\v', '\f', '\r')
+extern const char *scan_space(const char *data, const char *end);
+//First byte that is not an identifier character ([A-Za-z0-9_])
+extern const char *scan_word(const char *data, const char *end);
+//First '"'
+extern const char *scan_quote(const char *data, const char *end);
+//First '\n'
+extern const char *scan_newline(const char *data, const char *end);
+
+#endif
@@ -0,0 +1,116 @@
+#include <stdlib.h>
+#include <string.h>
+#include "symbol.h"
+#include "memstat.h"
+
+#define SYMBOL_BLOCK_SIZE 65536
+#define SYMBOL_INITIAL_SLOTS 1024
+
+SymbolTable symbol_table_create()
+{
+	return (SymbolTable)
+	{
+		.symbols = symbol_vector_create(SYMBOL_INITIAL_SLOTS / 2),
+		.slots = mem_calloc(SYMBOL_INITIAL_SLOTS, sizeof(int)),
+		.slot_count = SYMBOL_INITIAL_SLOTS,
+		.blocks = block_vector_create(4)
+	};
+}
+
+void symbol_table_free(SymbolTable *table)
+{
+	for (int i = 0; i < table->blocks.size; i++)
+	{
+		mem_free(table->blocks.data[i]);
+	}
+	block_vector_free(&table->blocks);
+	symbol_vector_free(&table->symbols);
+	mem_free(table->slots);
+	*table = (SymbolTable){0};
+}
+
+//FNV-1a
+static uint32_t hash_string(const char *str, int length)
+{
+	uint32_t hash = 2166136261u;
+	for (int i = 0; i < length; i++)
+	{
+		hash ^= (unsigned char)str[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+static const char *store_name(SymbolTable *table, const char *str, int length)
+{
+	if (table->block_used + length + 1 > table->block_capacity)
+	{
+		//Names longer than a block get a block of their own
+		int capacity = length + 1 > SYMBOL_BLOCK_SIZE ? length + 1 : SYMBOL_BLOCK_SIZE;
+		char *block = mem_alloc(capacity);
+		block_vector_push(&table->blocks, block);
+		table->block_used = 0;
+		table->block_capacity = capacity;
+	}
+
+	char *name = *block_vector_last(&table->blocks) + table->block_used;
+	memcpy(name, str, length);
+	name[length] = 0;
+	table->block_used += length + 1;
+	return name;
+}
+
+static void grow_slots(SymbolTable *table)
+{
+	int slot_count = table->slot_count * 2;
+	int *slots = mem_calloc(slot_count, sizeof(int));
+
+	for (int id = 0; id < table->symbols.size; id++)
+	{
+		uint32_t i = table->symbols.data[id].hash & (slot_count - 1);
+		while (slots[i])
+			i = (i + 1) & (slot_count - 1);
+		slots[i] = id + 1;
+	}
+
+	mem_free(table->slots);
+	table->slots = slots;
+	table->slot_count = slot_count;
+}
+
+SymbolId symbol_intern(SymbolTable *table, const char *str, int length)
+{
+	uint32_t hash = hash_string(str, length);
+	uint32_t i = hash & (table->slot_count - 1);
+
+	while (table->slots[i])
+	{
+		SymbolId id = table->slots[i] - 1;
+		Symbol *symbol = &table->symbols.data[id];
+		if (symbol->hash == hash && symbol->length == length && !memcmp(symbol->name, str, length))
+			return id;
+		i = (i + 1) & (table->slot_count - 1);
+	}
+
+	Symbol symbol = (Symbol)
+	{
+		.name = store_name(table, str, length),
+		.length = length,
+		.hash = hash
+	};
+	SymbolId id = table->symbols.size;
+	symbol_vector_push(&table->symbols, symbol);
+	table->slots[i] = id + 1;
+
+	//Keep the load factor at or below one half
+	if (table->symbols.size * 2 > table->slot_count)
+		grow_slots(table);
+
+	return id;
+}
+
+const char *symbol_name(SymbolTable *table, SymbolId id)
+{
+	if (id < 0 || id >= table->symbols.size) return NULL;
+	return table->symbols.data[id].name;
+}
@@ -0,0 +1,39 @@
+#ifndef SYMBOL_H
+#define SYMBOL_H
+#include "list.h"
+#include <stdint.h>
+
+//Every distinct lexeme is interned once. Two lexemes with the same text always have the same SymbolId,
+//so names can be compared with == instead of strcmp.
+typedef int SymbolId;
+#define SYMBOL_INVALID -1
+
+typedef struct
+{
+	const char *name;
+	int length;
+	uint32_t hash;
+} Symbol;
+
+VECTOR_DEFINE(SymbolVector, symbol_vector, Symbol)
+VECTOR_DEFINE(BlockVector, block_vector, char *)
+
+typedef struct
+{
+	SymbolVector symbols;
+	//Open addressing table of SymbolId + 1. 0 marks an empty slot. slot_count is always a power of two.
+	int *slots;
+	int slot_count;
+	//Names are stored NUL terminated in fixed size blocks that are never moved, so Symbol.name stays valid
+	//for the lifetime of the table.
+	BlockVector blocks;
+	int block_used;
+	int block_capacity;
+} SymbolTable;
+
+extern SymbolTable symbol_table_create();
+extern void symbol_table_free(SymbolTable *table);
+extern SymbolId symbol_intern(SymbolTable *table, const char *str, int length);
+extern const char *symbol_name(SymbolTable *table, SymbolId id);
+
+#endif
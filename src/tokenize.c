@@ -1,28 +1,91 @@
 #include "tokenize.h"
+#include "file_map.h"
+#include "scan.h"
+#include "parallel.h"
+#include "memstat.h"
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
-#include <ctype.h>
+#include <assert.h>
 
-//If str1 starts with str2, returns the length of str2. Otherwise returns 0.
-static int starts_with(const char *str1, const char *str2)
+#define CC_SPACE 1
+#define CC_DIGIT 2
+#define CC_WORD 4
+
+//Character classes for the C locale. CC_WORD is any character that can start an identifier.
+//Identifier characters after the first are CC_WORD | CC_DIGIT.
+#define S CC_SPACE
+#define D CC_DIGIT
+#define W CC_WORD
+static const unsigned char char_class[256] =
+{
+	0, 0, 0, 0, 0, 0, 0, 0, 0, S, S, S, S, S, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	S, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	D, D, D, D, D, D, D, D, D, D, 0, 0, 0, 0, 0, 0,
+	0, W, W, W, W, W, W, W, W, W, W, W, W, W, W, W,
+	W, W, W, W, W, W, W, W, W, W, W, 0, 0, 0, 0, W,
+	0, W, W, W, W, W, W, W, W, W, W, W, W, W, W, W,
+	W, W, W, W, W, W, W, W, W, W, W, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+};
+#undef S
+#undef D
+#undef W
+#define char_is(c, cls) (char_class[(unsigned char)(c)] & (cls))
+
+typedef struct
+{
+	const char *text;
+	int length;
+	TokenType type;
+} Keyword;
+
+//Perfect hash of every keyword (except @array, which is handled by its own '@' dispatch).
+//If a keyword is added, KEYWORD_HASH must be re-checked for collisions.
+#define KEYWORD_HASH(str, len) (((unsigned char)(str)[0] * 5 + (unsigned char)(str)[(len) - 1] * 2 + (len)) & 63)
+static const Keyword keyword_table[64] =
 {
-	int len = strlen(str2);
-	if (!strncmp(str1, str2, len))
-		return len;
-	return 0;
+	[1] = { "continue", 8, TOKEN_CONTINUE },
+	[2] = { "null", 4, TOKEN_NULL },
+	[5] = { "break", 5, TOKEN_BREAK },
+	[6] = { "bool", 4, TOKEN_BOOL },
+	[7] = { "else", 4, TOKEN_ELSE },
+	[11] = { "static", 6, TOKEN_STATIC },
+	[13] = { "false", 5, TOKEN_FALSE },
+	[18] = { "true", 4, TOKEN_TRUE },
+	[26] = { "void", 4, TOKEN_VOID },
+	[27] = { "if", 2, TOKEN_IF },
+	[28] = { "return", 6, TOKEN_RETURN },
+	[34] = { "while", 5, TOKEN_WHILE },
+	[37] = { "for", 3, TOKEN_FOR },
+	[45] = { "struct", 6, TOKEN_STRUCT },
+	[56] = { "u16", 3, TOKEN_U16 },
+	[59] = { "u8", 2, TOKEN_U8 },
+	[60] = { "i16", 3, TOKEN_I16 },
+	[63] = { "i8", 2, TOKEN_I8 },
+};
+
+//Returns the keyword type of the word, or TOKEN_IDENTIFIER if the word is not a keyword
+static TokenType keyword_lookup(const char *word, int length)
+{
+	const Keyword *keyword = &keyword_table[KEYWORD_HASH(word, length)];
+	if (keyword->length == length && !memcmp(word, keyword->text, length))
+		return keyword->type;
+	return TOKEN_IDENTIFIER;
 }
 
-//If str1 starts with str2 and then contains a non-identifier character, return the length of str2
-//Otherwise return 0
-static int is_word_token(const char *str1, const char *str2)
+//Returns the length of the run of identifier characters at the start of input
+static int word_length(const char *input, const char *end)
 {
-	int len = starts_with(str1, str2);
-	if (len == 0) return 0;
-	str1 += len;
-	if (!isalnum(*str1) && *str1 != '_')
-		return len;
-	return 0;
+	return scan_word(input, end) - input;
 }
 
 typedef struct
@@ -31,100 +94,63 @@ typedef struct
 	int token_length;
 } TokenLookupResult;
 
-static TokenLookupResult token_type_lookup(const char *search_str, TokenType previous_type)
-{
-	int length = 0;
-
-	length = is_word_token(search_str, "continue");
-	if (length > 0) return (TokenLookupResult){ .type = TOKEN_CONTINUE, .token_length = length };
-	length = is_word_token(search_str, "null");
-	if (length > 0) return (TokenLookupResult){ .type = TOKEN_NULL, .token_length = length };
-	length = is_word_token(search_str, "false");
-	if (length > 0) return (TokenLookupResult){ .type = TOKEN_FALSE, .token_length = length };
-	length = is_word_token(search_str, "true");
-	if (length > 0) return (TokenLookupResult){ .type = TOKEN_TRUE, .token_length = length };
-	length = is_word_token(search_str, "break");
-	if (length > 0) return (TokenLookupResult){ .type = TOKEN_BREAK, .token_length = length };
-	length = is_word_token(search_str, "while");
-	if (length > 0) return (TokenLookupResult){ .type = TOKEN_WHILE, .token_length = length };
-	length = is_word_token(search_str, "else");
-	if (length > 0) return (TokenLookupResult){ .type = TOKEN_ELSE, .token_length = length };
-	length = is_word_token(search_str, "if");
-	if (length > 0) return (TokenLookupResult){ .type = TOKEN_IF, .token_length = length };
-	length = is_word_token(search_str, "return");
-	if (length > 0) return (TokenLookupResult){ .type = TOKEN_RETURN, .token_length = length };
-	length = is_word_token(search_str, "void");
-	if (length > 0) return (TokenLookupResult){ .type = TOKEN_VOID, .token_length = length };
-	length = is_word_token(search_str, "for");
-	if (length > 0) return (TokenLookupResult){ .type = TOKEN_FOR, .token_length = length };
-	length = is_word_token(search_str, "struct");
-	if (length > 0) return (TokenLookupResult){ .type = TOKEN_STRUCT, .token_length = length };
-	length = is_word_token(search_str, "static");
-	if (length > 0) return (TokenLookupResult){ .type = TOKEN_STATIC, .token_length = length };
-	length = is_word_token(search_str, "@array");
-	if (length > 0) return (TokenLookupResult){ .type = TOKEN_ARRAY_DECL, .token_length = length };
-
-	length = starts_with(search_str, "||");
-	if (length > 0) return (TokenLookupResult){ .type = TOKEN_LOGIC_OR, .token_length = length };
-	length = starts_with(search_str, "&&");
-	if (length > 0) return (TokenLookupResult){ .type = TOKEN_LOGIC_AND, .token_length = length };
-	length = starts_with(search_str, ">=");
-	if (length > 0) return (TokenLookupResult){ .type = TOKEN_CMP_GE, .token_length = length };
-	length = starts_with(search_str, "<=");
-	if (length > 0) return (TokenLookupResult){ .type = TOKEN_CMP_LE, .token_length = length };
-	length = starts_with(search_str, "!=");
-	if (length > 0) return (TokenLookupResult){ .type = TOKEN_CMP_NEQ, .token_length = length };
-	length = starts_with(search_str, "==");
-	if (length > 0) return (TokenLookupResult){ .type = TOKEN_CMP_EQ, .token_length = length };
-	length = starts_with(search_str, "->");
-	if (length > 0) return (TokenLookupResult){ .type = TOKEN_ARROW, .token_length = length };
-	length = starts_with(search_str, "i16");
-	if (length > 0) return (TokenLookupResult){ .type = TOKEN_I16, .token_length = length };
-	length = starts_with(search_str, "u16");
-	if (length > 0) return (TokenLookupResult){ .type = TOKEN_U16, .token_length = length };
-	length = starts_with(search_str, "i8");
-	if (length > 0) return (TokenLookupResult){ .type = TOKEN_I8, .token_length = length };
-	length = starts_with(search_str, "u8");
-	if (length > 0) return (TokenLookupResult){ .type = TOKEN_U8, .token_length = length };
-	length = starts_with(search_str, "bool");
-	if (length > 0) return (TokenLookupResult){ .type = TOKEN_BOOL, .token_length = length };
-	length = starts_with(search_str, "+");
-	if (length > 0) return (TokenLookupResult){ .type = TOKEN_PLUS, .token_length = length };
-	length = starts_with(search_str, "-");
-	//If the previous token was a minus, this one must be part of a number literal or is invalid
-	if (length > 0 && previous_type != TOKEN_MINUS) return (TokenLookupResult){ .type = TOKEN_MINUS, .token_length = length };
-	length = starts_with(search_str, "*");
-	if (length > 0) return (TokenLookupResult){ .type = TOKEN_STAR, .token_length = length };
-	length = starts_with(search_str, "(");
-	if (length > 0) return (TokenLookupResult){ .type = TOKEN_OPEN_PAREN, .token_length = length };
-	length = starts_with(search_str, ")");
-	if (length > 0) return (TokenLookupResult){ .type = TOKEN_CLOSE_PAREN, .token_length = length };
-	length = starts_with(search_str, ":");
-	if (length > 0) return (TokenLookupResult){ .type = TOKEN_COLON, .token_length = length };
-	length = starts_with(search_str, "{");
-	if (length > 0) return (TokenLookupResult){ .type = TOKEN_OPEN_BRACE, .token_length = length };
-	length = starts_with(search_str, "}");
-	if (length > 0) return (TokenLookupResult){ .type = TOKEN_CLOSE_BRACE, .token_length = length };
-	length = starts_with(search_str, ";");
-	if (length > 0) return (TokenLookupResult){ .type = TOKEN_SEMICOLON, .token_length = length };
-	length = starts_with(search_str, "=");
-	if (length > 0) return (TokenLookupResult){ .type = TOKEN_EQUAL, .token_length = length };
-	length = starts_with(search_str, "<");
-	if (length > 0) return (TokenLookupResult){ .type = TOKEN_CMP_LT, .token_length = length };
-	length = starts_with(search_str, ">");
-	if (length > 0) return (TokenLookupResult){ .type = TOKEN_CMP_GT, .token_length = length };
-	length = starts_with(search_str, "&");
-	if (length > 0) return (TokenLookupResult){ .type = TOKEN_AMP, .token_length = length };
-	length = starts_with(search_str, "[");
-	if (length > 0) return (TokenLookupResult){ .type = TOKEN_OPEN_BRACKET, .token_length = length };
-	length = starts_with(search_str, "]");
-	if (length > 0) return (TokenLookupResult){ .type = TOKEN_CLOSE_BRACKET, .token_length = length };
-	length = starts_with(search_str, ".");
-	if (length > 0) return (TokenLookupResult){ .type = TOKEN_DOT, .token_length = length };
-	length = starts_with(search_str, ",");
-	if (length > 0) return (TokenLookupResult){ .type = TOKEN_COMMA, .token_length = length };
-
-	return (TokenLookupResult){ .type = TOKEN_INVALID };
+#define LOOKUP_RESULT(t, len) (TokenLookupResult){ .type = (t), .token_length = (len) }
+
+//Recognizes keywords, identifiers and operators in a single pass, dispatching on the first byte.
+//Operators use maximal munch, so ">=" is always taken over ">".
+static TokenLookupResult token_type_lookup(const char *search_str, const char *end, TokenType previous_type)
+{
+	if (char_is(*search_str, CC_WORD))
+	{
+		int length = word_length(search_str, end);
+		return LOOKUP_RESULT(keyword_lookup(search_str, length), length);
+	}
+
+	char next = search_str + 1 < end ? search_str[1] : 0;
+	switch (*search_str)
+	{
+	case '@':
+		if (word_length(search_str + 1, end) == 5 && !memcmp(search_str + 1, "array", 5))
+			return LOOKUP_RESULT(TOKEN_ARRAY_DECL, 6);
+		break;
+	case '|':
+		if (next == '|') return LOOKUP_RESULT(TOKEN_LOGIC_OR, 2);
+		break;
+	case '&':
+		if (next == '&') return LOOKUP_RESULT(TOKEN_LOGIC_AND, 2);
+		return LOOKUP_RESULT(TOKEN_AMP, 1);
+	case '>':
+		if (next == '=') return LOOKUP_RESULT(TOKEN_CMP_GE, 2);
+		return LOOKUP_RESULT(TOKEN_CMP_GT, 1);
+	case '<':
+		if (next == '=') return LOOKUP_RESULT(TOKEN_CMP_LE, 2);
+		return LOOKUP_RESULT(TOKEN_CMP_LT, 1);
+	case '!':
+		if (next == '=') return LOOKUP_RESULT(TOKEN_CMP_NEQ, 2);
+		break;
+	case '=':
+		if (next == '=') return LOOKUP_RESULT(TOKEN_CMP_EQ, 2);
+		return LOOKUP_RESULT(TOKEN_EQUAL, 1);
+	case '-':
+		if (next == '>') return LOOKUP_RESULT(TOKEN_ARROW, 2);
+		//If the previous token was a minus, this one must be part of a number literal or is invalid
+		if (previous_type != TOKEN_MINUS) return LOOKUP_RESULT(TOKEN_MINUS, 1);
+		break;
+	case '+': return LOOKUP_RESULT(TOKEN_PLUS, 1);
+	case '*': return LOOKUP_RESULT(TOKEN_STAR, 1);
+	case '(': return LOOKUP_RESULT(TOKEN_OPEN_PAREN, 1);
+	case ')': return LOOKUP_RESULT(TOKEN_CLOSE_PAREN, 1);
+	case ':': return LOOKUP_RESULT(TOKEN_COLON, 1);
+	case '{': return LOOKUP_RESULT(TOKEN_OPEN_BRACE, 1);
+	case '}': return LOOKUP_RESULT(TOKEN_CLOSE_BRACE, 1);
+	case ';': return LOOKUP_RESULT(TOKEN_SEMICOLON, 1);
+	case '[': return LOOKUP_RESULT(TOKEN_OPEN_BRACKET, 1);
+	case ']': return LOOKUP_RESULT(TOKEN_CLOSE_BRACKET, 1);
+	case '.': return LOOKUP_RESULT(TOKEN_DOT, 1);
+	case ',': return LOOKUP_RESULT(TOKEN_COMMA, 1);
+	}
+
+	return LOOKUP_RESULT(TOKEN_INVALID, 0);
 }
 
 typedef struct 
@@ -135,67 +161,81 @@ typedef struct
 	int str_length;
 } ParseIntLiteralResult;
 
-static Token *create_token(const char *token_str, int token_str_len, TokenType type, uint64_t int_literal, bool is_negative)
+typedef enum
+{
+	LEX_TOKEN,
+	LEX_END,
+	LEX_ERROR
+} LexStatus;
+
+//Position of the lexer within a buffer of source text. base[0] is at source offset base_offset.
+typedef struct
 {
-	char *name_str = malloc(token_str_len + 1);
-	memcpy(name_str, token_str, token_str_len);
-	name_str[token_str_len] = 0;
+	const char *data;
+	const char *end;
+	const char *base;
+	uint32_t base_offset;
+	TokenType previous_type;
+} LexState;
 
-	Token *token = malloc(sizeof(Token));
-	*token = (Token)
+//Creates a token that refers to its lexeme in the source. Identifiers are interned by the caller once
+//the token is known to be complete.
+static Token create_token(LexState *state, const char *token_str, int token_str_len, TokenType type, uint64_t int_literal, bool is_negative)
+{
+	return (Token)
 	{
 		.type = type,
-		.name = name_str,
+		.offset = state->base_offset + (uint32_t)(token_str - state->base),
+		.length = token_str_len,
+		.symbol = SYMBOL_INVALID,
 		.int_literal = int_literal,
 		.is_negative = is_negative
 	};
+}
 
-	return token;
+static int digit_value(char c)
+{
+	if (c >= '0' && c <= '9') return c - '0';
+	if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+	return 16;
 }
 
-static ParseIntLiteralResult parse_int_literal(const char *input)
+//Parses decimal, 0x hexadecimal and 0 octal literals the same way strtol does with base 0.
+//The source is not NUL terminated, so strtol cannot be used directly.
+static ParseIntLiteralResult parse_int_literal(const char *input, const char *end)
 {
 	ParseIntLiteralResult result = {0};
-	if (*input == '-')
+	const char *start = input;
+	if (input < end && *input == '-')
 	{
 		result.is_negative = true;
-		result.str_length++;
 		input++;
 	}
-	if (!isdigit(*input))
+	if (input >= end || !char_is(*input, CC_DIGIT))
 		return result;
 
-	char *end;
-	result.int_literal = (uint64_t)strtol(input, &end, 0);
-	result.success = true;
-	result.str_length = end - input;
-	if (result.is_negative)
-		result.str_length++;
-
-	return result;
-}
-
-typedef struct 
-{
-	bool success;
-	int str_length;
-} ParseIdentifierResult;
-
-static ParseIdentifierResult parse_identifier(const char *input)
-{
-	if (*input != '_' && !isalpha(*input))
-		return (ParseIdentifierResult){0};
-
-	ParseIdentifierResult result = { .str_length = 1 };
-	input++;
+	int base = 10;
+	if (*input == '0')
+	{
+		base = 8;
+		if (input + 2 < end && (input[1] == 'x' || input[1] == 'X') && digit_value(input[2]) < 16)
+		{
+			base = 16;
+			input += 2;
+		}
+	}
 
-	while (isalnum(*input) || *input == '_')
+	uint64_t value = 0;
+	while (input < end && digit_value(*input) < base)
 	{
-		result.str_length++;
+		value = value * base + digit_value(*input);
 		input++;
 	}
 
+	result.int_literal = (uint32_t)value;
 	result.success = true;
+	result.str_length = input - start;
 	return result;
 }
 
@@ -205,104 +245,550 @@ typedef struct
 	int str_length;
 } ParseStrLiteralResult;
 
-static ParseStrLiteralResult parse_str_literal(const char *input)
+static ParseStrLiteralResult parse_str_literal(const char *input, const char *end)
 {
 	const char *start = input;
 	if (*input != '"') return (ParseStrLiteralResult){0};
 	input++;
-	if (*input == 0) return (ParseStrLiteralResult){0};
+	if (input >= end) return (ParseStrLiteralResult){0};
 
 	while (1)
 	{
-		if (*input == '"' && *(input - 1) != '\\')
-			return (ParseStrLiteralResult) { .success = true, .str_length = input - start - 1 };
-		if (*input == 0)
+		input = scan_quote(input, end);
+		if (input == end)
 			return (ParseStrLiteralResult){0};
+		if (*(input - 1) != '\\')
+			return (ParseStrLiteralResult) { .success = true, .str_length = input - start - 1 };
 		input++;
 	}
+}
+
+static void skip_space(LexState *state)
+{
+	//Most tokens are separated by at most a space, so check the first byte before scanning
+	if (state->data == state->end || !char_is(*state->data, CC_SPACE))
+		return;
+
+	state->data = scan_space(state->data, state->end);
+}
+
+static LexStatus lex_token(LexState *state, Token *token)
+{
+	skip_space(state);
+
+	const char *filedata = state->data;
+	const char *end = state->end;
+	if (filedata == end)
+		return LEX_END;
+
+	TokenLookupResult result = token_type_lookup(filedata, end, state->previous_type);
+	if (result.type != TOKEN_INVALID)
+	{
+		*token = create_token(state, filedata, result.token_length, result.type, 0, false);
+		state->previous_type = result.type;
+		state->data += result.token_length;
+		return LEX_TOKEN;
+	}
+
+	ParseStrLiteralResult str_result = parse_str_literal(filedata, end);
+	if (str_result.success)
+	{
+		*token = create_token(state, filedata + 1, str_result.str_length, TOKEN_STR_LITERAL, 0, false);
+		state->previous_type = TOKEN_STR_LITERAL;
+		state->data += str_result.str_length + 2;
+		return LEX_TOKEN;
+	}
 
-	return (ParseStrLiteralResult){0};
+	ParseIntLiteralResult int_result = parse_int_literal(filedata, end);
+	if (int_result.success)
+	{
+		*token = create_token(state, filedata, int_result.str_length, TOKEN_INT, int_result.int_literal, int_result.is_negative);
+		state->previous_type = TOKEN_INT;
+		state->data += int_result.str_length;
+		return LEX_TOKEN;
+	}
+
+	return LEX_ERROR;
 }
 
-static bool take_token(const char *filedata, Vector *tokens)
+static bool take_token(TokenList *list)
 {
-	TokenType previous_type = TOKEN_INVALID;
-	int line = 1;
-	int col = 1;
+	LexState state = (LexState)
+	{
+		.data = list->source,
+		.end = list->source + list->source_length,
+		.base = list->source
+	};
 
 	while (1)
 	{
-		while (isspace(*filedata))
+		Token token;
+		LexStatus status = lex_token(&state, &token);
+		if (status != LEX_TOKEN)
+			return status == LEX_END;
+
+		if (token.type == TOKEN_IDENTIFIER)
+			token.symbol = symbol_intern(&list->symbols, list->source + token.offset, token.length);
+		token_vector_push(&list->tokens, token);
+	}
+}
+
+//Sources smaller than this are always lexed on the calling thread. The threads parallel_for starts for
+//each call cost tens of microseconds each, which is small next to lexing a megabyte.
+#define PARALLEL_LEX_MIN_SIZE (1 << 20)
+
+typedef struct
+{
+	const char *source;
+	const char *start;
+	const char *end;
+	TokenVector tokens;
+	SymbolTable symbols;
+	bool success;
+} LexChunk;
+
+//Lexes one chunk as if it were the start of a file. Identifiers are interned into the chunk's own
+//symbol table; take_token_parallel maps them onto the list's table afterwards.
+static void lex_chunk(void *context, int index)
+{
+	LexChunk *chunk = &((LexChunk *)context)[index];
+	LexState state = (LexState)
+	{
+		.data = chunk->start,
+		.end = chunk->end,
+		.base = chunk->source
+	};
+
+	while (1)
+	{
+		Token token;
+		LexStatus status = lex_token(&state, &token);
+		if (status != LEX_TOKEN)
 		{
-			if (*filedata == '\n')
+			chunk->success = status == LEX_END;
+			return;
+		}
+
+		if (token.type == TOKEN_IDENTIFIER)
+			token.symbol = symbol_intern(&chunk->symbols, chunk->source + token.offset, token.length);
+		token_vector_push(&chunk->tokens, token);
+	}
+}
+
+//Picks up to chunk_count chunk starts, roughly evenly spaced. Every chunk after the first starts right after
+//a newline that is outside of any string literal, and the chunk does not begin with '-' (whose meaning depends
+//on the previous token), so lexing each chunk on its own gives the same tokens as lexing the whole source.
+static int find_chunk_starts(const char *source, const char *end, int chunk_count, const char **starts)
+{
+	int count = 1;
+	starts[0] = source;
+	const char *data = source;
+	const char *next_quote = scan_quote(source, end);
+
+	for (int i = 1; i < chunk_count; i++)
+	{
+		const char *target = source + (end - source) / chunk_count * i;
+		if (target > data) data = target;
+
+		while (1)
+		{
+			//Skip every string literal that opens before data, moving data past it if it is still open there
+			while (next_quote < data)
 			{
-				line++;
-				col = 0;
+				ParseStrLiteralResult str_result = parse_str_literal(next_quote, end);
+				if (!str_result.success) return count;
+				const char *close = next_quote + str_result.str_length + 2;
+				if (close > data) data = close;
+				next_quote = scan_quote(close, end);
 			}
 
-			col++;
-			filedata++;
+			const char *newline = memchr(data, '\n', end - data);
+			if (!newline) return count;
+			if (next_quote < newline)
+			{
+				data = next_quote + 1;
+				continue;
+			}
+
+			data = newline + 1;
+			const char *first = scan_space(data, end);
+			if (first == end) return count;
+			if (*first == '-') continue;
+
+			starts[count++] = data;
+			break;
 		}
+	}
+
+	return count;
+}
+
+//Lexes large sources in chunks on every available thread. Produces exactly the tokens, symbols and
+//result of take_token, including the partial token list when the source contains an error.
+static bool take_token_parallel(TokenList *list, int thread_count)
+{
+	const char *end = list->source + list->source_length;
+	const char **starts = mem_alloc(sizeof(char *) * thread_count);
+	int chunk_count = find_chunk_starts(list->source, end, thread_count, starts);
 
-		TokenLookupResult result = token_type_lookup(filedata, previous_type);
-		if (result.type != TOKEN_INVALID)
+	LexChunk *chunks = mem_alloc(sizeof(LexChunk) * chunk_count);
+	for (int i = 0; i < chunk_count; i++)
+	{
+		chunks[i] = (LexChunk)
 		{
-			previous_type = result.type;
-			Token *token = create_token(filedata, result.token_length, result.type, 0, false);
-			token->line = line;
-			token->column = col;
-			col += strlen(token->name);
-			vec_push(Token*, tokens, &token);
-			filedata += result.token_length;
-			continue;
-		}
+			.source = list->source,
+			.start = starts[i],
+			.end = i + 1 < chunk_count ? starts[i + 1] : end,
+			.tokens = token_vector_create(256),
+			.symbols = symbol_table_create()
+		};
+	}
+	mem_free(starts);
+
+	parallel_for(chunk_count, lex_chunk, chunks);
+
+	//Chunks after the first failed one are discarded, just like the serial lexer stops at the error
+	int used_chunks = 0;
+	int token_count = list->tokens.size;
+	bool success = true;
+	while (used_chunks < chunk_count && success)
+	{
+		token_count += chunks[used_chunks].tokens.size;
+		success = chunks[used_chunks].success;
+		used_chunks++;
+	}
+
+	token_vector_reserve(&list->tokens, token_count);
 
-		ParseStrLiteralResult str_result = parse_str_literal(filedata);
-		if (str_result.success)
+	for (int i = 0; i < chunk_count; i++)
+	{
+		LexChunk *chunk = &chunks[i];
+		if (i < used_chunks)
 		{
-			previous_type = TOKEN_STR_LITERAL;
-			Token *token = create_token(filedata + 1, str_result.str_length, TOKEN_STR_LITERAL, 0, false);
-			token->line = line;
-			token->column = col;
-			col += strlen(token->name);
-			vec_push(Token*, tokens, &token);
-			filedata += str_result.str_length + 2;
-			continue;
+			//Interning each chunk's symbols in chunk order assigns the same ids as the serial lexer
+			SymbolId *symbol_map = mem_alloc(sizeof(SymbolId) * (chunk->symbols.symbols.size + 1));
+			for (int id = 0; id < chunk->symbols.symbols.size; id++)
+			{
+				Symbol *symbol = &chunk->symbols.symbols.data[id];
+				symbol_map[id] = symbol_intern(&list->symbols, symbol->name, symbol->length);
+			}
+
+			Token *tokens = &list->tokens.data[list->tokens.size];
+			token_vector_append(&list->tokens, chunk->tokens.data, chunk->tokens.size);
+			for (int t = 0; t < chunk->tokens.size; t++)
+			{
+				if (tokens[t].symbol != SYMBOL_INVALID)
+					tokens[t].symbol = symbol_map[tokens[t].symbol];
+			}
+			mem_free(symbol_map);
 		}
 
-		ParseIntLiteralResult int_result = parse_int_literal(filedata);
-		if (int_result.success)
+		token_vector_free(&chunk->tokens);
+		symbol_table_free(&chunk->symbols);
+	}
+
+	mem_free(chunks);
+	return success;
+}
+
+//Appends the offset of the line that starts after every newline in [data, end). data is at source offset base_offset.
+static void find_line_starts(OffsetVector *line_starts, const char *data, const char *end, uint32_t base_offset)
+{
+	const char *start = data;
+	while ((data = scan_newline(data, end)) != end)
+	{
+		data++;
+		offset_vector_push(line_starts, base_offset + (uint32_t)(data - start));
+	}
+}
+
+static SourceLocation find_location(OffsetVector *line_starts, uint32_t offset)
+{
+	//Last line that starts at or before offset. The first line always starts at 0.
+	int low = 0;
+	int high = line_starts->size - 1;
+	while (low < high)
+	{
+		int mid = (low + high + 1) / 2;
+		if (line_starts->data[mid] <= offset)
+			low = mid;
+		else
+			high = mid - 1;
+	}
+
+	return (SourceLocation)
+	{
+		.line = low + 1,
+		.column = offset - line_starts->data[low] + 1
+	};
+}
+
+//Where the token starts in the source. A string literal starts at its opening quote.
+static uint32_t token_source_offset(Token *token)
+{
+	return token->offset - (token->type == TOKEN_STR_LITERAL ? 1 : 0);
+}
+
+TokenList token_list_create()
+{
+	return (TokenList)
+	{
+		.tokens = token_vector_create(256),
+		.symbols = symbol_table_create()
+	};
+}
+
+void token_list_free(TokenList *list)
+{
+	if (list->source_mapped)
+		file_unmap(list->source, list->source_length);
+	else
+		mem_free((char *)list->source);
+	token_vector_free(&list->tokens);
+	offset_vector_free(&list->line_starts);
+	symbol_table_free(&list->symbols);
+}
+
+//Shift still pending from token_list_edit for a token in the list
+static int32_t pending_shift(TokenList *list, Token *token)
+{
+	int index = token - (Token *)list->tokens.data;
+	return index >= list->shift_start && index < list->tokens.size ? list->shift_offset : 0;
+}
+
+//Offset of a token in the list, including any pending shift
+static uint32_t token_offset(TokenList *list, Token *token)
+{
+	return token->offset + pending_shift(list, token);
+}
+
+const char *token_text(TokenList *list, Token *token)
+{
+	return list->source + token_offset(list, token);
+}
+
+char *token_copy_text(TokenList *list, Token *token)
+{
+	char *text = malloc(token->length + 1);
+	memcpy(text, token_text(list, token), token->length);
+	text[token->length] = 0;
+	return text;
+}
+
+SourceLocation token_location(TokenList *list, Token *token)
+{
+	if (list->line_starts.size == 0)
+	{
+		offset_vector_push(&list->line_starts, 0);
+		find_line_starts(&list->line_starts, list->source, list->source + list->source_length, 0);
+	}
+
+	return find_location(&list->line_starts, token_source_offset(token) + pending_shift(list, token));
+}
+
+//Source range covered by the token at index. String literals include their quotes.
+static uint32_t token_start(TokenList *list, int index)
+{
+	Token *token = &list->tokens.data[index];
+	return token_source_offset(token) + pending_shift(list, token);
+}
+
+static uint32_t token_end(TokenList *list, int index)
+{
+	Token *token = &list->tokens.data[index];
+	return token_offset(list, token) + token->length + (token->type == TOKEN_STR_LITERAL ? 1 : 0);
+}
+
+static void shift_tokens(TokenList *list, int from, int to, int offset_shift)
+{
+	for (int i = from; i < to; i++)
+		list->tokens.data[i].offset += offset_shift;
+}
+
+void token_list_settle(TokenList *list)
+{
+	if (list->shift_start < list->tokens.size)
+		shift_tokens(list, list->shift_start, list->tokens.size, list->shift_offset);
+	list->shift_start = 0;
+	list->shift_offset = 0;
+}
+
+//Replaces old_length bytes of the source at start with new_text, moving the source to the heap if it is mapped
+static void edit_source(TokenList *list, uint32_t start, uint32_t old_length, const char *new_text, uint32_t new_length)
+{
+	uint32_t length = list->source_length - old_length + new_length;
+	char *buffer = (char *)list->source;
+	if (list->source_mapped)
+	{
+		buffer = mem_alloc(length > list->source_length ? length : list->source_length);
+		memcpy(buffer, list->source, list->source_length);
+		file_unmap(list->source, list->source_length);
+		list->source_mapped = false;
+	}
+	else if (length > list->source_length)
+	{
+		buffer = mem_realloc(buffer, length);
+	}
+	memmove(buffer + start + new_length, buffer + start + old_length, list->source_length - start - old_length);
+	memcpy(buffer + start, new_text, new_length);
+
+	list->source = buffer;
+	list->source_length = length;
+}
+
+bool token_list_edit(TokenList *list, uint32_t start, uint32_t old_length, const char *new_text, uint32_t new_length)
+{
+	if (start > list->source_length || old_length > list->source_length - start)
+		return false;
+	if ((uint64_t)list->source_length - old_length + new_length > UINT32_MAX)
+		return false;
+
+	int token_count = list->tokens.size;
+	int32_t delta = (int32_t)new_length - (int32_t)old_length;
+
+	//Find the first token that ends at or after the edit. Lexing restarts one token before it, so the
+	//lexer always starts at a token whose previous token is known, or at the start
+	//of the source when the edit comes before the second token.
+	int low = 0;
+	int high = token_count;
+	while (low < high)
+	{
+		int mid = (low + high) / 2;
+		if (token_end(list, mid) < start)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	int first = low > 0 ? low - 1 : 0;
+
+	LexState state = {0};
+	uint32_t restart_offset = 0;
+	if (low > 0)
+	{
+		restart_offset = token_start(list, first);
+		state.previous_type = first > 0 ? list->tokens.data[first - 1].type : TOKEN_INVALID;
+	}
+
+	//The first old token that starts after the edited bytes is where resynchronization can begin
+	int old_index = first;
+	while (old_index < token_count && token_start(list, old_index) < start + old_length)
+		old_index++;
+
+	edit_source(list, start, old_length, new_text, new_length);
+	state.base = list->source;
+	state.data = list->source + restart_offset;
+	state.end = list->source + list->source_length;
+
+	//Lex until a new token lines up with an old one: same position (after the edit), type, length and
+	//previous token. Every old token from there on would be lexed identically.
+	TokenVector new_tokens = token_vector_create(16);
+	bool success = true;
+	bool resynced = false;
+	while (1)
+	{
+		TokenType previous_type = state.previous_type;
+		Token token;
+		LexStatus status = lex_token(&state, &token);
+		if (status != LEX_TOKEN)
 		{
-			previous_type = TOKEN_INT;
-			Token *token = create_token(filedata, int_result.str_length, TOKEN_INT, int_result.int_literal, int_result.is_negative);
-			token->line = line;
-			token->column = col;
-			col += strlen(token->name);
-			vec_push(Token*, tokens, &token);
-			filedata += int_result.str_length;
-			continue;
+			success = status == LEX_END;
+			old_index = token_count;
+			break;
 		}
 
-		ParseIdentifierResult id_result = parse_identifier(filedata);
-		if (id_result.success)
+		uint32_t token_source_start = token_source_offset(&token);
+		if (token_source_start >= start + new_length)
 		{
-			previous_type = TOKEN_IDENTIFIER;
-			Token *token = create_token(filedata, id_result.str_length, TOKEN_IDENTIFIER, 0, false);
-			token->line = line;
-			token->column = col;
-			col += strlen(token->name);
-			vec_push(Token*, tokens, &token);
-			filedata += id_result.str_length;
-			continue;
+			while (old_index < token_count && token_start(list, old_index) + delta < token_source_start)
+				old_index++;
+
+			if (old_index < token_count && token_start(list, old_index) + delta == token_source_start)
+			{
+				Token *old = &list->tokens.data[old_index];
+				TokenType old_previous_type = old_index > 0 ? list->tokens.data[old_index - 1].type : TOKEN_INVALID;
+				if (old->type == token.type && old->length == token.length && old_previous_type == previous_type)
+				{
+					resynced = true;
+					break;
+				}
+			}
 		}
 
+		if (token.type == TOKEN_IDENTIFIER)
+			token.symbol = symbol_intern(&list->symbols, list->source + token.offset, token.length);
+		token_vector_push(&new_tokens, token);
+	}
+
+	//Tokens [first, old_index) are replaced by new_tokens. Only the tokens between this edit and the previous
+	//pending shift are updated now; everything after the splice keeps a single combined pending shift.
+	int removed = old_index - first;
+	int size_change = new_tokens.size - removed;
+	int shift_start = list->shift_start;
+
+	if (shift_start < first)
+	{
+		shift_tokens(list, shift_start, first, list->shift_offset);
+		shift_start = old_index;
+	}
+	if (resynced && shift_start > old_index)
+		shift_tokens(list, old_index, shift_start < token_count ? shift_start : token_count, delta);
+	if (shift_start < old_index)
+		shift_start = old_index;
+
+	int new_size = token_count + size_change;
+	if (new_size > list->tokens.capacity)
+		token_vector_grow(&list->tokens, new_size);
+
+	Token *tokens = list->tokens.data;
+	memmove(tokens + first + new_tokens.size, tokens + old_index, sizeof(Token) * (token_count - old_index));
+	memcpy(tokens + first, new_tokens.data, sizeof(Token) * new_tokens.size);
+	list->tokens.size = new_size;
+	token_vector_free(&new_tokens);
+
+	//Tokens past the resync point are unchanged, including a lexing error after them
+	if (resynced)
+		success = !list->failed;
+	list->failed = !success;
+
+	if (resynced)
+	{
+		list->shift_start = shift_start + size_change;
+		list->shift_offset += delta;
+	}
+	else
+	{
+		list->shift_start = 0;
+		list->shift_offset = 0;
+	}
+	//The line table is rebuilt on the next token_location call
+	list->line_starts.size = 0;
+
+	return success;
+}
+
+//Reads the whole file into a heap buffer. Used when the file cannot be mapped.
+static bool read_source(FILE *file, TokenList *list, long file_length)
+{
+	char *buffer = mem_alloc(file_length);
+	long bytes_read = fread(buffer, sizeof(char), file_length, file);
+	if (bytes_read != file_length)
+	{
+		mem_free(buffer);
 		return false;
 	}
 
+	list->source = buffer;
+	list->source_length = file_length;
+	list->source_mapped = false;
 	return true;
 }
 
-bool tokenize_file(const char *filepath, Vector *tokens)
+bool tokenize_file(const char *filepath, TokenList *list)
+{
+	return tokenize_file_threads(filepath, list, parallel_thread_count());
+}
+
+bool tokenize_file_threads(const char *filepath, TokenList *list, int thread_count)
 {
 	FILE *file = fopen(filepath, "rb");
 	if (!file)
@@ -318,22 +804,241 @@ bool tokenize_file(const char *filepath, Vector *tokens)
 	if (file_length == 0)
 	{
 		fclose(file);
-		return;
+		return true;
 	}
 
-	char *buffer = malloc(sizeof(char) * file_length + 1);
-	long bytes_read = fread(buffer, sizeof(char), file_length, file);
-	buffer[file_length] = 0;
+	if ((uint64_t)file_length > UINT32_MAX)
+	{
+		fclose(file);
+		printf("File %s is too large", filepath);
+		return false;
+	}
 
-	if (bytes_read != file_length)
+	list->source = file_map(file, file_length);
+	list->source_length = file_length;
+	list->source_mapped = list->source != NULL;
+
+	if (!list->source_mapped && !read_source(file, list, file_length))
 	{
 		fclose(file);
-		free(buffer);
 		printf("Failed to read file %s", filepath);
 		return false;
 	}
 
 	fclose(file);
 
-	return take_token(buffer, tokens);
+	if (list->source_length >= PARALLEL_LEX_MIN_SIZE && thread_count > 1)
+		list->failed = !take_token_parallel(list, thread_count);
+	else
+		list->failed = !take_token(list);
+	return !list->failed;
+}
+
+#define LEXER_CHUNK_SIZE 65536
+//Bytes after a token the lexer may look at to decide where it ends, e.g. "0x" needs one more digit to be hexadecimal
+#define LEXER_TOKEN_SLACK 2
+
+struct Lexer
+{
+	FILE *file;
+	SymbolTable *symbols;
+	char *buffer;
+	int buffer_capacity;
+	LexState state;
+	bool eof;
+	bool failed;
+	//Newlines are counted up to counted_offset as the input goes by, so only the start of the current line
+	//is remembered
+	uint32_t counted_offset;
+	int line;
+	uint32_t line_start;
+	//Ring buffer of tokens that have been lexed but not consumed, and where each of them starts
+	Token lookahead[LEXER_LOOKAHEAD];
+	SourceLocation lookahead_locations[LEXER_LOOKAHEAD];
+	int lookahead_start;
+	int lookahead_count;
+	//Start and location of the token lexer_next returned last
+	uint32_t last_offset;
+	SourceLocation last_location;
+};
+
+Lexer *lexer_open(const char *filepath, SymbolTable *symbols)
+{
+	FILE *file = fopen(filepath, "rb");
+	if (!file)
+	{
+		printf("Failed to open %s", filepath);
+		return NULL;
+	}
+
+	Lexer *lexer = mem_alloc(sizeof(Lexer));
+	*lexer = (Lexer)
+	{
+		.file = file,
+		.symbols = symbols,
+		.buffer = mem_alloc(LEXER_CHUNK_SIZE),
+		.buffer_capacity = LEXER_CHUNK_SIZE,
+		.line = 1,
+		.last_offset = UINT32_MAX
+	};
+	lexer->state.data = lexer->state.end = lexer->state.base = lexer->buffer;
+
+	return lexer;
+}
+
+void lexer_close(Lexer *lexer)
+{
+	fclose(lexer->file);
+	mem_free(lexer->buffer);
+	mem_free(lexer);
+}
+
+bool lexer_failed(Lexer *lexer)
+{
+	return lexer->failed;
+}
+
+//Counts the newlines from counted_offset up to offset. Those bytes must still be in the buffer.
+static void lexer_count_lines(Lexer *lexer, uint32_t offset)
+{
+	const char *data = lexer->buffer + (lexer->counted_offset - lexer->state.base_offset);
+	const char *end = lexer->buffer + (offset - lexer->state.base_offset);
+	while ((data = scan_newline(data, end)) != end)
+	{
+		data++;
+		lexer->line++;
+		lexer->line_start = lexer->state.base_offset + (uint32_t)(data - lexer->buffer);
+	}
+	lexer->counted_offset = offset;
+}
+
+//Moves the bytes that are still needed to the front of the buffer and reads the next chunk after them. Those are
+//the bytes that have not been lexed yet and the text of the tokens the lexer can still hand out: the one
+//lexer_next returned last and the ones in the lookahead. The buffer only grows when they fill all of it.
+static void lexer_refill(Lexer *lexer)
+{
+	LexState *state = &lexer->state;
+	const char *keep = state->data;
+	if (lexer->last_offset != UINT32_MAX)
+		keep = lexer->buffer + (lexer->last_offset - state->base_offset);
+	else if (lexer->lookahead_count > 0)
+		keep = lexer->buffer + (token_source_offset(&lexer->lookahead[lexer->lookahead_start]) - state->base_offset);
+	int remaining = state->end - keep;
+	int data_position = state->data - keep;
+
+	//The bytes before keep are dropped and the lines are counted up to data, which is not before keep
+	lexer_count_lines(lexer, state->base_offset + (uint32_t)(state->data - lexer->buffer));
+	memmove(lexer->buffer, keep, remaining);
+	state->base_offset += keep - lexer->buffer;
+
+	if (remaining == lexer->buffer_capacity)
+	{
+		lexer->buffer_capacity *= 2;
+		lexer->buffer = mem_realloc(lexer->buffer, lexer->buffer_capacity);
+	}
+
+	int requested = lexer->buffer_capacity - remaining;
+	int bytes_read = fread(lexer->buffer + remaining, sizeof(char), requested, lexer->file);
+	if (bytes_read < requested)
+		lexer->eof = true;
+
+	state->base = lexer->buffer;
+	state->data = lexer->buffer + data_position;
+	state->end = lexer->buffer + remaining + bytes_read;
+}
+
+//Lexes one more token into the lookahead ring. Returns false at the end of the input or on an error.
+static bool lexer_fill(Lexer *lexer)
+{
+	if (lexer->failed)
+		return false;
+
+	while (1)
+	{
+		skip_space(&lexer->state);
+		if (lexer->state.data == lexer->state.end && !lexer->eof)
+		{
+			lexer_refill(lexer);
+			continue;
+		}
+
+		LexState saved_state = lexer->state;
+		Token token;
+		LexStatus status = lex_token(&lexer->state, &token);
+
+		//A token that ends close to the end of the buffer may continue in the next chunk, so it is lexed again
+		if (!lexer->eof && (status != LEX_TOKEN || lexer->state.end - lexer->state.data < LEXER_TOKEN_SLACK))
+		{
+			lexer->state = saved_state;
+			lexer_refill(lexer);
+			continue;
+		}
+
+		if (status == LEX_ERROR)
+			lexer->failed = true;
+		if (status != LEX_TOKEN)
+			return false;
+
+		if (token.type == TOKEN_IDENTIFIER)
+			token.symbol = symbol_intern(lexer->symbols, lexer->state.data - token.length, token.length);
+
+		uint32_t offset = token_source_offset(&token);
+		lexer_count_lines(lexer, offset);
+		int slot = (lexer->lookahead_start + lexer->lookahead_count) % LEXER_LOOKAHEAD;
+		lexer->lookahead[slot] = token;
+		lexer->lookahead_locations[slot] = (SourceLocation){ .line = lexer->line, .column = offset - lexer->line_start + 1 };
+		lexer->lookahead_count++;
+		return true;
+	}
+}
+
+Token *lexer_peek(Lexer *lexer, int k)
+{
+	assert(k < LEXER_LOOKAHEAD);
+
+	while (lexer->lookahead_count <= k)
+	{
+		if (!lexer_fill(lexer))
+			return NULL;
+	}
+
+	return &lexer->lookahead[(lexer->lookahead_start + k) % LEXER_LOOKAHEAD];
+}
+
+const char *lexer_token_text(Lexer *lexer, Token *token)
+{
+	assert(token_source_offset(token) >= lexer->state.base_offset);
+	return lexer->buffer + (token->offset - lexer->state.base_offset);
+}
+
+SourceLocation lexer_location(Lexer *lexer, Token *token)
+{
+	uint32_t offset = token_source_offset(token);
+	if (offset == lexer->last_offset)
+		return lexer->last_location;
+
+	for (int i = 0; i < lexer->lookahead_count; i++)
+	{
+		int slot = (lexer->lookahead_start + i) % LEXER_LOOKAHEAD;
+		if (lexer->lookahead[slot].offset == token->offset)
+			return lexer->lookahead_locations[slot];
+	}
+
+	//Only the tokens the lexer still holds can be located
+	assert(false);
+	return (SourceLocation){0};
+}
+
+Token lexer_next(Lexer *lexer)
+{
+	Token *token = lexer_peek(lexer, 0);
+	if (!token)
+		return (Token){ .type = TOKEN_INVALID };
+
+	Token result = *token;
+	lexer->last_offset = token_source_offset(token);
+	lexer->last_location = lexer->lookahead_locations[lexer->lookahead_start];
+	lexer->lookahead_start = (lexer->lookahead_start + 1) % LEXER_LOOKAHEAD;
+	lexer->lookahead_count--;
+	return result;
 }
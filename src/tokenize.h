@@ -2,6 +2,7 @@
 #define TOKENIZE_H
 
 #include "list.h"
+#include "symbol.h"
 #include <stdbool.h>
 #include <stdint.h>
 
@@ -53,19 +54,95 @@ typedef enum
 	TOKEN_TRUE,
 	TOKEN_FALSE,
 	TOKEN_CONTINUE,
-	TOKEN_STR_LITERAL
+	TOKEN_STR_LITERAL,
+	//Number of token types, for tables indexed by TokenType
+	TOKEN_TYPE_COUNT
 } TokenType;
 
 typedef struct
 {
-	const char *name;
 	uint64_t int_literal;
+	//The lexeme is the slice [offset, offset + length) of the source. String literals exclude their quotes.
+	uint32_t offset;
+	uint32_t length;
+	//Interned name of identifiers. SYMBOL_INVALID for every other token.
+	SymbolId symbol;
 	TokenType type;
-	int line;
-	int column;
 	bool is_negative;
 } Token;
 
-extern bool tokenize_file(const char *filepath, Vector *tokens);
+//1-based line and column of a token. Columns count bytes from the start of the line.
+typedef struct
+{
+	int line;
+	int column;
+} SourceLocation;
+
+VECTOR_DEFINE(TokenVector, token_vector, Token)
+VECTOR_DEFINE(OffsetVector, offset_vector, uint32_t)
+
+//Tokens only store their byte offset. Lines and columns are looked up in a table of line start offsets,
+//which is built the first time token_location needs it.
+//Tokens are stored by value in one contiguous vector. Code that needs to hold on to a token
+//keeps its index into tokens rather than a pointer.
+//The source is either mapped read-only or, if mapping fails, read into a heap buffer. It is not NUL terminated.
+typedef struct
+{
+	TokenVector tokens;
+	SymbolTable symbols;
+	const char *source;
+	uint32_t source_length;
+	bool source_mapped;
+	//Set when lexing stopped at an invalid token; tokens holds everything before it
+	bool failed;
+	//Offset of the first byte of every line, in order. Empty until token_location is first called.
+	OffsetVector line_starts;
+	//Offset shift left pending by token_list_edit for tokens at index shift_start and later
+	int shift_start;
+	int32_t shift_offset;
+} TokenList;
+
+extern TokenList token_list_create();
+extern void token_list_free(TokenList *list);
+//Returns the start of the token's lexeme. The text is token->length bytes long and is not NUL terminated.
+extern const char *token_text(TokenList *list, Token *token);
+//Returns a NUL terminated copy of the token's lexeme that the caller must free.
+extern char *token_copy_text(TokenList *list, Token *token);
+//Finds the line and column of a token by binary search over the line starts
+extern SourceLocation token_location(TokenList *list, Token *token);
+extern bool tokenize_file(const char *filepath, TokenList *list);
+//tokenize_file with the source split into thread_count chunks instead of one per hardware thread.
+//Sources below 1 MB and a thread_count of 1 are lexed serially.
+extern bool tokenize_file_threads(const char *filepath, TokenList *list, int thread_count);
+//Replaces old_length bytes of the source at start with new_text and re-lexes only the tokens around the
+//edit, until the new tokens line up with the old ones again. Returns what tokenize_file would return for
+//the edited source. The offsets of the tokens after the edit are shifted lazily, so they are stale until
+//token_list_settle is called. token_text and token_location always account for the pending shift.
+//Only the relexing is bounded by the edit. The bytes of the source after it and the tokens after the
+//relexed ones are still moved, and the line table is rebuilt on the next token_location call, so an edit
+//takes time linear in the size of the file.
+extern bool token_list_edit(TokenList *list, uint32_t start, uint32_t old_length, const char *new_text, uint32_t new_length);
+extern void token_list_settle(TokenList *list);
+
+//Streaming lexer. Reads the file in fixed size chunks and keeps at most LEXER_LOOKAHEAD tokens, and counts
+//lines as it reads instead of storing where they start, so its memory use does not depend on the size of
+//the input. Identifiers are interned into symbols, which only grow with the number of distinct names.
+#define LEXER_LOOKAHEAD 16
+typedef struct Lexer Lexer;
+
+extern Lexer *lexer_open(const char *filepath, SymbolTable *symbols);
+extern void lexer_close(Lexer *lexer);
+//Returns the token k positions ahead without consuming it, or NULL if the input ends first.
+//k must be less than LEXER_LOOKAHEAD. The pointer is valid until the next call to lexer_next.
+extern Token *lexer_peek(Lexer *lexer, int k);
+//Consumes the next token. Returns a TOKEN_INVALID token at the end of the input.
+extern Token lexer_next(Lexer *lexer);
+//True if lexing stopped because of invalid input rather than the end of the file
+extern bool lexer_failed(Lexer *lexer);
+//Line and column of the token lexer_next returned last or of a token still in the lookahead
+extern SourceLocation lexer_location(Lexer *lexer, Token *token);
+//Lexeme of the token lexer_next returned last or of a token still in the lookahead, token->length bytes long
+//and not NUL terminated. The pointer is valid until the next call to lexer_peek or lexer_next.
+extern const char *lexer_token_text(Lexer *lexer, Token *token);
 
 #endif
@@ -0,0 +1,185 @@
+/*
+	Copy propagation and dead code elimination test.
+
+	Compiles small functions, runs ir_optimize on them and counts the copies, defines, arithmetic and
+	address-of instructions left in the last function of each. A copy of a parameter must be propagated
+	unless the parameter is assigned again after it, a counter that only feeds itself must be removed with
+	its loop left in place, and every assignment to a variable whose address is taken must survive, even
+	once the pointer itself is removed. Build and run from the repository root on Linux:
+
+		cc -O2 -Isrc -o copy_dce tests/copy_dce.c $(find src -name '*.c' ! -name main.c) -lpthread
+		./copy_dce
+
+	Exits with 0 if every function was left with the expected instructions.
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "tokenize.h"
+#include "ast.h"
+#include "compiler.h"
+#include "opt.h"
+#include "arena.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+typedef struct
+{
+	int copies;
+	int defines;
+	int arithmetic;
+	int addrofs;
+} InstCounts;
+
+typedef struct
+{
+	const char *name;
+	const char *source;
+	InstCounts expected;
+} OptCase;
+
+static const OptCase cases[] =
+{
+	{
+		"copy of a parameter",
+		"u8 f(u8 a)\n"
+		"{\n"
+		"	u8 b = a;\n"
+		"	u8 c = b + 1;\n"
+		"	return c;\n"
+		"}\n",
+		{ .copies = 0, .defines = 1, .arithmetic = 1, .addrofs = 0 }
+	},
+	{
+		"copy of a parameter that is assigned again",
+		"u8 f(u8 a)\n"
+		"{\n"
+		"	u8 b = a;\n"
+		"	a = a + 1;\n"
+		"	return b + a;\n"
+		"}\n",
+		{ .copies = 2, .defines = 1, .arithmetic = 2, .addrofs = 0 }
+	},
+	{
+		"counter that nothing reads",
+		"u8 f(u8 a)\n"
+		"{\n"
+		"	u8 n = 0;\n"
+		"	while (a < 10) { a = a + 1; n = n + 2; }\n"
+		"	return a;\n"
+		"}\n",
+		{ .copies = 1, .defines = 2, .arithmetic = 1, .addrofs = 0 }
+	},
+	{
+		"variable whose address is passed on",
+		"void g(u8* p)\n"
+		"{\n"
+		"	*p = 4;\n"
+		"}\n"
+		"u8 f(u8 a)\n"
+		"{\n"
+		"	u8 x = 1;\n"
+		"	u8* p = &x;\n"
+		"	g(p);\n"
+		"	return a;\n"
+		"}\n",
+		{ .copies = 0, .defines = 1, .arithmetic = 0, .addrofs = 1 }
+	},
+	{
+		"variable whose address is taken but not used",
+		"u8 f(u8 a)\n"
+		"{\n"
+		"	u8 x = 1;\n"
+		"	u8* p = &x;\n"
+		"	x = 2;\n"
+		"	return a;\n"
+		"}\n",
+		{ .copies = 0, .defines = 2, .arithmetic = 0, .addrofs = 0 }
+	},
+	{
+		"copy of a parameter into a variable whose address is taken",
+		"void g(u8* p)\n"
+		"{\n"
+		"	*p = 4;\n"
+		"}\n"
+		"u8 f(u8 a)\n"
+		"{\n"
+		"	u8 x = a;\n"
+		"	u8* p = &x;\n"
+		"	g(p);\n"
+		"	return x;\n"
+		"}\n",
+		{ .copies = 1, .defines = 0, .arithmetic = 0, .addrofs = 1 }
+	},
+};
+
+static InstCounts count_insts(struct IrFunction *function)
+{
+	InstCounts counts = {0};
+	struct IrInstBuffer *insts = &function->insts;
+	for (IrInstIndex i = insts->first; i != IR_INST_INDEX_NONE; i = insts->next[i])
+	{
+		enum IrInstType opcode = insts->opcodes[i];
+		counts.copies += opcode == IRINST_COPY;
+		counts.defines += opcode == IRINST_DEFINE;
+		counts.arithmetic += opcode == IRINST_ADD || opcode == IRINST_SUB || opcode == IRINST_MUL;
+		counts.addrofs += opcode == IRINST_ADDROF;
+	}
+	return counts;
+}
+
+static bool check_case(const OptCase *test)
+{
+	char path[] = "/tmp/copy_dce_XXXXXX";
+	int fd = mkstemp(path);
+	FILE *file = fd < 0 ? NULL : fdopen(fd, "wb");
+	if (!file)
+	{
+		printf("%s: failed to write source\n", test->name);
+		return false;
+	}
+	fputs(test->source, file);
+	fclose(file);
+
+	TokenList list = token_list_create();
+	tokenize_file(path, &list);
+	AstUnit unit;
+	ast_parse_unit(&list, &unit);
+	Arena arena = arena_create(0);
+	struct CompilerContext ctx = compiler_create_context(&arena);
+
+	bool passed = compile_unit(&ctx, &unit);
+	if (passed)
+	{
+		ir_optimize(&ctx.ir_context);
+		InstCounts counts = count_insts(&ctx.ir_context.functions.data[ctx.ir_context.functions.size - 1]);
+		InstCounts expected = test->expected;
+		passed = counts.copies == expected.copies && counts.defines == expected.defines &&
+			counts.arithmetic == expected.arithmetic && counts.addrofs == expected.addrofs;
+		printf("%s: %d copies, %d defines, %d arithmetic, %d addrof%s\n", test->name, counts.copies, counts.defines,
+			counts.arithmetic, counts.addrofs, passed ? "" : " (WRONG)");
+		if (!passed)
+			ir_print_context(&ctx.ir_context, stdout);
+	}
+	else
+	{
+		printf("%s: failed to compile\n", test->name);
+	}
+
+	compiler_free_context(&ctx);
+	ast_unit_free(&unit);
+	arena_free(&arena);
+	token_list_free(&list);
+	remove(path);
+	return passed;
+}
+
+int main()
+{
+	bool passed = true;
+	for (int i = 0; i < (int)(sizeof(cases) / sizeof(cases[0])); i++)
+		passed = check_case(&cases[i]) && passed;
+	printf(passed ? "passed\n" : "FAILED\n");
+	return passed ? 0 : 1;
+}
@@ -0,0 +1,167 @@
+/*
+	Parallel lexing determinism test.
+
+	Generates sources of 1 MB and more, lexes each one serially and split into chunks for several thread
+	counts, and checks that every run produces the same tokens, symbol ids and result. The sources contain
+	string literals with newlines and escaped quotes placed across the points where the chunks would be cut,
+	lines that start with '-', and an input that fails partway through. Build and run from the repository
+	root on Linux:
+
+		cc -O2 -Isrc -o lex_determinism tests/lex_determinism.c src/tokenize.c src/symbol.c src/file_map.c src/scan.c src/parallel.c src/memstat.c -lpthread
+		./lex_determinism
+
+	Exits with 0 if every comparison matched.
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "tokenize.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define SOURCE_SIZE (2 << 20)
+
+static const char *const filler_lines[] =
+{
+	"u16 count = count + 1;\n",
+	"i16 value%d = (i16)0x%X - value%d * %d;\n",
+	"if (flag%d == true && other < 0x%x) { return name%d; }\n",
+	"\t-%d + total%d;\n",
+	"while (index%d <= %d) { index%d = index%d + 1; }\n",
+	"u8* pointer%d = &buffer%d; @array u8 data[%d];\n",
+	"text%d = \"a string with an \\\" escaped quote\";\n",
+	"call%d(argument, 0%o, %d, \"%d\");\n",
+};
+
+//A string literal long enough to cover a chunk cut, with newlines in it so a cut at a newline would land
+//inside the literal
+static int write_long_string(FILE *file)
+{
+	int written = fprintf(file, "message = \"");
+	for (int line = 0; line < 40; line++)
+		written += fprintf(file, "line %d of a literal that spans lines \\\" still inside\n", line);
+	written += fprintf(file, "\";\n");
+	return written;
+}
+
+//Writes exactly SOURCE_SIZE bytes. A long string literal starts shortly before every eighth of the file,
+//which is where the lexer cuts the source for 2, 4 and 8 threads. invalid_at places a byte that no token
+//can start with at that offset, or nowhere if it is 0.
+static bool generate_source(const char *path, long invalid_at)
+{
+	FILE *file = fopen(path, "wb");
+	if (!file) return false;
+
+	srand(12345);
+	long size = 0;
+	int next_cut = 1;
+	bool invalid_written = invalid_at == 0;
+	while (size < SOURCE_SIZE - 4096)
+	{
+		if (size >= (long)SOURCE_SIZE / 8 * next_cut - 512 && next_cut < 8)
+		{
+			size += write_long_string(file);
+			next_cut++;
+			continue;
+		}
+		if (!invalid_written && size >= invalid_at)
+		{
+			size += fprintf(file, "broken # token;\n");
+			invalid_written = true;
+			continue;
+		}
+
+		int n = rand() % 997;
+		const char *line = filler_lines[rand() % (sizeof(filler_lines) / sizeof(filler_lines[0]))];
+		size += fprintf(file, line, n, n * 31, n % 13, n + 1, n % 7, n * 3);
+	}
+	while (size < SOURCE_SIZE - 1)
+		size += fprintf(file, " ");
+	size += fprintf(file, "\n");
+
+	fclose(file);
+	return size == SOURCE_SIZE;
+}
+
+static bool same_tokens(TokenList *a, TokenList *b)
+{
+	if (a->tokens.size != b->tokens.size || a->failed != b->failed)
+	{
+		printf("\t%d tokens (failed %d) against %d tokens (failed %d)\n", a->tokens.size, a->failed, b->tokens.size, b->failed);
+		return false;
+	}
+
+	for (int i = 0; i < a->tokens.size; i++)
+	{
+		Token *x = &a->tokens.data[i];
+		Token *y = &b->tokens.data[i];
+		if (x->type != y->type || x->offset != y->offset || x->length != y->length || x->symbol != y->symbol ||
+			x->int_literal != y->int_literal || x->is_negative != y->is_negative)
+		{
+			printf("\ttoken %d differs at offset %u against %u\n", i, x->offset, y->offset);
+			return false;
+		}
+	}
+
+	if (a->symbols.symbols.size != b->symbols.symbols.size)
+	{
+		printf("\t%d symbols against %d\n", a->symbols.symbols.size, b->symbols.symbols.size);
+		return false;
+	}
+	for (int id = 0; id < a->symbols.symbols.size; id++)
+	{
+		if (strcmp(symbol_name(&a->symbols, id), symbol_name(&b->symbols, id)) != 0)
+		{
+			printf("\tsymbol %d is %s against %s\n", id, symbol_name(&a->symbols, id), symbol_name(&b->symbols, id));
+			return false;
+		}
+	}
+	return true;
+}
+
+static bool check_source(const char *name, long invalid_at, bool expect_success)
+{
+	static const int thread_counts[] = { 2, 3, 4, 7, 8, 16 };
+	char path[] = "/tmp/lex_determinism_XXXXXX";
+	int fd = mkstemp(path);
+	if (fd < 0 || !generate_source(path, invalid_at))
+	{
+		printf("%s: failed to generate source\n", name);
+		return false;
+	}
+	close(fd);
+
+	TokenList serial = token_list_create();
+	bool serial_success = tokenize_file_threads(path, &serial, 1);
+	bool passed = serial_success == expect_success;
+	if (!passed)
+		printf("%s: serial lexing returned %d\n", name, serial_success);
+
+	for (int i = 0; i < (int)(sizeof(thread_counts) / sizeof(thread_counts[0])); i++)
+	{
+		TokenList parallel = token_list_create();
+		bool parallel_success = tokenize_file_threads(path, &parallel, thread_counts[i]);
+		bool same = parallel_success == serial_success;
+		if (!same)
+			printf("\tlexing returned %d against %d\n", serial_success, parallel_success);
+		same = same && same_tokens(&serial, &parallel);
+		printf("%s, %d threads: %s\n", name, thread_counts[i], same ? "same" : "DIFFERENT");
+		passed = passed && same;
+		token_list_free(&parallel);
+	}
+
+	token_list_free(&serial);
+	remove(path);
+	return passed;
+}
+
+int main()
+{
+	bool passed = check_source("valid source", 0, true);
+	passed = check_source("invalid byte at 70%", SOURCE_SIZE / 10 * 7, false) && passed;
+	passed = check_source("invalid byte in the first chunk", 4096, false) && passed;
+	printf(passed ? "passed\n" : "FAILED\n");
+	return passed ? 0 : 1;
+}
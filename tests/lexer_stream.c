@@ -0,0 +1,198 @@
+/*
+	Streaming lexer test.
+
+	Streams generated sources through lexer_next and lexer_peek and checks every token, its text and its line
+	and column against tokenize_file, token_text and token_location. String literals with newlines cross the lexer's chunk
+	boundaries. Then streams a source with millions of lines and checks that the lexer's peak memory is
+	the same as for a source an eighth of its size and stays under a fixed bound. Build and run from the
+	repository root on Linux:
+
+		cc -O2 -Isrc -o lexer_stream tests/lexer_stream.c src/tokenize.c src/symbol.c src/file_map.c src/scan.c src/parallel.c src/memstat.c -lpthread
+		./lexer_stream
+
+	Exits with 0 if every check passed.
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "tokenize.h"
+#include "memstat.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+//The lexer's chunk buffer, the symbol table of the few names the sources use and the handle itself
+#define STREAM_MEMORY_BOUND (512 << 10)
+
+static bool generate_source(const char *path, long line_count, bool long_strings)
+{
+	FILE *file = fopen(path, "wb");
+	if (!file) return false;
+
+	for (long line = 0; line < line_count; line++)
+	{
+		switch (line % 7)
+		{
+		case 0:
+			fprintf(file, "u16 total = total + %ld;\n", line % 1000);
+			break;
+		case 1:
+			fprintf(file, "\tif (count < 0x%lX) { count = count * 2; }\n", line % 4096);
+			break;
+		case 2:
+			if (long_strings)
+			{
+				//Long enough that the literals regularly cross the 64 KB chunks of the lexer
+				fprintf(file, "text = \"");
+				for (int i = 0; i < 30; i++)
+					fprintf(file, "part %d of line %ld\n", i, line);
+				fprintf(file, "\";\n");
+			}
+			else
+				fprintf(file, "text = \"short\";\n");
+			break;
+		case 3:
+			fprintf(file, "\n\n   -%ld + name;\n", line % 97);
+			break;
+		default:
+			fprintf(file, "x = y;\n");
+		}
+	}
+
+	fclose(file);
+	return true;
+}
+
+static bool same_token(Token *a, Token *b)
+{
+	return a->type == b->type && a->offset == b->offset && a->length == b->length && a->symbol == b->symbol &&
+		a->int_literal == b->int_literal && a->is_negative == b->is_negative;
+}
+
+static bool same_location(SourceLocation a, SourceLocation b)
+{
+	return a.line == b.line && a.column == b.column;
+}
+
+static bool same_text(Lexer *lexer, Token *token, TokenList *list, Token *expected)
+{
+	return memcmp(lexer_token_text(lexer, token), token_text(list, expected), expected->length) == 0;
+}
+
+//Streams the file and compares it token by token with the list tokenize_file makes of it
+static bool check_tokens(const char *path)
+{
+	TokenList list = token_list_create();
+	tokenize_file_threads(path, &list, 1);
+
+	SymbolTable symbols = symbol_table_create();
+	Lexer *lexer = lexer_open(path, &symbols);
+	bool passed = true;
+	int index = 0;
+	while (passed)
+	{
+		//Peeking ahead must give the same tokens and locations as consuming them later
+		int k = index % LEXER_LOOKAHEAD;
+		Token *peeked = lexer_peek(lexer, k);
+		if (peeked && index + k < list.tokens.size)
+		{
+			Token *expected = &list.tokens.data[index + k];
+			passed = same_token(peeked, expected) && same_location(lexer_location(lexer, peeked), token_location(&list, expected)) &&
+				same_text(lexer, peeked, &list, expected);
+		}
+
+		Token token = lexer_next(lexer);
+		if (token.type == TOKEN_INVALID)
+			break;
+		if (index >= list.tokens.size)
+		{
+			passed = false;
+			break;
+		}
+
+		Token *expected = &list.tokens.data[index];
+		SourceLocation location = lexer_location(lexer, &token);
+		SourceLocation expected_location = token_location(&list, expected);
+		if (!same_token(&token, expected) || !same_location(location, expected_location) || !same_text(lexer, &token, &list, expected))
+		{
+			printf("\ttoken %d at %d:%d against %d:%d\n", index, location.line, location.column, expected_location.line, expected_location.column);
+			passed = false;
+		}
+		index++;
+	}
+
+	passed = passed && index == list.tokens.size && !lexer_failed(lexer) && symbols.symbols.size == list.symbols.symbols.size;
+	printf("tokens, text and locations of %d tokens: %s\n", index, passed ? "same" : "DIFFERENT");
+
+	lexer_close(lexer);
+	symbol_table_free(&symbols);
+	token_list_free(&list);
+	return passed;
+}
+
+//Peak bytes live while streaming the whole file
+static int64_t stream_peak(const char *path, long *token_count)
+{
+	MemPhase previous = mem_set_phase(MEM_PHASE_LEX);
+	SymbolTable symbols = symbol_table_create();
+	Lexer *lexer = lexer_open(path, &symbols);
+	int64_t peak = 0;
+	*token_count = 0;
+	while (lexer_next(lexer).type != TOKEN_INVALID)
+	{
+		if (++*token_count % 4096 == 0)
+		{
+			int64_t live = mem_phase_stats(MEM_PHASE_LEX).live;
+			if (live > peak) peak = live;
+		}
+	}
+	int64_t live = mem_phase_stats(MEM_PHASE_LEX).live;
+	if (live > peak) peak = live;
+	lexer_close(lexer);
+	symbol_table_free(&symbols);
+	mem_set_phase(previous);
+	return peak;
+}
+
+static bool check_memory(const char *small_path, const char *large_path)
+{
+	long small_tokens, large_tokens;
+	int64_t small_peak = stream_peak(small_path, &small_tokens);
+	int64_t large_peak = stream_peak(large_path, &large_tokens);
+	printf("peak lexer memory: %lld bytes for %ld tokens, %lld bytes for %ld tokens\n",
+		(long long)small_peak, small_tokens, (long long)large_peak, large_tokens);
+	return large_peak == small_peak && large_peak < STREAM_MEMORY_BOUND;
+}
+
+static bool make_temp(char *path)
+{
+	int fd = mkstemp(path);
+	if (fd < 0) return false;
+	close(fd);
+	return true;
+}
+
+int main()
+{
+	char strings_path[] = "/tmp/lexer_stream_XXXXXX";
+	char small_path[] = "/tmp/lexer_stream_XXXXXX";
+	char large_path[] = "/tmp/lexer_stream_XXXXXX";
+	if (!make_temp(strings_path) || !make_temp(small_path) || !make_temp(large_path) ||
+		!generate_source(strings_path, 20000, true) || !generate_source(small_path, 500000, false) ||
+		!generate_source(large_path, 4000000, false))
+	{
+		printf("Failed to generate sources\n");
+		return 1;
+	}
+
+	bool passed = check_tokens(strings_path);
+	passed = check_tokens(small_path) && passed;
+	passed = check_memory(small_path, large_path) && passed;
+
+	remove(strings_path);
+	remove(small_path);
+	remove(large_path);
+	printf(passed ? "passed\n" : "FAILED\n");
+	return passed ? 0 : 1;
+}
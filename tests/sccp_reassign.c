@@ -0,0 +1,141 @@
+/*
+	Constant propagation test for variables that are assigned more than once.
+
+	Compiles small functions, runs ir_sccp on them and counts the branches and the arithmetic left. A value
+	computed from a variable before the variable is assigned again must still fold, a phi whose incoming
+	values agree must fold, and branches on values that differ by path or by loop iteration must stay.
+	Build and run from the repository root on Linux:
+
+		cc -O2 -Isrc -o sccp_reassign tests/sccp_reassign.c $(find src -name '*.c' ! -name main.c) -lpthread
+		./sccp_reassign
+
+	Exits with 0 if every function was left with the expected instructions.
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "tokenize.h"
+#include "ast.h"
+#include "compiler.h"
+#include "opt.h"
+#include "arena.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+typedef struct
+{
+	const char *name;
+	const char *source;
+	int branches;
+	int arithmetic;
+} SccpCase;
+
+static const SccpCase cases[] =
+{
+	{
+		"value read before the variable is assigned again",
+		"u8 f(u8 a)\n"
+		"{\n"
+		"	u8 y = 3;\n"
+		"	u8 z = y * 2 + 1;\n"
+		"	if (z == 7) { a = a + 1; }\n"
+		"	y = a;\n"
+		"	return y;\n"
+		"}\n",
+		0, 1
+	},
+	{
+		"paths that assign the same constant",
+		"u8 f(u8 a)\n"
+		"{\n"
+		"	u8 y = 0;\n"
+		"	if (a == 1) { y = 5; } else { y = 5; }\n"
+		"	if (y == 5) { return 1; }\n"
+		"	return 2;\n"
+		"}\n",
+		1, 0
+	},
+	{
+		"paths that assign different constants",
+		"u8 f(u8 a)\n"
+		"{\n"
+		"	u8 y = 3;\n"
+		"	if (a == 1) { y = 4; }\n"
+		"	if (y == 3) { return 1; }\n"
+		"	return 2;\n"
+		"}\n",
+		2, 0
+	},
+	{
+		"counter assigned in a loop",
+		"u8 f(u8 a)\n"
+		"{\n"
+		"	u8 i = 0;\n"
+		"	while (i < 3) { i = i + 1; }\n"
+		"	return i;\n"
+		"}\n",
+		1, 1
+	},
+};
+
+static bool check_case(const SccpCase *test)
+{
+	char path[] = "/tmp/sccp_reassign_XXXXXX";
+	int fd = mkstemp(path);
+	FILE *file = fd < 0 ? NULL : fdopen(fd, "wb");
+	if (!file)
+	{
+		printf("%s: failed to write source\n", test->name);
+		return false;
+	}
+	fputs(test->source, file);
+	fclose(file);
+
+	TokenList list = token_list_create();
+	tokenize_file(path, &list);
+	AstUnit unit;
+	ast_parse_unit(&list, &unit);
+	Arena arena = arena_create(0);
+	struct CompilerContext ctx = compiler_create_context(&arena);
+
+	bool passed = compile_unit(&ctx, &unit);
+	if (!passed)
+		printf("%s: failed to compile\n", test->name);
+	for (int f = 0; passed && f < ctx.ir_context.functions.size; f++)
+	{
+		struct IrFunction *function = &ctx.ir_context.functions.data[f];
+		ir_sccp(&ctx.ir_context, function);
+
+		int branches = 0;
+		int arithmetic = 0;
+		struct IrInstBuffer *insts = &function->insts;
+		for (IrInstIndex i = insts->first; i != IR_INST_INDEX_NONE; i = insts->next[i])
+		{
+			enum IrInstType opcode = insts->opcodes[i];
+			branches += opcode == IRINST_BRANCH;
+			arithmetic += opcode == IRINST_ADD || opcode == IRINST_SUB || opcode == IRINST_MUL;
+		}
+
+		passed = branches == test->branches && arithmetic == test->arithmetic;
+		printf("%s: %d branches, %d arithmetic%s\n", test->name, branches, arithmetic, passed ? "" : " (WRONG)");
+		if (!passed)
+			ir_print_context(&ctx.ir_context, stdout);
+	}
+
+	compiler_free_context(&ctx);
+	ast_unit_free(&unit);
+	arena_free(&arena);
+	token_list_free(&list);
+	remove(path);
+	return passed;
+}
+
+int main()
+{
+	bool passed = true;
+	for (int i = 0; i < (int)(sizeof(cases) / sizeof(cases[0])); i++)
+		passed = check_case(&cases[i]) && passed;
+	printf(passed ? "passed\n" : "FAILED\n");
+	return passed ? 0 : 1;
+}
@@ -0,0 +1,148 @@
+/*
+	Incremental relexing test.
+
+	Generates a source, applies thousands of random edits to it with token_list_edit and after every edit
+	lexes the edited source from scratch with tokenize_file. The tokens, their offsets, the names of their
+	symbols, their text and token_location must match. The edits insert and delete across string literals
+	with newlines, numbers that a '-' joins and splits and bytes no token can start with, and
+	token_list_settle is called at random points in between. Build and run from the repository root on Linux:
+
+		cc -O2 -Isrc -o token_edit tests/token_edit.c src/tokenize.c src/symbol.c src/file_map.c src/scan.c src/parallel.c src/memstat.c -lpthread
+		./token_edit
+
+	Exits with 0 if the list matched the fresh lexing after every edit.
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "tokenize.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define EDIT_COUNT 3000
+
+static const char *const source_lines[] =
+{
+	"u16 count = count + 1;\n",
+	"i16 value = (i16)0x1F - value * 3;\n",
+	"if (flag == true && other < 0x7f) { return name; }\n",
+	"\t-12 + total;\n",
+	"while (index <= 40) { index = index + 1; }\n",
+	"u8* pointer = &buffer; @array u8 data[8];\n",
+	"text = \"a string with an \\\" escaped quote\";\n",
+	"note = \"a literal\nthat spans lines\";\n",
+};
+
+static const char *const fragments[] =
+{
+	" ", "\n", "\t", "x", "abc", "name", "1", "42", "-", "->", "-5", "0x1f", "\"", "\"hi\"", "\"a\nb\"", "\\",
+	"(", ")", "{", "}", ";", "u8", "i16", "if", "while", "=", "==", "<=", "&&", "+", "*", "#", " \n  ",
+};
+
+#define COUNT(array) ((int)(sizeof(array) / sizeof(array[0])))
+
+static bool write_source(const char *path, const char *data, uint32_t length)
+{
+	FILE *file = fopen(path, "wb");
+	if (!file) return false;
+	bool written = fwrite(data, 1, length, file) == length;
+	fclose(file);
+	return written;
+}
+
+//Offset of the token once the shift token_list_edit left pending is applied
+static uint32_t settled_offset(TokenList *list, int index)
+{
+	Token *token = &list->tokens.data[index];
+	return index >= list->shift_start ? token->offset + list->shift_offset : token->offset;
+}
+
+static bool same_as_fresh(TokenList *list, bool edit_success, TokenList *fresh, bool fresh_success)
+{
+	if (edit_success != fresh_success || list->failed != fresh->failed || list->tokens.size != fresh->tokens.size)
+	{
+		printf("\t%d tokens (result %d) against %d tokens (result %d)\n", list->tokens.size, edit_success,
+			fresh->tokens.size, fresh_success);
+		return false;
+	}
+
+	for (int i = 0; i < list->tokens.size; i++)
+	{
+		Token *x = &list->tokens.data[i];
+		Token *y = &fresh->tokens.data[i];
+		SourceLocation a = token_location(list, x);
+		SourceLocation b = token_location(fresh, y);
+		bool same = x->type == y->type && settled_offset(list, i) == y->offset && x->length == y->length &&
+			x->int_literal == y->int_literal && x->is_negative == y->is_negative &&
+			memcmp(token_text(list, x), token_text(fresh, y), y->length) == 0 && a.line == b.line && a.column == b.column;
+		//Symbol ids depend on the order names were first seen in, so the names are compared
+		if (same && y->type == TOKEN_IDENTIFIER)
+			same = strcmp(symbol_name(&list->symbols, x->symbol), symbol_name(&fresh->symbols, y->symbol)) == 0;
+		if (!same)
+		{
+			printf("\ttoken %d at %u (%d:%d) against %u (%d:%d)\n", i, settled_offset(list, i), a.line, a.column,
+				y->offset, b.line, b.column);
+			return false;
+		}
+	}
+	return true;
+}
+
+static bool check_edits(unsigned seed)
+{
+	char path[] = "/tmp/token_edit_XXXXXX";
+	int fd = mkstemp(path);
+	if (fd < 0)
+	{
+		printf("seed %u: failed to create source\n", seed);
+		return false;
+	}
+	close(fd);
+
+	srand(seed);
+	char source[4096] = "";
+	for (int i = 0; i < 60; i++)
+		strcat(source, source_lines[rand() % COUNT(source_lines)]);
+
+	TokenList list = token_list_create();
+	bool passed = write_source(path, source, strlen(source));
+	bool success = passed && tokenize_file(path, &list);
+	int edit;
+	for (edit = 0; passed && edit < EDIT_COUNT; edit++)
+	{
+		uint32_t start = rand() % (list.source_length + 1);
+		uint32_t old_length = rand() % 6;
+		if (old_length > list.source_length - start)
+			old_length = list.source_length - start;
+		char new_text[64] = "";
+		for (int count = rand() % 3; count > 0; count--)
+			strcat(new_text, fragments[rand() % COUNT(fragments)]);
+
+		success = token_list_edit(&list, start, old_length, new_text, strlen(new_text));
+		if (rand() % 4 == 0)
+			token_list_settle(&list);
+
+		TokenList fresh = token_list_create();
+		bool fresh_success = write_source(path, list.source, list.source_length) && tokenize_file(path, &fresh);
+		passed = same_as_fresh(&list, success, &fresh, fresh_success);
+		if (!passed)
+			printf("\tedit %d replaced %u bytes at %u with \"%s\"\n", edit, old_length, start, new_text);
+		token_list_free(&fresh);
+	}
+
+	printf("seed %u, %d edits: %s\n", seed, edit, passed ? "same" : "DIFFERENT");
+	token_list_free(&list);
+	remove(path);
+	return passed;
+}
+
+int main()
+{
+	bool passed = true;
+	for (unsigned seed = 1; seed <= 8; seed++)
+		passed = check_edits(seed) && passed;
+	printf(passed ? "passed\n" : "FAILED\n");
+	return passed ? 0 : 1;
+}